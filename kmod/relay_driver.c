@@ -8,6 +8,9 @@
 #include <linux/slab.h>
 #include <linux/mutex.h>
 #include <linux/idr.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/kref.h>
 
 #define USB_VENDOR_ID_RELAY      0x0403
 #define USB_PRODUCT_ID_RELAY     0x6001
@@ -21,17 +24,31 @@ MODULE_AUTHOR("Ethan Austin-Cruse");
 MODULE_DESCRIPTION("SainSmart 5V USB Relay Driver");
 MODULE_LICENSE("GPL");
 
-/* Per-device state */
+/*
+ * Per-device state. Open files hold a reference, so it outlives an
+ * unplug until the last one is closed; once disconnected is set the
+ * board is gone and every file operation fails.
+ */
 struct usbrelay {
+    struct kref            kref;
     struct usb_device     *udev;
     struct usb_interface  *intf;
-    struct cdev            cdev;
+    struct cdev           *cdev;
     dev_t                  devt;
     int                    minor;
     u8                     relay_state;
     u8                     bulk_in_ep;
     u8                     bulk_out_ep;
     struct mutex           lock;
+    u32                    state_seq;   /* bumped on every mask change */
+    wait_queue_head_t      state_wait;  /* pollers waiting for a change */
+    bool                   disconnected; /* set under lock on unplug */
+};
+
+/* Per-open state: the change a reader has last seen */
+struct usbrelay_client {
+    struct usbrelay *dev;
+    u32              seen_seq;
 };
 
 /* Globals for char devices */
@@ -40,11 +57,16 @@ static int usbrelay_major;
 static struct class *usbrelay_class;
 static DEFINE_IDA(usbrelay_ida);  /* allocate minors safely */
 
+/* Minor -> device, for open(); cleared on disconnect */
+static DEFINE_MUTEX(usbrelay_table_lock);
+static struct usbrelay *usbrelay_table[USBRELAY_MAX_DEVICES];
+
 /* Fops forward declarations */
 static int usbrelay_open(struct inode *inode, struct file *file);
 static int usbrelay_release(struct inode *inode, struct file *file);
 static ssize_t usbrelay_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos);
 static ssize_t usbrelay_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
+static __poll_t usbrelay_poll(struct file *file, poll_table *wait);
 
 static const struct file_operations usbrelay_fops = {
     .owner   = THIS_MODULE,
@@ -52,6 +74,7 @@ static const struct file_operations usbrelay_fops = {
     .release = usbrelay_release,
     .write   = usbrelay_write,
     .read = usbrelay_read,
+    .poll    = usbrelay_poll,
 };
 
 /* Helper: push current relay_state to device via bulk OUT */
@@ -73,6 +96,13 @@ static int usbrelay_push_state(struct usbrelay *dev) {
     return 0;
 }
 
+static void usbrelay_delete(struct kref *kref) {
+    struct usbrelay *dev = container_of(kref, struct usbrelay, kref);
+
+    usb_put_dev(dev->udev);
+    kfree(dev);
+}
+
 static int usbrelay_probe(struct usb_interface *intf, const struct usb_device_id *id) {
     struct usbrelay *dev = NULL;
     struct usb_host_interface *iface_desc;
@@ -91,10 +121,12 @@ static int usbrelay_probe(struct usb_interface *intf, const struct usb_device_id
         goto error;
     }
 
+    kref_init(&dev->kref);
     dev->udev  = usb_get_dev(interface_to_usbdev(intf));
     dev->intf  = intf;
     dev->relay_state = 0x00;   /* start with all relays off */
     mutex_init(&dev->lock);
+    init_waitqueue_head(&dev->state_wait);
 
     usb_set_intfdata(intf, dev);
 
@@ -127,13 +159,24 @@ static int usbrelay_probe(struct usb_interface *intf, const struct usb_device_id
     dev->minor = minor;
     dev->devt  = MKDEV(usbrelay_major, minor);
 
-    cdev_init(&dev->cdev, &usbrelay_fops);
-    dev->cdev.owner = THIS_MODULE;
+    /* Allocated apart from dev: the last fput() drops the cdev after
+     * usbrelay_release(), which may already have freed dev */
+    dev->cdev = cdev_alloc();
+    if (!dev->cdev) {
+        retval = -ENOMEM;
+        goto error_ida;
+    }
+    dev->cdev->ops = &usbrelay_fops;
+    dev->cdev->owner = THIS_MODULE;
+
+    mutex_lock(&usbrelay_table_lock);
+    usbrelay_table[minor] = dev;
+    mutex_unlock(&usbrelay_table_lock);
 
-    retval = cdev_add(&dev->cdev, dev->devt, 1);
+    retval = cdev_add(dev->cdev, dev->devt, 1);
     if (retval) {
         pr_err("usbrelay: cdev_add failed: %d\n", retval);
-        goto error_ida;
+        goto error_cdev;
     }
 
     if (!usbrelay_class) {
@@ -180,18 +223,21 @@ error_device:
     device_destroy(usbrelay_class, dev->devt);
 
 error_cdev:
-    cdev_del(&dev->cdev);
+    mutex_lock(&usbrelay_table_lock);
+    usbrelay_table[minor] = NULL;
+    mutex_unlock(&usbrelay_table_lock);
+    mutex_lock(&dev->lock);
+    dev->disconnected = true;   /* in case it was opened meanwhile */
+    mutex_unlock(&dev->lock);
+    cdev_del(dev->cdev);
 
 error_ida:
     ida_simple_remove(&usbrelay_ida, minor);
 
 error:
-    if (dev) {
-        if (dev->udev)
-            usb_put_dev(dev->udev);
-        kfree(dev);
-    }
     usb_set_intfdata(intf, NULL);
+    if (dev)
+        kref_put(&dev->kref, usbrelay_delete);
     return retval;
 }
 
@@ -203,16 +249,24 @@ static void usbrelay_disconnect(struct usb_interface *intf) {
     if (!dev)
         return;
 
+    /* No new opens; fail the open files and wake their pollers */
+    mutex_lock(&usbrelay_table_lock);
+    usbrelay_table[dev->minor] = NULL;
+    mutex_unlock(&usbrelay_table_lock);
+
+    mutex_lock(&dev->lock);
+    dev->disconnected = true;
+    mutex_unlock(&dev->lock);
+    wake_up_interruptible_all(&dev->state_wait);
+
     device_destroy(usbrelay_class, dev->devt);
-    cdev_del(&dev->cdev);
+    cdev_del(dev->cdev);
     ida_simple_remove(&usbrelay_ida, dev->minor);
 
     usb_set_intfdata(intf, NULL);
 
-    if (dev->udev)
-        usb_put_dev(dev->udev);
-
-    kfree(dev);
+    /* Freed here, or by the release of the last open file */
+    kref_put(&dev->kref, usbrelay_delete);
 
     pr_info("usbrelay: device disconnected and resources cleaned up\n");
 }
@@ -236,21 +290,47 @@ static struct usb_driver usbrelay_driver = {
 
 static int usbrelay_open(struct inode *inode, struct file *file) {
     struct usbrelay *dev;
+    struct usbrelay_client *client;
 
-    /* Get back to our usbrelay struct from the cdev */
-    dev = container_of(inode->i_cdev, struct usbrelay, cdev);
-    if (!dev)
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if (!client)
+        return -ENOMEM;
+
+    /* Look the board up and pin it; disconnect removes it first */
+    mutex_lock(&usbrelay_table_lock);
+    dev = iminor(inode) < USBRELAY_MAX_DEVICES ? usbrelay_table[iminor(inode)] : NULL;
+    if (dev)
+        kref_get(&dev->kref);
+    mutex_unlock(&usbrelay_table_lock);
+
+    if (!dev) {
+        kfree(client);
         return -ENODEV;
-    file->private_data = dev;
+    }
+    client->dev = dev;
+
+    mutex_lock(&dev->lock);
+    client->seen_seq = dev->state_seq;
+    mutex_unlock(&dev->lock);
+
+    file->private_data = client;
     return 0;
 }
 
 static int usbrelay_release(struct inode *inode, struct file *file) {
+    struct usbrelay_client *client = file->private_data;
+
+    if (client) {
+        kref_put(&client->dev->kref, usbrelay_delete);
+        kfree(client);
+    }
+    file->private_data = NULL;
     return 0;
 }
 
 static ssize_t usbrelay_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
-    struct usbrelay *dev = file->private_data;
+    struct usbrelay_client *client = file->private_data;
+    struct usbrelay *dev = client ? client->dev : NULL;
     u8 mask;
 
     if (!dev)
@@ -260,7 +340,12 @@ static ssize_t usbrelay_read(struct file *file, char __user *buf, size_t count,
         return -EINVAL;  /* caller must request at least 1 byte */
 
     mutex_lock(&dev->lock);
+    if (dev->disconnected) {
+        mutex_unlock(&dev->lock);
+        return -ENODEV;
+    }
     mask = dev->relay_state;
+    client->seen_seq = dev->state_seq;  /* this reader is now up to date */
     mutex_unlock(&dev->lock);
 
     if (copy_to_user(buf, &mask, 1))
@@ -271,9 +356,38 @@ static ssize_t usbrelay_read(struct file *file, char __user *buf, size_t count,
 }
 
 
+/*
+ * The mask can always be read and written without blocking, so POLLIN and
+ * POLLOUT are not meaningful on their own. Instead a file becomes readable
+ * with POLLPRI once the mask has changed (through any open file) since it
+ * last read it, which lets a monitor sleep until there is news. After an
+ * unplug every file reports POLLHUP | POLLERR.
+ */
+static __poll_t usbrelay_poll(struct file *file, poll_table *wait) {
+    struct usbrelay_client *client = file->private_data;
+    struct usbrelay *dev = client ? client->dev : NULL;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    if (!dev)
+        return EPOLLERR | EPOLLHUP;
+
+    poll_wait(file, &dev->state_wait, wait);
+
+    mutex_lock(&dev->lock);
+    if (dev->disconnected)
+        mask = EPOLLHUP | EPOLLERR;
+    else if (client->seen_seq != dev->state_seq)
+        mask |= EPOLLIN | EPOLLRDNORM | EPOLLPRI;
+    mutex_unlock(&dev->lock);
+
+    return mask;
+}
+
 static ssize_t usbrelay_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
-    struct usbrelay *dev = file->private_data;
+    struct usbrelay_client *client = file->private_data;
+    struct usbrelay *dev = client ? client->dev : NULL;
     u8 mask;
+    int changed;
     int retval;
 
     if (!dev)
@@ -287,11 +401,21 @@ static ssize_t usbrelay_write(struct file *file, const char __user *buf, size_t
 
     mutex_lock(&dev->lock);
 
+    if (dev->disconnected) {
+        mutex_unlock(&dev->lock);
+        return -ENODEV;
+    }
+    changed = dev->relay_state != mask;
     dev->relay_state = mask;
     retval = usbrelay_push_state(dev);
+    if (changed)
+        dev->state_seq++;       /* the shadow mask changed, even on failure */
 
     mutex_unlock(&dev->lock);
 
+    if (changed)
+        wake_up_interruptible(&dev->state_wait);
+
     if (retval)
         return retval;
 
@@ -0,0 +1,221 @@
+// async_bench.cpp - coroutine client (relay_async.hpp) vs blocking calls
+//
+// Drives the same set workload over every -d board three ways:
+//
+//   oneshot    one blocking "relayctl set" process per operation
+//   blocking   relay_set() from librelay, one call after another, in one
+//              thread (a read and a write per operation)
+//   async      one EventLoop thread, -t coroutines per board, each
+//              awaiting its operations one at a time; operations queued
+//              while a board was busy share its next read and write
+//
+// For each it prints ops/sec, per-operation latency percentiles and the
+// device writes made per operation.
+//
+// Usage: async_bench [-d device]... [-n ops-per-board] [-t tasks-per-board]
+//                    [-s oneshot-runs] [-r relayctl]
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/relay_async.hpp"
+
+namespace {
+
+struct Result {
+    const char *name;
+    long ops = 0;
+    double opsPerSec = 0, p50Us = 0, p99Us = 0, maxUs = 0, writesPerOp = 0;
+};
+
+void summarize(Result &r, std::vector<std::int64_t> &lat, std::int64_t elapsedNs) {
+    std::sort(lat.begin(), lat.end());
+    long n = static_cast<long>(lat.size());
+    r.ops = n;
+    r.opsPerSec = elapsedNs ? static_cast<double>(n) * 1e9 / static_cast<double>(elapsedNs) : 0.0;
+    r.p50Us = static_cast<double>(lat[static_cast<std::size_t>((n - 1) * 50 / 100)]) / 1e3;
+    r.p99Us = static_cast<double>(lat[static_cast<std::size_t>((n - 1) * 99 / 100)]) / 1e3;
+    r.maxUs = static_cast<double>(lat[static_cast<std::size_t>(n - 1)]) / 1e3;
+}
+
+int benchOneshot(const std::string &relayctl, const std::vector<std::string> &devs, long runs,
+                 Result &r) {
+    std::vector<std::int64_t> lat;
+    std::int64_t start = usbrelay::detail::nowNs();
+
+    for (long i = 0; i < runs; i++) {
+        const std::string &dev = devs[static_cast<std::size_t>(i) % devs.size()];
+        std::string ch = std::to_string(1 + i % 4);
+        std::int64_t t0 = usbrelay::detail::nowNs();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) {
+                dup2(null, STDOUT_FILENO);
+            }
+            execl(relayctl.c_str(), relayctl.c_str(), "-d", dev.c_str(), "set", ch.c_str(),
+                  (i & 1) ? "on" : "off", static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::fprintf(stderr, "async_bench: %s set failed\n", relayctl.c_str());
+            return 1;
+        }
+        lat.push_back(usbrelay::detail::nowNs() - t0);
+    }
+    summarize(r, lat, usbrelay::detail::nowNs() - start);
+    r.writesPerOp = 1.0;
+    return 0;
+}
+
+int benchBlocking(const std::vector<std::string> &devs, long perBoard, Result &r) {
+    std::vector<struct relay_board *> boards;
+    for (const auto &d : devs) {
+        struct relay_board *b;
+        if (relay_open(&b, d.c_str()) != USBRELAY_OK) {
+            perror(d.c_str());
+            for (auto *o : boards) {
+                relay_close(o);
+            }
+            return 1;
+        }
+        boards.push_back(b);
+    }
+
+    std::vector<std::int64_t> lat;
+    std::int64_t start = usbrelay::detail::nowNs();
+    int rc = 0;
+    for (long i = 0; i < perBoard && rc == 0; i++) {
+        for (auto *b : boards) {
+            std::int64_t t0 = usbrelay::detail::nowNs();
+            if (relay_set(b, static_cast<int>(1 + i % 4), static_cast<int>(i & 1)) != USBRELAY_OK) {
+                std::fprintf(stderr, "async_bench: relay_set failed\n");
+                rc = 1;
+                break;
+            }
+            lat.push_back(usbrelay::detail::nowNs() - t0);
+        }
+    }
+    if (rc == 0) {
+        summarize(r, lat, usbrelay::detail::nowNs() - start);
+        r.writesPerOp = 1.0;
+    }
+    for (auto *b : boards) {
+        relay_close(b);
+    }
+    return rc;
+}
+
+usbrelay::Task<> worker(usbrelay::AsyncBoard &b, long id, long ops,
+                        std::vector<std::int64_t> &lat) {
+    for (long i = 0; i < ops; i++) {
+        std::int64_t t0 = usbrelay::detail::nowNs();
+        co_await b.set(static_cast<int>(1 + (id + i) % 4), (i & 1) != 0);
+        lat.push_back(usbrelay::detail::nowNs() - t0);
+    }
+}
+
+int benchAsync(const std::vector<std::string> &devs, long perBoard, long tasks, Result &r) {
+    usbrelay::EventLoop loop;
+    std::vector<std::unique_ptr<usbrelay::AsyncBoard>> boards;
+    std::vector<std::int64_t> lat;
+
+    lat.reserve(static_cast<std::size_t>(perBoard) * devs.size());
+    for (const auto &d : devs) {
+        boards.push_back(std::make_unique<usbrelay::AsyncBoard>(loop, d));
+    }
+    for (auto &b : boards) {
+        for (long t = 0; t < tasks; t++) {
+            long ops = perBoard / tasks + (t < perBoard % tasks ? 1 : 0);
+            loop.spawn(worker(*b, t, ops, lat));
+        }
+    }
+
+    std::int64_t start = usbrelay::detail::nowNs();
+    loop.run();
+    summarize(r, lat, usbrelay::detail::nowNs() - start);
+
+    unsigned long writes = 0;
+    for (auto &b : boards) {
+        writes += b->deviceWrites();
+    }
+    r.writesPerOp = static_cast<double>(writes) / static_cast<double>(r.ops);
+    return 0;
+}
+
+void printTable(const std::vector<Result> &res) {
+    std::printf("%-10s %10s %9s %9s %9s %9s\n", "case", "ops/sec", "p50 us", "p99 us", "max us",
+                "writes/op");
+    for (const auto &r : res) {
+        std::printf("%-10s %10.0f %9.2f %9.2f %9.2f %9.3f\n", r.name, r.opsPerSec, r.p50Us,
+                    r.p99Us, r.maxUs, r.writesPerOp);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<std::string> devs;
+    std::string relayctl = "./tools/relayctl";
+    long perBoard = 10000;
+    long tasks = 64;
+    long runs = 200;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:t:s:r:")) != -1) {
+        switch (opt) {
+        case 'd': devs.push_back(optarg); break;
+        case 'n': perBoard = std::strtol(optarg, nullptr, 10); break;
+        case 't': tasks = std::strtol(optarg, nullptr, 10); break;
+        case 's': runs = std::strtol(optarg, nullptr, 10); break;
+        case 'r': relayctl = optarg; break;
+        default:
+            std::fprintf(stderr, "usage: %s [-d device]... [-n ops-per-board] [-t tasks-per-board] "
+                         "[-s oneshot-runs] [-r relayctl]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (devs.empty()) {
+        devs.push_back(USBRELAY_DEFAULT_DEVICE);
+    }
+    if (perBoard <= 0 || tasks <= 0 || runs <= 0) {
+        std::fprintf(stderr, "async_bench: need -n, -t and -s > 0\n");
+        return 1;
+    }
+
+    std::printf("async_bench: %zu board(s), %ld ops per board, %ld tasks per board, "
+                "%ld oneshot runs\n", devs.size(), perBoard, tasks, runs);
+
+    std::fflush(stdout);
+
+    std::vector<Result> res(3);
+    res[0].name = "oneshot";
+    res[1].name = "blocking";
+    res[2].name = "async";
+    try {
+        if (benchOneshot(relayctl, devs, runs, res[0]) != 0 ||
+            benchBlocking(devs, perBoard, res[1]) != 0 ||
+            benchAsync(devs, perBoard, tasks, res[2]) != 0) {
+            return 1;
+        }
+    } catch (const usbrelay::RelayError &e) {
+        std::fprintf(stderr, "async_bench: %s\n", e.what());
+        return 1;
+    }
+    printTable(res);
+    return 0;
+}
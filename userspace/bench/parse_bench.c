@@ -0,0 +1,76 @@
+/* parse_bench.c - throughput of the relayctl command parser
+ *
+ * Parses a mix of typical protocol lines in a tight loop and reports
+ * lines/sec and ns/line. The line is copied back into a scratch buffer
+ * before each parse because parsing is in place.
+ *
+ * Usage: parse_bench [iterations]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/usbrelay.h"
+#include "../tools/relayctl_parse.h"
+
+static const char *const bench_lines[] = {
+    "set 1 on",
+    "SET 4 OFF",
+    "get 2",
+    "getall",
+    "toggle 3",
+    "write-mask 0x0A",
+    "read-mask",
+    "reset",
+    "ping",
+    "frobnicate 1",
+};
+
+#define NUM_LINES   (sizeof(bench_lines) / sizeof(bench_lines[0]))
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    long iterations = 2000000;
+    char scratch[NUM_LINES][USBRELAY_MAX_LINE_LEN];
+    size_t lens[NUM_LINES];
+    struct relayctl_command cmd;
+    unsigned long ok = 0, failed = 0;
+
+    if (argc > 1) {
+        iterations = strtol(argv[1], NULL, 10);
+        if (iterations <= 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_LINES; i++) {
+        lens[i] = strlen(bench_lines[i]) + 1;
+    }
+
+    double t0 = now_sec();
+    for (long n = 0; n < iterations; n++) {
+        size_t i = (size_t)n % NUM_LINES;
+        memcpy(scratch[i], bench_lines[i], lens[i]);
+        if (relayctl_parse_line(scratch[i], &cmd) == 0) {
+            ok++;
+        } else {
+            failed++;
+        }
+    }
+    double elapsed = now_sec() - t0;
+
+    printf("parse_bench: %ld lines in %.3f s (%lu ok, %lu rejected)\n",
+           iterations, elapsed, ok, failed);
+    printf("parse_bench: %.0f lines/sec, %.1f ns/line\n",
+           (double)iterations / elapsed, elapsed * 1e9 / (double)iterations);
+    return 0;
+}
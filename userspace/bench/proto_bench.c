@@ -0,0 +1,261 @@
+/* proto_bench.c - ASCII vs binary framing throughput of a relayctl session
+ *
+ * Starts "relayctl -d <device> -i" on a pair of pipes and pushes the same
+ * command mix through it twice: once as ASCII lines and once as binary
+ * frames after negotiating BINARY. Commands are pipelined in batches so
+ * many of them share one read/write syscall on each side.
+ *
+ * Usage: proto_bench [-d device] [-n commands] [-b batch] [-r relayctl]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/usbrelay.h"
+
+struct session {
+    pid_t pid;
+    int to_child;
+    int from_child;
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Read until count newline-terminated lines have arrived */
+static int read_lines(int fd, long count) {
+    char buf[4096];
+    while (count > 0) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') {
+                count--;
+            }
+        }
+    }
+    return 0;
+}
+
+static int session_start(struct session *s, const char *relayctl, const char *dev) {
+    int in[2], out[2];
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    s->pid = fork();
+    if (s->pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (s->pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execl(relayctl, relayctl, "-d", dev, "-i", (char *)NULL);
+        perror(relayctl);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    s->to_child = in[1];
+    s->from_child = out[0];
+
+    /* Skip the REPL banner: sync on the reply to a ping */
+    const char *sync = "ping\n";
+    char c, prev = '\n', line[8];
+    size_t len = 0;
+    if (write_all(s->to_child, sync, strlen(sync)) != 0) {
+        return 1;
+    }
+    for (;;) {
+        if (read(s->from_child, &c, 1) != 1) {
+            fprintf(stderr, "proto_bench: relayctl exited during startup\n");
+            return 1;
+        }
+        if (prev == '\n') {
+            len = 0;
+        }
+        if (len < sizeof(line)) {
+            line[len++] = c;
+        }
+        prev = c;
+        if (c == '\n' && len == 3 && memcmp(line, "OK\n", 3) == 0) {
+            return 0;
+        }
+    }
+}
+
+static void session_stop(struct session *s) {
+    close(s->to_child);
+    close(s->from_child);
+    waitpid(s->pid, NULL, 0);
+}
+
+static const char *const ascii_cmds[] = {
+    "set 1 on\n", "toggle 2\n", "get 1\n", "write-mask 0x05\n", "getall\n",
+};
+
+#define NUM_CMDS    (sizeof(ascii_cmds) / sizeof(ascii_cmds[0]))
+
+static void fill_frame(struct usbrelay_frame *f, long i) {
+    memset(f, 0, sizeof(*f));
+    f->seq = (uint16_t)i;
+    switch (i % (long)NUM_CMDS) {
+    case 0: f->op = USBRELAY_OP_SET; f->channel = 1; f->arg = 1; break;
+    case 1: f->op = USBRELAY_OP_TOGGLE; f->channel = 2; break;
+    case 2: f->op = USBRELAY_OP_GET; f->channel = 1; break;
+    case 3: f->op = USBRELAY_OP_WRITE_MASK; f->arg = 0x05; break;
+    default: f->op = USBRELAY_OP_GETALL; break;
+    }
+}
+
+static double run_ascii(struct session *s, long total, long batch, size_t *bytes) {
+    static char buf[64 * 1024];
+    double t0 = now_sec();
+
+    *bytes = 0;
+    for (long done = 0; done < total; done += batch) {
+        long n = (total - done < batch) ? total - done : batch;
+        size_t len = 0;
+        for (long i = 0; i < n; i++) {
+            const char *c = ascii_cmds[(size_t)(done + i) % NUM_CMDS];
+            size_t cl = strlen(c);
+            memcpy(buf + len, c, cl);
+            len += cl;
+        }
+        *bytes += len;
+        if (write_all(s->to_child, buf, len) != 0 || read_lines(s->from_child, n) != 0) {
+            return -1.0;
+        }
+    }
+    return now_sec() - t0;
+}
+
+static double run_binary(struct session *s, long total, long batch, size_t *bytes) {
+    static struct usbrelay_frame frames[4096];
+    const char *neg = "binary\n";
+
+    if (write_all(s->to_child, neg, strlen(neg)) != 0 || read_lines(s->from_child, 1) != 0) {
+        return -1.0;
+    }
+
+    double t0 = now_sec();
+    *bytes = 0;
+    for (long done = 0; done < total; done += batch) {
+        long n = (total - done < batch) ? total - done : batch;
+        for (long i = 0; i < n; i++) {
+            fill_frame(&frames[i], done + i);
+        }
+        *bytes += (size_t)n * sizeof(frames[0]);
+        if (write_all(s->to_child, frames, (size_t)n * sizeof(frames[0])) != 0 ||
+            read_all(s->from_child, frames, (size_t)n * sizeof(frames[0])) != 0) {
+            return -1.0;
+        }
+    }
+    return now_sec() - t0;
+}
+
+int main(int argc, char **argv) {
+    const char *dev = USBRELAY_DEFAULT_DEVICE;
+    const char *relayctl = "./tools/relayctl";
+    long total = 100000;
+    long batch = 64;
+    struct session s;
+    size_t bytes;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:b:r:")) != -1) {
+        switch (opt) {
+        case 'd': dev = optarg; break;
+        case 'n': total = strtol(optarg, NULL, 10); break;
+        case 'b': batch = strtol(optarg, NULL, 10); break;
+        case 'r': relayctl = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-d device] [-n commands] [-b batch] [-r relayctl]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (total <= 0 || batch <= 0 || batch > 4096) {
+        fprintf(stderr, "proto_bench: need -n > 0 and 0 < -b <= 4096\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("proto_bench: %ld commands, batch %ld, device %s\n", total, batch, dev);
+
+    if (session_start(&s, relayctl, dev) != 0) {
+        return 1;
+    }
+    double t = run_ascii(&s, total, batch, &bytes);
+    session_stop(&s);
+    if (t < 0) {
+        fprintf(stderr, "proto_bench: ASCII session failed\n");
+        return 1;
+    }
+    printf("  ascii : %10.0f cmds/sec  %6.2f us/cmd  %zu request bytes\n",
+           (double)total / t, t * 1e6 / (double)total, bytes);
+
+    if (session_start(&s, relayctl, dev) != 0) {
+        return 1;
+    }
+    t = run_binary(&s, total, batch, &bytes);
+    session_stop(&s);
+    if (t < 0) {
+        fprintf(stderr, "proto_bench: binary session failed\n");
+        return 1;
+    }
+    printf("  binary: %10.0f cmds/sec  %6.2f us/cmd  %zu request bytes\n",
+           (double)total / t, t * 1e6 / (double)total, bytes);
+    return 0;
+}
@@ -0,0 +1,524 @@
+/* relaybench.c - per-command latency and throughput benchmark for relayctl
+ *
+ * Runs each command path (set, toggle, write-mask, getall and a mixed REPL
+ * workload) three ways against a real device:
+ *
+ *   oneshot    one relayctl process per command (fork + exec + open)
+ *   session    one "relayctl -i" session, one command in flight at a time
+ *   pipelined  one session, commands sent in batches of -p
+ *
+ * For each case it reports latency percentiles, ops/sec and the number of
+ * read/write syscalls relayctl made per command (from /proc/<pid>/io, so
+ * this covers device and pipe I/O alike). Results can be written as JSON
+ * (-j) and checked against an earlier JSON run (-B): a case whose p50
+ * latency or ops/sec is more than -t percent worse counts as a regression
+ * and relaybench exits with status 3.
+ *
+ * Usage: relaybench [-d device] [-r relayctl] [-n session-ops]
+ *                   [-s oneshot-runs] [-p batch] [-j out.json]
+ *                   [-B baseline.json] [-t percent]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/usbrelay.h"
+
+#define RELAYBENCH_MAX_RESULTS  32
+#define RELAYBENCH_EXIT_REGRESS 3
+
+struct bench_case {
+    const char *name;
+    const char *lines[4];   /* cycled through; NULL-terminated */
+};
+
+static const struct bench_case bench_cases[] = {
+    { "set",        { "set 1 on", "set 1 off", NULL } },
+    { "toggle",     { "toggle 2", NULL } },
+    { "write-mask", { "write-mask 0x05", "write-mask 0x0A", NULL } },
+    { "getall",     { "getall", NULL } },
+    { "mixed",      { "set 3 on", "toggle 1", "getall", "write-mask 0x00" } },
+};
+
+#define NUM_CASES   (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+struct bench_result {
+    char     name[48];          /* "<mode>.<case>" */
+    long     ops;
+    long     errors;
+    double   ops_per_sec;
+    double   p50_us, p90_us, p99_us, p999_us, max_us;
+    double   syscalls_per_cmd;
+};
+
+struct bench_opts {
+    const char *dev;
+    const char *relayctl;
+    long        session_ops;
+    long        oneshot_runs;
+    long        batch;
+};
+
+struct session {
+    pid_t  pid;
+    int    to_child;
+    int    from_child;
+    char   buf[64 * 1024];
+    size_t start, end;
+    size_t line, line_len;  /* last reply line, valid until the next call */
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* read + write syscalls made so far by pid (also valid for a zombie) */
+static long proc_rw_syscalls(pid_t pid) {
+    char path[64], line[128];
+    long total = 0, v;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "syscr: %ld", &v) == 1 || sscanf(line, "syscw: %ld", &v) == 1) {
+            total += v;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+/* Next reply line from the session; returns 1 for ERR, 0 for OK, -1 on EOF */
+static int session_reply(struct session *s) {
+    for (;;) {
+        char *nl = memchr(s->buf + s->start, '\n', s->end - s->start);
+        if (nl) {
+            s->line = s->start;
+            s->line_len = (size_t)(nl - s->buf) + 1 - s->start;
+            s->start += s->line_len;
+            return s->line_len >= 3 && memcmp(s->buf + s->line, "ERR", 3) == 0;
+        }
+        if (s->start > 0) {
+            memmove(s->buf, s->buf + s->start, s->end - s->start);
+            s->end -= s->start;
+            s->start = 0;
+        }
+        if (s->end == sizeof(s->buf)) {
+            return -1;
+        }
+        ssize_t n = read(s->from_child, s->buf + s->end, sizeof(s->buf) - s->end);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        s->end += (size_t)n;
+    }
+}
+
+static int session_start(struct session *s, const struct bench_opts *o) {
+    int in[2], out[2];
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    s->pid = fork();
+    if (s->pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (s->pid == 0) {
+        /* stderr too, so ERR replies arrive in order with the OKs */
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(out[1], STDERR_FILENO);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execl(o->relayctl, o->relayctl, "-d", o->dev, "-i", (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    s->to_child = in[1];
+    s->from_child = out[0];
+    s->start = s->end = 0;
+
+    /* Skip the REPL banner: sync on the bare "OK" reply to a ping */
+    if (write_all(s->to_child, "ping\n", 5) != 0) {
+        return 1;
+    }
+    for (;;) {
+        if (session_reply(s) < 0) {
+            fprintf(stderr, "relaybench: %s exited during startup\n", o->relayctl);
+            return 1;
+        }
+        if (s->line_len == 3 && memcmp(s->buf + s->line, "OK\n", 3) == 0) {
+            return 0;
+        }
+    }
+}
+
+static void session_stop(struct session *s) {
+    close(s->to_child);
+    close(s->from_child);
+    waitpid(s->pid, NULL, 0);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Fill in percentiles from n per-op latencies (sorted in place) */
+static void summarize(struct bench_result *r, uint64_t *lat, long n, uint64_t elapsed_ns) {
+    qsort(lat, (size_t)n, sizeof(lat[0]), cmp_u64);
+    r->ops = n;
+    r->ops_per_sec = elapsed_ns ? (double)n * 1e9 / (double)elapsed_ns : 0.0;
+    r->p50_us  = (double)lat[(n - 1) * 50 / 100] / 1e3;
+    r->p90_us  = (double)lat[(n - 1) * 90 / 100] / 1e3;
+    r->p99_us  = (double)lat[(n - 1) * 99 / 100] / 1e3;
+    r->p999_us = (double)lat[(n - 1) * 999 / 1000] / 1e3;
+    r->max_us  = (double)lat[n - 1] / 1e3;
+}
+
+static const char *case_line(const struct bench_case *c, long i) {
+    long n = 0;
+    while (n < 4 && c->lines[n]) {
+        n++;
+    }
+    return c->lines[i % n];
+}
+
+static int bench_oneshot(const struct bench_opts *o, const struct bench_case *c,
+                         struct bench_result *r, uint64_t *lat) {
+    long syscalls = 0;
+    uint64_t t_start = now_ns();
+
+    r->errors = 0;
+    for (long i = 0; i < o->oneshot_runs; i++) {
+        char line[USBRELAY_MAX_LINE_LEN];
+        char *argv[8];
+        int argc = 0;
+
+        snprintf(line, sizeof(line), "%s", case_line(c, i));
+        argv[argc++] = (char *)o->relayctl;
+        argv[argc++] = "-d";
+        argv[argc++] = (char *)o->dev;
+        for (char *t = strtok(line, " "); t && argc < 7; t = strtok(NULL, " ")) {
+            argv[argc++] = t;
+        }
+        argv[argc] = NULL;
+
+        uint64_t t0 = now_ns();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            execv(o->relayctl, argv);
+            _exit(127);
+        }
+
+        /* Sample the syscall counters before reaping the zombie */
+        siginfo_t si;
+        memset(&si, 0, sizeof(si));
+        if (waitid(P_PID, (id_t)pid, &si, WEXITED | WNOWAIT) != 0) {
+            perror("waitid");
+            return 1;
+        }
+        lat[i] = now_ns() - t0;
+        long sc = proc_rw_syscalls(pid);
+        syscalls += sc > 0 ? sc : 0;
+        waitpid(pid, NULL, 0);
+        if (si.si_code != CLD_EXITED || si.si_status != 0) {
+            if (si.si_status == 127) {
+                fprintf(stderr, "relaybench: cannot run %s\n", o->relayctl);
+                return 1;
+            }
+            r->errors++;
+        }
+    }
+
+    snprintf(r->name, sizeof(r->name), "oneshot.%s", c->name);
+    summarize(r, lat, o->oneshot_runs, now_ns() - t_start);
+    r->syscalls_per_cmd = (double)syscalls / (double)o->oneshot_runs;
+    return 0;
+}
+
+static int bench_session(const struct bench_opts *o, const struct bench_case *c,
+                         long batch, struct bench_result *r, uint64_t *lat) {
+    static char out[64 * 1024];
+    struct session *s = malloc(sizeof(*s));
+    int rc = 1;
+
+    if (!s || session_start(s, o) != 0) {
+        free(s);
+        return 1;
+    }
+
+    r->errors = 0;
+    long sc0 = proc_rw_syscalls(s->pid);
+    uint64_t t_start = now_ns();
+    long done = 0;
+    while (done < o->session_ops) {
+        long n = (o->session_ops - done < batch) ? o->session_ops - done : batch;
+        size_t len = 0;
+
+        for (long i = 0; i < n; i++) {
+            const char *l = case_line(c, done + i);
+            size_t ll = strlen(l);
+            memcpy(out + len, l, ll);
+            out[len + ll] = '\n';
+            len += ll + 1;
+        }
+
+        uint64_t t0 = now_ns();
+        if (write_all(s->to_child, out, len) != 0) {
+            goto out;
+        }
+        for (long i = 0; i < n; i++) {
+            int e = session_reply(s);
+            if (e < 0) {
+                goto out;
+            }
+            r->errors += e;
+        }
+        /* A batch completes as a unit: charge each command its share */
+        uint64_t per = (now_ns() - t0) / (uint64_t)n;
+        for (long i = 0; i < n; i++) {
+            lat[done + i] = per;
+        }
+        done += n;
+    }
+    uint64_t elapsed = now_ns() - t_start;
+    long sc1 = proc_rw_syscalls(s->pid);
+
+    snprintf(r->name, sizeof(r->name), "%s.%s", batch > 1 ? "pipelined" : "session", c->name);
+    summarize(r, lat, o->session_ops, elapsed);
+    r->syscalls_per_cmd = (sc0 >= 0 && sc1 >= 0) ?
+        (double)(sc1 - sc0) / (double)o->session_ops : -1.0;
+    rc = 0;
+out:
+    if (rc != 0) {
+        fprintf(stderr, "relaybench: session ended early in %s\n", c->name);
+    }
+    session_stop(s);
+    free(s);
+    return rc;
+}
+
+static void print_table(const struct bench_result *res, int n) {
+    printf("%-22s %10s %9s %9s %9s %9s %9s %8s %6s\n",
+           "case", "ops/sec", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us",
+           "sys/cmd", "errs");
+    for (int i = 0; i < n; i++) {
+        const struct bench_result *r = &res[i];
+        printf("%-22s %10.0f %9.2f %9.2f %9.2f %9.2f %9.2f %8.2f %6ld\n",
+               r->name, r->ops_per_sec, r->p50_us, r->p90_us, r->p99_us,
+               r->p999_us, r->max_us, r->syscalls_per_cmd, r->errors);
+    }
+}
+
+static int write_json(const char *path, const struct bench_opts *o,
+                      const struct bench_result *res, int n) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+
+    fprintf(f, "{\n  \"tool\": \"relaybench\",\n  \"proto\": \"%s\",\n", USBRELAY_PROTO_VERSION);
+    fprintf(f, "  \"device\": \"%s\",\n  \"results\": [\n", o->dev);
+    for (int i = 0; i < n; i++) {
+        const struct bench_result *r = &res[i];
+        fprintf(f,
+                "    { \"name\": \"%s\", \"ops\": %ld, \"errors\": %ld, "
+                "\"ops_per_sec\": %.1f, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+                "\"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f, "
+                "\"syscalls_per_cmd\": %.2f }%s\n",
+                r->name, r->ops, r->errors, r->ops_per_sec, r->p50_us, r->p90_us,
+                r->p99_us, r->p999_us, r->max_us, r->syscalls_per_cmd,
+                i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout) {
+        fclose(f);
+    }
+    return 0;
+}
+
+/* Look up "key": <number> inside the baseline object named name. This is
+ * only meant to read back files written by write_json() above. */
+static int baseline_value(const char *json, const char *name, const char *key, double *v) {
+    char pat[96];
+
+    snprintf(pat, sizeof(pat), "\"name\": \"%s\"", name);
+    const char *obj = strstr(json, pat);
+    if (!obj) {
+        return 1;
+    }
+    const char *end = strchr(obj, '}');
+    snprintf(pat, sizeof(pat), "\"%s\": ", key);
+    const char *p = strstr(obj, pat);
+    if (!p || (end && p > end)) {
+        return 1;
+    }
+    *v = strtod(p + strlen(pat), NULL);
+    return 0;
+}
+
+static int compare_baseline(FILE *log, const char *path, const struct bench_result *res,
+                            int n, double threshold) {
+    static char json[256 * 1024];
+    int regressions = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    size_t len = fread(json, 1, sizeof(json) - 1, f);
+    fclose(f);
+    json[len] = '\0';
+
+    fprintf(log, "\nbaseline %s (threshold %.0f%%):\n", path, threshold);
+    for (int i = 0; i < n; i++) {
+        const struct bench_result *r = &res[i];
+        double p50, ops;
+
+        if (baseline_value(json, r->name, "p50_us", &p50) != 0 ||
+            baseline_value(json, r->name, "ops_per_sec", &ops) != 0) {
+            fprintf(log, "  %-22s not in baseline\n", r->name);
+            continue;
+        }
+        double d_p50 = p50 > 0 ? (r->p50_us - p50) * 100.0 / p50 : 0.0;
+        double d_ops = ops > 0 ? (ops - r->ops_per_sec) * 100.0 / ops : 0.0;
+        int bad = d_p50 > threshold || d_ops > threshold;
+        fprintf(log, "  %-22s p50 %+6.1f%%  ops/sec %+6.1f%%%s\n", r->name, d_p50, -d_ops,
+                bad ? "  REGRESSION" : "");
+        regressions += bad;
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    struct bench_opts o = {
+        .dev = USBRELAY_DEFAULT_DEVICE,
+        .relayctl = "./tools/relayctl",
+        .session_ops = 20000,
+        .oneshot_runs = 200,
+        .batch = 64,
+    };
+    static struct bench_result res[RELAYBENCH_MAX_RESULTS];
+    const char *json_path = NULL;
+    const char *baseline = NULL;
+    double threshold = 10.0;
+    int nres = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:r:n:s:p:j:B:t:")) != -1) {
+        switch (opt) {
+        case 'd': o.dev = optarg; break;
+        case 'r': o.relayctl = optarg; break;
+        case 'n': o.session_ops = strtol(optarg, NULL, 10); break;
+        case 's': o.oneshot_runs = strtol(optarg, NULL, 10); break;
+        case 'p': o.batch = strtol(optarg, NULL, 10); break;
+        case 'j': json_path = optarg; break;
+        case 'B': baseline = optarg; break;
+        case 't': threshold = strtod(optarg, NULL); break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-d device] [-r relayctl] [-n session-ops] [-s oneshot-runs]\n"
+                    "       [-p batch] [-j out.json] [-B baseline.json] [-t percent]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (o.session_ops <= 0 || o.oneshot_runs <= 0 || o.batch <= 0 || o.batch > 1024) {
+        fprintf(stderr, "relaybench: need -n > 0, -s > 0 and 0 < -p <= 1024\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    long max_ops = o.session_ops > o.oneshot_runs ? o.session_ops : o.oneshot_runs;
+    uint64_t *lat = malloc((size_t)max_ops * sizeof(*lat));
+    if (!lat) {
+        perror("malloc");
+        return 1;
+    }
+
+    /* With -j - the JSON owns stdout; progress goes to stderr */
+    FILE *log = (json_path && strcmp(json_path, "-") == 0) ? stderr : stdout;
+    fprintf(log, "relaybench: device %s, %ld session ops, %ld one-shot runs, batch %ld\n",
+            o.dev, o.session_ops, o.oneshot_runs, o.batch);
+
+    for (size_t c = 0; c < NUM_CASES; c++) {
+        if (bench_oneshot(&o, &bench_cases[c], &res[nres], lat) != 0) {
+            return 1;
+        }
+        nres++;
+        if (bench_session(&o, &bench_cases[c], 1, &res[nres], lat) != 0) {
+            return 1;
+        }
+        nres++;
+        if (bench_session(&o, &bench_cases[c], o.batch, &res[nres], lat) != 0) {
+            return 1;
+        }
+        nres++;
+    }
+    free(lat);
+
+    if (log == stdout) {
+        print_table(res, nres);
+    }
+    if (json_path && write_json(json_path, &o, res, nres) != 0) {
+        return 1;
+    }
+    if (baseline) {
+        int regressions = compare_baseline(log, baseline, res, nres, threshold);
+        if (regressions < 0) {
+            return 1;
+        }
+        if (regressions > 0) {
+            fprintf(stderr, "relaybench: %d regression(s) against %s\n", regressions, baseline);
+            return RELAYBENCH_EXIT_REGRESS;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,428 @@
+/* ring_bench.c - submission-to-actuation latency of the ring server
+ *
+ * Starts "relayctl -d <device> -Q <name>" and measures write-mask round
+ * trips, one command in flight at a time, three ways:
+ *
+ *   binary      a "relayctl -i" session in BINARY mode over pipes
+ *   ring        the shared-memory ring, back to back (server spinning)
+ *   ring.idle   the ring with -g microseconds between commands, so the
+ *               server has gone to sleep and is woken through the futex
+ *   ring.2cl    two ring clients interleaved frame by frame on the same
+ *               board: one runs BEGIN/WRITE-MASK/COMMIT while the other's
+ *               writes and COMMIT must be refused with BAD_STATE, and a
+ *               transaction left open by a detaching client is dropped
+ *
+ * The response to a write-mask is produced after the device write has
+ * returned, so the round trip bounds submission-to-actuation. "submit
+ * us" is the p50 time to hand one request over (write() on the pipe,
+ * relay_ring_submit() on the ring). In ring.2cl a frame answered with
+ * another status than expected counts as an error.
+ *
+ * Usage: ring_bench [-d device] [-n commands] [-g idle-gap-us] [-r relayctl]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/relay_ring.h"
+#include "../include/usbrelay.h"
+
+struct bench_result {
+    const char *name;
+    long        ops;
+    long        errors;
+    double      ops_per_sec;
+    double      submit_us, p50_us, p90_us, p99_us, p999_us, max_us;
+};
+
+struct child {
+    pid_t pid;
+    int   to_child;
+    int   from_child;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_us(long us) {
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Read up to and including the next line starting with prefix */
+static int wait_line(int fd, const char *prefix) {
+    char line[128];
+    size_t len = 0;
+    char c;
+
+    while (read(fd, &c, 1) == 1) {
+        if (c != '\n') {
+            if (len < sizeof(line) - 1) {
+                line[len++] = c;
+            }
+            continue;
+        }
+        line[len] = '\0';
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            return 0;
+        }
+        len = 0;
+    }
+    return 1;
+}
+
+static int child_start(struct child *ch, char *const argv[]) {
+    int in[2], out[2];
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    ch->pid = fork();
+    if (ch->pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (ch->pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    ch->to_child = in[1];
+    ch->from_child = out[0];
+    return 0;
+}
+
+static void child_stop(struct child *ch, int sig) {
+    if (sig) {
+        kill(ch->pid, sig);
+    }
+    close(ch->to_child);
+    close(ch->from_child);
+    waitpid(ch->pid, NULL, 0);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Fill in percentiles from n per-op latencies (sorted in place) */
+static void summarize(struct bench_result *r, uint64_t *lat, uint64_t *sub, long n,
+                      uint64_t elapsed_ns) {
+    qsort(lat, (size_t)n, sizeof(lat[0]), cmp_u64);
+    qsort(sub, (size_t)n, sizeof(sub[0]), cmp_u64);
+    r->ops = n;
+    r->ops_per_sec = elapsed_ns ? (double)n * 1e9 / (double)elapsed_ns : 0.0;
+    r->submit_us = (double)sub[(n - 1) / 2] / 1e3;
+    r->p50_us  = (double)lat[(n - 1) * 50 / 100] / 1e3;
+    r->p90_us  = (double)lat[(n - 1) * 90 / 100] / 1e3;
+    r->p99_us  = (double)lat[(n - 1) * 99 / 100] / 1e3;
+    r->p999_us = (double)lat[(n - 1) * 999 / 1000] / 1e3;
+    r->max_us  = (double)lat[n - 1] / 1e3;
+}
+
+static void fill_frame(struct usbrelay_frame *f, long i) {
+    memset(f, 0, sizeof(*f));
+    f->op = USBRELAY_OP_WRITE_MASK;
+    f->seq = (uint16_t)i;
+    f->arg = (i & 1) ? 0x0A : 0x05;
+}
+
+static int bench_binary(const char *relayctl, const char *dev, long n,
+                        struct bench_result *r, uint64_t *lat, uint64_t *sub) {
+    char *argv[] = { (char *)relayctl, "-d", (char *)dev, "-i", NULL };
+    struct child ch;
+    int rc = 0;
+
+    if (child_start(&ch, argv) != 0) {
+        return 1;
+    }
+    const char *neg = "binary\n";
+    if (write(ch.to_child, neg, strlen(neg)) != (ssize_t)strlen(neg) ||
+        wait_line(ch.from_child, "OK MODE=BINARY") != 0) {
+        fprintf(stderr, "ring_bench: %s did not enter binary mode\n", relayctl);
+        child_stop(&ch, SIGTERM);
+        return 1;
+    }
+
+    uint64_t start = now_ns();
+    for (long i = 0; i < n; i++) {
+        struct usbrelay_frame f;
+        fill_frame(&f, i);
+        uint64_t t0 = now_ns();
+        if (write(ch.to_child, &f, sizeof(f)) != (ssize_t)sizeof(f)) {
+            rc = 1;
+            break;
+        }
+        uint64_t t1 = now_ns();
+        if (read_all(ch.from_child, &f, sizeof(f)) != 0) {
+            rc = 1;
+            break;
+        }
+        lat[i] = now_ns() - t0;
+        sub[i] = t1 - t0;
+        if (f.status != USBRELAY_OK) {
+            r->errors++;
+        }
+    }
+    if (rc == 0) {
+        summarize(r, lat, sub, n, now_ns() - start);
+    }
+    child_stop(&ch, 0);
+    return rc;
+}
+
+static int bench_ring(struct relay_ring_client *c, long n, long gap_us,
+                      struct bench_result *r, uint64_t *lat, uint64_t *sub) {
+    uint64_t busy = 0;
+
+    for (long i = 0; i < n; i++) {
+        struct usbrelay_frame f;
+        fill_frame(&f, i);
+        if (gap_us > 0) {
+            sleep_us(gap_us);
+        }
+        uint64_t t0 = now_ns();
+        if (relay_ring_submit(c, &f) != 0) {
+            perror("ring_bench: relay_ring_submit");
+            return 1;
+        }
+        uint64_t t1 = now_ns();
+        if (relay_ring_receive(c, &f, 1000) != 0) {
+            perror("ring_bench: relay_ring_receive");
+            return 1;
+        }
+        lat[i] = now_ns() - t0;
+        sub[i] = t1 - t0;
+        busy += lat[i];
+        if (f.status != USBRELAY_OK) {
+            r->errors++;
+        }
+    }
+    /* ops/sec without the idle gaps */
+    summarize(r, lat, sub, n, busy);
+    return 0;
+}
+
+/* One ring.2cl step: who sends what, and the status it must get */
+struct two_client_step {
+    int     client;     /* 0 = A, 1 = B */
+    uint8_t op;
+    uint8_t status;
+};
+
+static const struct two_client_step two_client_round[] = {
+    { 0, USBRELAY_OP_BEGIN,      USBRELAY_OK },
+    { 1, USBRELAY_OP_WRITE_MASK, USBRELAY_ERR_BAD_STATE },
+    { 0, USBRELAY_OP_WRITE_MASK, USBRELAY_OK },
+    { 1, USBRELAY_OP_COMMIT,     USBRELAY_ERR_BAD_STATE },
+    { 0, USBRELAY_OP_COMMIT,     USBRELAY_OK },
+    { 1, USBRELAY_OP_WRITE_MASK, USBRELAY_OK },
+};
+
+#define TWO_CLIENT_STEPS (long)(sizeof(two_client_round) / sizeof(two_client_round[0]))
+
+static int ring_call(struct relay_ring_client *c, uint8_t op, uint8_t arg, long seq,
+                     struct usbrelay_frame *resp) {
+    struct usbrelay_frame f;
+
+    memset(&f, 0, sizeof(f));
+    f.op = op;
+    f.seq = (uint16_t)seq;
+    f.arg = arg;
+    if (relay_ring_call(c, &f, resp, 1000) != 0) {
+        perror("ring_bench: relay_ring_call");
+        return 1;
+    }
+    return 0;
+}
+
+static int bench_two_clients(struct relay_ring_client *b, const char *name, long rounds,
+                             struct bench_result *r, uint64_t *lat, uint64_t *sub) {
+    struct relay_ring_client *cl[2];
+    struct usbrelay_frame f;
+    uint64_t busy = 0;
+    long n = 0;
+
+    if (relay_ring_attach(&cl[0], name) != 0) {
+        perror("ring_bench: relay_ring_attach");
+        return 1;
+    }
+    cl[1] = b;
+
+    for (long i = 0; i < rounds; i++) {
+        uint8_t staged = (i & 1) ? 0x0A : 0x05;
+        for (long k = 0; k < TWO_CLIENT_STEPS; k++) {
+            const struct two_client_step *st = &two_client_round[k];
+            uint8_t arg = st->client == 0 ? staged : 0x0F;
+            uint64_t t0 = now_ns();
+            if (ring_call(cl[st->client], st->op, arg, n, &f) != 0) {
+                relay_ring_detach(cl[0]);
+                return 1;
+            }
+            lat[n] = now_ns() - t0;
+            sub[n] = 0;
+            busy += lat[n];
+            if (f.status != st->status ||
+                (st->op == USBRELAY_OP_COMMIT && st->client == 0 && f.mask != staged)) {
+                r->errors++;
+            }
+            n++;
+        }
+    }
+
+    /* A detaches inside a transaction: B must get the board back */
+    if (ring_call(cl[0], USBRELAY_OP_BEGIN, 0, n, &f) != 0) {
+        relay_ring_detach(cl[0]);
+        return 1;
+    }
+    relay_ring_detach(cl[0]);
+    int tries = 0;
+    do {
+        if (tries > 0) {
+            sleep_us(1000);
+        }
+        if (ring_call(b, USBRELAY_OP_WRITE_MASK, 0x00, n, &f) != 0) {
+            return 1;
+        }
+    } while (f.status == USBRELAY_ERR_BAD_STATE && ++tries < 1000);
+    if (f.status != USBRELAY_OK) {
+        r->errors++;
+    }
+
+    summarize(r, lat, sub, n, busy);
+    return 0;
+}
+
+static void print_table(const struct bench_result *res, int n) {
+    printf("%-10s %10s %9s %9s %9s %9s %9s %9s %6s\n",
+           "case", "ops/sec", "submit us", "p50 us", "p90 us", "p99 us", "p99.9 us",
+           "max us", "errs");
+    for (int i = 0; i < n; i++) {
+        const struct bench_result *r = &res[i];
+        printf("%-10s %10.0f %9.3f %9.2f %9.2f %9.2f %9.2f %9.2f %6ld\n",
+               r->name, r->ops_per_sec, r->submit_us, r->p50_us, r->p90_us, r->p99_us,
+               r->p999_us, r->max_us, r->errors);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *dev = USBRELAY_DEFAULT_DEVICE;
+    const char *relayctl = "./tools/relayctl";
+    long total = 100000;
+    long gap_us = 1000;
+    struct bench_result res[4];
+    char name[64];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:g:r:")) != -1) {
+        switch (opt) {
+        case 'd': dev = optarg; break;
+        case 'n': total = strtol(optarg, NULL, 10); break;
+        case 'g': gap_us = strtol(optarg, NULL, 10); break;
+        case 'r': relayctl = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-d device] [-n commands] [-g idle-gap-us] [-r relayctl]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (total <= 0 || gap_us <= RELAY_RING_SPIN_US) {
+        fprintf(stderr, "ring_bench: need -n > 0 and -g > %d (the server spin)\n",
+                RELAY_RING_SPIN_US);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    /* ring.2cl runs at least one round, even with -n below its size */
+    uint64_t *lat = calloc((size_t)(total + TWO_CLIENT_STEPS), sizeof(*lat));
+    uint64_t *sub = calloc((size_t)(total + TWO_CLIENT_STEPS), sizeof(*sub));
+    if (!lat || !sub) {
+        fprintf(stderr, "ring_bench: out of memory\n");
+        return 1;
+    }
+    memset(res, 0, sizeof(res));
+    res[0].name = "binary";
+    res[1].name = "ring";
+    res[2].name = "ring.idle";
+    res[3].name = "ring.2cl";
+    long idle_n = total / 10 > 0 ? total / 10 : 1;
+
+    printf("ring_bench: %ld write-mask round trips (%ld idle, %ld us apart), device %s\n",
+           total, idle_n, gap_us, dev);
+
+    if (bench_binary(relayctl, dev, total, &res[0], lat, sub) != 0) {
+        fprintf(stderr, "ring_bench: binary session failed\n");
+        return 1;
+    }
+
+    snprintf(name, sizeof(name), "relayctl-ring-bench.%d", (int)getpid());
+    char *sargv[] = { (char *)relayctl, "-d", (char *)dev, "-Q", name, NULL };
+    struct child server;
+    if (child_start(&server, sargv) != 0) {
+        return 1;
+    }
+    if (wait_line(server.from_child, "OK RING NAME=") != 0) {
+        fprintf(stderr, "ring_bench: %s -Q did not start\n", relayctl);
+        child_stop(&server, SIGTERM);
+        return 1;
+    }
+
+    struct relay_ring_client *c;
+    int rc = 0;
+    if (relay_ring_attach(&c, name) != 0) {
+        perror("ring_bench: relay_ring_attach");
+        rc = 1;
+    } else {
+        long rounds = total / TWO_CLIENT_STEPS > 0 ? total / TWO_CLIENT_STEPS : 1;
+        if (bench_ring(c, total, 0, &res[1], lat, sub) != 0 ||
+            bench_ring(c, idle_n, gap_us, &res[2], lat, sub) != 0 ||
+            bench_two_clients(c, name, rounds, &res[3], lat, sub) != 0) {
+            rc = 1;
+        }
+        relay_ring_detach(c);
+    }
+    child_stop(&server, SIGTERM);
+
+    if (rc == 0) {
+        print_table(res, 4);
+    }
+    free(lat);
+    free(sub);
+    return rc;
+}
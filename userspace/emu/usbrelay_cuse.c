@@ -0,0 +1,353 @@
+/* usbrelay_cuse.c - userspace /dev/usbrelayN emulator (CUSE)
+ *
+ * Creates a character device with the same 1-byte mask ABI as the kernel
+ * driver (docs/PROTOCOL.md section 2), so relayctl, test_relayctl.sh and
+ * other controllers can run on hosts without relay_driver.ko or a board,
+ * while still paying real open/read/write syscall costs.
+ *
+ * read() and write() mirror usbrelay_read()/usbrelay_write():
+ *   - count == 0 fails with EINVAL
+ *   - read returns the shadow mask (one byte), with no device I/O
+ *   - write stores buf[0] as the shadow mask, then "pushes" it to the
+ *     board; the push is where latency, jitter and failures are injected.
+ *     As in the driver, a failed push still leaves the new shadow mask.
+ *   - writes are serialized by one lock held across the push
+ *   - poll() reports POLLPRI once the mask has changed since the file
+ *     last read it, as usbrelay_poll() does
+ *
+ * Every applied mask is appended to the log (--log) as
+ *   <realtime s.ns> <monotonic ns> mask=0xHH rc=<errno or 0>
+ *
+ * Usage (needs /dev/cuse, usually root):
+ *   usbrelay_cuse -f --name=usbrelay0 [--latency=us] [--jitter=us]
+ *                 [--fail-write=pct] [--fail-read=pct] [--seed=n]
+ *                 [--log=path]
+ */
+#define FUSE_USE_VERSION 31
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cuse_lowlevel.h>
+#include <fuse_opt.h>
+
+#include "../include/usbrelay.h"
+
+struct emu_param {
+    char        *name;          /* device node name, default usbrelay0 */
+    char        *log_path;
+    unsigned     latency_us;    /* added to every write (bulk push) */
+    unsigned     jitter_us;     /* +/- uniform around latency_us */
+    double       fail_write;    /* percent of writes failing with EIO */
+    double       fail_read;     /* percent of reads failing with EIO */
+    unsigned     seed;
+    int          show_help;
+};
+
+/* Per-open state (fi->fh), linked into emu.clients */
+struct emu_client {
+    struct emu_client      *next;
+    uint32_t                seen_seq;
+    struct fuse_pollhandle *ph;     /* pending poll, or NULL */
+};
+
+struct emu_dev {
+    pthread_mutex_t lock;
+    uint8_t         relay_state;
+    uint32_t        state_seq;      /* bumped on every mask change */
+    struct emu_client *clients;
+    unsigned        rand_state;
+    FILE           *log;
+    unsigned long   reads, writes, failures;
+};
+
+static struct emu_param param = { .seed = 1 };
+static struct emu_dev emu = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+#define EMU_OPT(t, p) { t, offsetof(struct emu_param, p), 1 }
+
+static const struct fuse_opt emu_opts[] = {
+    EMU_OPT("-n %s",           name),
+    EMU_OPT("--name=%s",       name),
+    EMU_OPT("--log=%s",        log_path),
+    EMU_OPT("--latency=%u",    latency_us),
+    EMU_OPT("--jitter=%u",     jitter_us),
+    EMU_OPT("--fail-write=%lf", fail_write),
+    EMU_OPT("--fail-read=%lf", fail_read),
+    EMU_OPT("--seed=%u",       seed),
+    FUSE_OPT_KEY("-h",         0),
+    FUSE_OPT_KEY("--help",     0),
+    FUSE_OPT_END
+};
+
+/* Called with emu.lock held */
+static int emu_chance(double percent) {
+    if (percent <= 0.0) {
+        return 0;
+    }
+    return (double)rand_r(&emu.rand_state) * 100.0 / ((double)RAND_MAX + 1.0) < percent;
+}
+
+/* Called with emu.lock held: the simulated bulk OUT transfer */
+static int emu_push_state(void) {
+    long delay = (long)param.latency_us;
+
+    if (param.jitter_us > 0) {
+        delay += (long)(rand_r(&emu.rand_state) % (2 * param.jitter_us + 1)) - (long)param.jitter_us;
+    }
+    if (delay > 0) {
+        struct timespec ts = { delay / 1000000, (delay % 1000000) * 1000 };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+    return emu_chance(param.fail_write) ? EIO : 0;
+}
+
+static void emu_log(uint8_t mask, int err) {
+    struct timespec rt, mono;
+
+    if (!emu.log) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    fprintf(emu.log, "%lld.%09ld %llu mask=0x%02X rc=%d\n",
+            (long long)rt.tv_sec, rt.tv_nsec,
+            (unsigned long long)mono.tv_sec * 1000000000ull + (unsigned long long)mono.tv_nsec,
+            mask, err);
+}
+
+static void emu_open(fuse_req_t req, struct fuse_file_info *fi) {
+    struct emu_client *c = calloc(1, sizeof(*c));
+
+    if (!c) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    pthread_mutex_lock(&emu.lock);
+    c->seen_seq = emu.state_seq;
+    c->next = emu.clients;
+    emu.clients = c;
+    pthread_mutex_unlock(&emu.lock);
+
+    fi->fh = (uint64_t)(uintptr_t)c;
+    fi->nonseekable = 1;    /* a "state" device: no file position */
+    fuse_reply_open(req, fi);
+}
+
+static void emu_release(fuse_req_t req, struct fuse_file_info *fi) {
+    struct emu_client *c = (struct emu_client *)(uintptr_t)fi->fh;
+
+    pthread_mutex_lock(&emu.lock);
+    for (struct emu_client **pp = &emu.clients; *pp; pp = &(*pp)->next) {
+        if (*pp == c) {
+            *pp = c->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu.lock);
+
+    if (c->ph) {
+        fuse_pollhandle_destroy(c->ph);
+    }
+    free(c);
+    fuse_reply_err(req, 0);
+}
+
+/* Called with emu.lock held after the mask changed: wake every poller */
+static void emu_notify_change(void) {
+    emu.state_seq++;
+    for (struct emu_client *c = emu.clients; c; c = c->next) {
+        if (c->ph) {
+            fuse_lowlevel_notify_poll(c->ph);
+            fuse_pollhandle_destroy(c->ph);
+            c->ph = NULL;
+        }
+    }
+}
+
+static void emu_poll(fuse_req_t req, struct fuse_file_info *fi, struct fuse_pollhandle *ph) {
+    struct emu_client *c = (struct emu_client *)(uintptr_t)fi->fh;
+    unsigned revents = POLLOUT | POLLWRNORM;
+
+    pthread_mutex_lock(&emu.lock);
+    if (c->seen_seq != emu.state_seq) {
+        revents |= POLLIN | POLLRDNORM | POLLPRI;
+    }
+    if (ph) {
+        if (c->ph) {
+            fuse_pollhandle_destroy(c->ph);
+        }
+        c->ph = ph;
+    }
+    pthread_mutex_unlock(&emu.lock);
+
+    fuse_reply_poll(req, revents);
+}
+
+static void emu_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi) {
+    struct emu_client *c = (struct emu_client *)(uintptr_t)fi->fh;
+    uint8_t mask;
+    int fail;
+
+    (void)off;
+    if (size < 1) {
+        fuse_reply_err(req, EINVAL);    /* caller must request at least 1 byte */
+        return;
+    }
+
+    pthread_mutex_lock(&emu.lock);
+    mask = emu.relay_state;
+    c->seen_seq = emu.state_seq;
+    emu.reads++;
+    fail = emu_chance(param.fail_read);
+    if (fail) {
+        emu.failures++;
+    }
+    pthread_mutex_unlock(&emu.lock);
+
+    if (fail) {
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    fuse_reply_buf(req, (const char *)&mask, 1);
+}
+
+static void emu_write(fuse_req_t req, const char *buf, size_t size, off_t off,
+                      struct fuse_file_info *fi) {
+    int err;
+
+    (void)off;
+    (void)fi;
+    if (size < 1) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    pthread_mutex_lock(&emu.lock);
+    if (emu.relay_state != (uint8_t)buf[0]) {
+        emu.relay_state = (uint8_t)buf[0];
+        emu_notify_change();
+    }
+    emu.writes++;
+    err = emu_push_state();
+    if (err) {
+        emu.failures++;
+    }
+    emu_log(emu.relay_state, err);
+    pthread_mutex_unlock(&emu.lock);
+
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    /* Like the driver: report the whole buffer as consumed */
+    fuse_reply_write(req, size);
+}
+
+static void emu_init_done(void *userdata) {
+    (void)userdata;
+    fprintf(stderr, "usbrelay_cuse: /dev/%s ready (latency %u us, jitter %u us, "
+            "fail-write %.2f%%, fail-read %.2f%%)\n",
+            param.name, param.latency_us, param.jitter_us,
+            param.fail_write, param.fail_read);
+}
+
+static void emu_destroy(void *userdata) {
+    (void)userdata;
+    fprintf(stderr, "usbrelay_cuse: reads=%lu writes=%lu injected failures=%lu\n",
+            emu.reads, emu.writes, emu.failures);
+    if (emu.log) {
+        fclose(emu.log);
+        emu.log = NULL;
+    }
+}
+
+static const struct cuse_lowlevel_ops emu_ops = {
+    .init_done = emu_init_done,
+    .destroy   = emu_destroy,
+    .open      = emu_open,
+    .release   = emu_release,
+    .read      = emu_read,
+    .write     = emu_write,
+    .poll      = emu_poll,
+};
+
+static int emu_process_arg(void *data, const char *arg, int key, struct fuse_args *outargs) {
+    struct emu_param *p = data;
+
+    (void)arg;
+    (void)outargs;
+    if (key == 0) {
+        p->show_help = 1;
+        return 0;
+    }
+    return 1;   /* keep everything else for fuse */
+}
+
+static void emu_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-f] [-s] [-d] [options]\n"
+            "\n"
+            "  -n, --name=NAME     device node name (default usbrelay0)\n"
+            "  --latency=US        delay added to every write, microseconds\n"
+            "  --jitter=US         uniform +/- jitter around --latency\n"
+            "  --fail-write=PCT    percent of writes failing with EIO\n"
+            "  --fail-read=PCT     percent of reads failing with EIO\n"
+            "  --seed=N            random seed for jitter and failures\n"
+            "  --log=PATH          append a timestamped line per applied mask\n"
+            "  -f                  stay in the foreground\n"
+            "  -s                  single-threaded\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char dev_name[128];
+    const char *dev_info_argv[] = { dev_name };
+    struct cuse_info ci;
+    int ret;
+
+    if (fuse_opt_parse(&args, &param, emu_opts, emu_process_arg) != 0) {
+        return 1;
+    }
+    if (param.show_help) {
+        emu_usage(argv[0]);
+        return 0;
+    }
+    if (!param.name) {
+        param.name = "usbrelay0";
+    }
+    if (param.fail_write < 0.0 || param.fail_write > 100.0 ||
+        param.fail_read < 0.0 || param.fail_read > 100.0) {
+        fprintf(stderr, "usbrelay_cuse: failure rates must be 0..100 percent\n");
+        return 1;
+    }
+    if (param.log_path) {
+        emu.log = fopen(param.log_path, "a");
+        if (!emu.log) {
+            perror(param.log_path);
+            return 1;
+        }
+        setvbuf(emu.log, NULL, _IOLBF, 0);
+    }
+    emu.rand_state = param.seed;
+    emu.relay_state = 0x00;     /* like probe(): start with all relays off */
+
+    snprintf(dev_name, sizeof(dev_name), "DEVNAME=%s", param.name);
+    memset(&ci, 0, sizeof(ci));
+    ci.dev_info_argc = 1;
+    ci.dev_info_argv = dev_info_argv;
+
+    ret = cuse_lowlevel_main(args.argc, args.argv, &ci, &emu_ops, NULL);
+    fuse_opt_free_args(&args);
+    return ret;
+}
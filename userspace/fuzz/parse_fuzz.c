@@ -0,0 +1,116 @@
+/* parse_fuzz.c - fuzz harness for the relayctl command parser
+ *
+ * With libFuzzer (clang -fsanitize=fuzzer) only LLVMFuzzerTestOneInput is
+ * used. Built without it (the default "make fuzz" target, gcc with
+ * ASan/UBSan) a small driver feeds the parser random token soup, plus
+ * any files given on the command line.
+ *
+ * Besides memory safety the harness checks parser invariants: a
+ * successful parse yields a known command with in-range arguments, and
+ * a failed one always carries an error code and message.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/usbrelay.h"
+#include "../tools/relayctl_parse.h"
+
+static void check_invariants(int rc, const struct relayctl_command *cmd) {
+    if (rc == 0) {
+        if (cmd->cmd <= RELAYCTL_CMD_NONE || cmd->cmd >= RELAYCTL_CMD_COUNT) {
+            abort();
+        }
+        if (cmd->channel != 0 &&
+            (cmd->channel < USBRELAY_MIN_CHANNEL || cmd->channel > USBRELAY_MAX_CHANNEL)) {
+            abort();
+        }
+        if (cmd->mask & ~USBRELAY_MASK_ALL) {
+            abort();
+        }
+    } else if (!cmd->err_code || !cmd->err_msg) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    struct relayctl_command cmd;
+    char *line = malloc(size + 1);
+
+    if (!line) {
+        return 0;
+    }
+    memcpy(line, data, size);
+    line[size] = '\0';
+
+    check_invariants(relayctl_parse_line(line, &cmd), &cmd);
+    free(line);
+    return 0;
+}
+
+#ifndef RELAYCTL_LIBFUZZER
+
+static const char *const fuzz_words[] = {
+    "set", "SET", "get", "getall", "toggle", "write-mask", "read-mask",
+    "reset", "ping", "version", "help", "begin", "commit", "abort", "quit", "binary",
+    "exit", "on", "OFF", "0", "1", "4", "5", "-1", "99999999999", "0x0F",
+    "0x10", "0xff", "xyz", "", " ", "\t", "\r\n", ";", "\x80\xff",
+};
+
+#define NUM_WORDS   (sizeof(fuzz_words) / sizeof(fuzz_words[0]))
+
+static void run_file(const char *path) {
+    static uint8_t buf[1 << 16];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(buf, n);
+}
+
+int main(int argc, char **argv) {
+    uint8_t buf[256];
+    unsigned long iterations = 1000000;
+    unsigned int seed = 1;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            run_file(argv[i]);
+        }
+        return 0;
+    }
+
+    srand(seed);
+    for (unsigned long n = 0; n < iterations; n++) {
+        size_t len = 0;
+        int words = rand() % 6;
+
+        for (int w = 0; w < words; w++) {
+            const char *word = fuzz_words[(size_t)rand() % NUM_WORDS];
+            size_t wl = strlen(word);
+            if (len + wl + 1 > sizeof(buf)) {
+                break;
+            }
+            memcpy(buf + len, word, wl);
+            len += wl;
+            buf[len++] = (rand() % 4) ? ' ' : (uint8_t)(rand() % 256);
+        }
+        /* Occasionally flip random bytes as well */
+        if (len > 0 && rand() % 8 == 0) {
+            buf[(size_t)rand() % len] = (uint8_t)(rand() % 256);
+        }
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    printf("parse_fuzz: %lu inputs, no invariant violations\n", iterations);
+    return 0;
+}
+
+#endif /* RELAYCTL_LIBFUZZER */
@@ -0,0 +1,135 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+/*
+ * librelay - in-process control of SainSmart USB relay boards.
+ *
+ * The same logic relayctl runs for each protocol command, as a C API:
+ * one relay_board per device, 1-based channels, and status codes
+ * (enum usbrelay_status) instead of "ERR ..." text. When a call fails
+ * with READ_FAILURE, WRITE_FAILURE or DEVICE_UNAVAILABLE, relay_errno()
+ * holds the underlying errno.
+ *
+ * A board must not be used from two threads at once; different boards
+ * are independent. Link with -lrelay (plus libusb-1.0 when the library
+ * was built with LIBUSB=1).
+ */
+
+#include <stdint.h>
+
+#include "usbrelay.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct relay_board;
+
+/* Open a board: a character device path (/dev/usbrelayN) or, in a
+ * LIBUSB=1 build, "usb" / "usb:N". On failure *out is NULL, the result
+ * is USBRELAY_ERR_DEVICE_UNAVAILABLE and errno says why. */
+enum usbrelay_status relay_open(struct relay_board **out, const char *path);
+
+/* Wait for queued writes, then release the board. NULL is a no-op. */
+enum usbrelay_status relay_close(struct relay_board *b);
+
+/* Trust the last known mask instead of reading the device before each
+ * operation; re-read once it is stale_ms old (0 = never) or after an
+ * error. Off by default. */
+void relay_set_cache(struct relay_board *b, int enabled, long stale_ms);
+
+/* Channel operations; *on (if not NULL) receives the resulting state */
+enum usbrelay_status relay_set(struct relay_board *b, int ch, int on);
+enum usbrelay_status relay_get(struct relay_board *b, int ch, int *on);
+enum usbrelay_status relay_toggle(struct relay_board *b, int ch, int *on);
+
+/* Whole-board operations. relay_get_mask honours the cache;
+ * relay_read_mask always asks the device (outside a batch). */
+enum usbrelay_status relay_get_mask(struct relay_board *b, uint8_t *mask);
+enum usbrelay_status relay_read_mask(struct relay_board *b, uint8_t *mask);
+enum usbrelay_status relay_write_mask(struct relay_board *b, uint8_t mask);
+enum usbrelay_status relay_reset(struct relay_board *b);
+enum usbrelay_status relay_ping(struct relay_board *b);
+
+/* Read the mask from the device into *mask and set *fd to a descriptor
+ * that polls POLLPRI once the mask changes, through this or any other
+ * open of the device; each relay_read_mask() re-arms it. *fd is -1 if
+ * the transport cannot notify (libusb, or a driver without poll
+ * support), and the caller has to poll with relay_read_mask() instead.
+ * Not allowed inside a batch (USBRELAY_ERR_BAD_STATE). */
+enum usbrelay_status relay_watch(struct relay_board *b, uint8_t *mask, int *fd);
+
+/* Interlocks: a bitmap over every relay mask, bit m set when mask m may
+ * be applied. Masks are checked before they reach the device: set,
+ * toggle, write_mask and reset refuse a forbidden mask with
+ * USBRELAY_ERR_INTERLOCK and leave the board as it was. Inside a batch
+ * only the mask relay_commit would write is checked; a refused commit
+ * drops the batch. Every mask is allowed until relay_set_interlock()
+ * is called; NULL allows every mask again. */
+#define RELAY_INTERLOCK_WORDS   (((1U << USBRELAY_NUM_CHANNELS) + 31) / 32)
+
+struct relay_interlock {
+    uint32_t allowed[RELAY_INTERLOCK_WORDS];    /* bit m -> mask m allowed */
+};
+
+void relay_set_interlock(struct relay_board *b, const struct relay_interlock *il);
+
+/* Nonzero if the interlocks allow mask */
+int relay_mask_allowed(const struct relay_board *b, uint8_t mask);
+
+/* Batches: between relay_begin and relay_commit, changes are staged and
+ * then applied with a single device write. relay_abort drops them. */
+enum usbrelay_status relay_begin(struct relay_board *b);
+enum usbrelay_status relay_commit(struct relay_board *b, uint8_t *applied);
+enum usbrelay_status relay_abort(struct relay_board *b);
+int relay_in_batch(const struct relay_board *b);
+/* Nonzero if the open batch has staged a change to the mask */
+int relay_batch_dirty(const struct relay_board *b);
+
+/* Wait until every queued write has reached the board (libusb backend;
+ * a no-op for character devices). */
+enum usbrelay_status relay_flush(struct relay_board *b);
+
+/* Current (possibly staged) mask, without device I/O */
+uint8_t relay_mask(const struct relay_board *b);
+
+/* errno of the last failed device operation */
+int relay_errno(const struct relay_board *b);
+
+/* Cache effectiveness counters */
+void relay_stats(const struct relay_board *b, unsigned long *cache_hits,
+                 unsigned long *dev_reads);
+
+/* Device I/O latency: every transport read and write is timed into a
+ * per-board log-linear histogram (about 6% resolution). These may be
+ * called from another thread while the board is in use. With the libusb
+ * backend a write is timed until it is queued, not until it completes. */
+enum relay_io {
+    RELAY_IO_READ = 0,
+    RELAY_IO_WRITE,
+    RELAY_IO_KINDS
+};
+
+struct relay_io_stats {
+    uint64_t count;         /* operations, including failed ones */
+    uint64_t errors;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+void relay_io_stats(const struct relay_board *b, enum relay_io io, struct relay_io_stats *out);
+
+/* Latency at quantile q (0.5 = median), in ns; 0 if nothing recorded */
+uint64_t relay_io_quantile(const struct relay_board *b, enum relay_io io, double q);
+
+/* Operations known to have taken at most ns (histogram buckets) */
+uint64_t relay_io_count_le(const struct relay_board *b, enum relay_io io, uint64_t ns);
+
+/* "OK", "BAD_CHANNEL", ... as used in "ERR <NAME>" protocol lines */
+const char *relay_status_name(enum usbrelay_status status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RELAY_H */
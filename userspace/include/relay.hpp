@@ -0,0 +1,190 @@
+// relay.hpp - C++ RAII wrapper over librelay (relay.h)
+//
+//   usbrelay::RelayBoard board("/dev/usbrelay0");
+//   board.set(1, true);
+//   {
+//       auto batch = board.batch();     // one device write for all three
+//       board.set(2, true);
+//       board.toggle(4);
+//       board.writeMask(board.mask() | 0x01);
+//       batch.commit();                 // not committed -> aborted
+//   }
+//   board.set(usbrelay::Channel<3>(), true);    // channel checked at compile time
+//
+// Failures throw usbrelay::RelayError, which carries the protocol status
+// code and, for device errors, the errno. A RelayBoard closes its device
+// when destroyed; it can be moved but not copied.
+#ifndef RELAY_HPP
+#define RELAY_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "relay.h"
+#include "relay_mask.hpp"
+
+namespace usbrelay {
+
+class RelayError : public std::runtime_error {
+public:
+    RelayError(enum usbrelay_status status, int sys_errno, const std::string &what)
+        : std::runtime_error(what + ": " + relay_status_name(status) +
+                             (sys_errno ? " (errno=" + std::to_string(sys_errno) + ")" : "")),
+          status_(status), errno_(sys_errno) {}
+
+    enum usbrelay_status status() const noexcept { return status_; }
+    int sysErrno() const noexcept { return errno_; }
+
+private:
+    enum usbrelay_status status_;
+    int errno_;
+};
+
+class RelayBoard {
+public:
+    explicit RelayBoard(const std::string &path) {
+        enum usbrelay_status st = relay_open(&board_, path.c_str());
+        if (st != USBRELAY_OK) {
+            throw RelayError(st, errno, "open " + path);
+        }
+    }
+
+    ~RelayBoard() { relay_close(board_); }
+
+    RelayBoard(const RelayBoard &) = delete;
+    RelayBoard &operator=(const RelayBoard &) = delete;
+
+    RelayBoard(RelayBoard &&other) noexcept : board_(std::exchange(other.board_, nullptr)) {}
+    RelayBoard &operator=(RelayBoard &&other) noexcept {
+        if (this != &other) {
+            relay_close(board_);
+            board_ = std::exchange(other.board_, nullptr);
+        }
+        return *this;
+    }
+
+    // Trust the last known mask; re-read after staleMs (0 = never)
+    void enableCache(long staleMs = 0) { relay_set_cache(board_, 1, staleMs); }
+    void disableCache() { relay_set_cache(board_, 0, 0); }
+
+    // Refuse masks the interlocks forbid (RelayError INTERLOCK)
+    void setInterlock(const relay_interlock &il) { relay_set_interlock(board_, &il); }
+    void clearInterlock() { relay_set_interlock(board_, nullptr); }
+
+    void set(int ch, bool on) { check(relay_set(board_, ch, on), "set"); }
+
+    bool get(int ch) {
+        int on = 0;
+        check(relay_get(board_, ch, &on), "get");
+        return on != 0;
+    }
+
+    // Returns the new state of the channel
+    bool toggle(int ch) {
+        int on = 0;
+        check(relay_toggle(board_, ch, &on), "toggle");
+        return on != 0;
+    }
+
+    std::uint8_t mask() {
+        std::uint8_t m = 0;
+        check(relay_get_mask(board_, &m), "getall");
+        return m;
+    }
+
+    std::uint8_t readMask() {
+        std::uint8_t m = 0;
+        check(relay_read_mask(board_, &m), "read-mask");
+        return m;
+    }
+
+    void writeMask(std::uint8_t m) { check(relay_write_mask(board_, m), "write-mask"); }
+
+    // Reads the mask into m; returns a descriptor that polls POLLPRI on
+    // the next change, or -1 if the caller has to poll (relay_watch)
+    int watch(std::uint8_t &m) {
+        int fd = -1;
+        check(relay_watch(board_, &m, &fd), "watch");
+        return fd;
+    }
+
+    // Compile-time checked forms (relay_mask.hpp): the channel or mask
+    // width is validated by the compiler, not on every call.
+    template <unsigned I>
+    void set(Channel<I>, bool on) {
+        static_assert(I <= USBRELAY_NUM_CHANNELS, "channel out of range for this board");
+        check(relay_set(board_, I, on), "set");
+    }
+    template <unsigned I>
+    bool get(Channel<I>) {
+        static_assert(I <= USBRELAY_NUM_CHANNELS, "channel out of range for this board");
+        return get(static_cast<int>(I));
+    }
+    template <unsigned I>
+    bool toggle(Channel<I>) {
+        static_assert(I <= USBRELAY_NUM_CHANNELS, "channel out of range for this board");
+        return toggle(static_cast<int>(I));
+    }
+    void writeMask(BoardMask m) { writeMask(static_cast<std::uint8_t>(m.value())); }
+    BoardMask state() { return BoardMask::fromRaw(mask()); }
+
+    void reset() { check(relay_reset(board_), "reset"); }
+    void ping() { check(relay_ping(board_), "ping"); }
+    void flush() { check(relay_flush(board_), "flush"); }
+
+    // Stages changes until commit(); aborts them if destroyed uncommitted
+    class Batch {
+    public:
+        explicit Batch(RelayBoard &board) : board_(&board) {
+            board.check(relay_begin(board.board_), "begin");
+        }
+        ~Batch() {
+            if (board_) {
+                relay_abort(board_->board_);
+            }
+        }
+
+        Batch(const Batch &) = delete;
+        Batch &operator=(const Batch &) = delete;
+        Batch(Batch &&other) noexcept : board_(std::exchange(other.board_, nullptr)) {}
+        Batch &operator=(Batch &&) = delete;
+
+        // Apply every staged change with one write; returns the new mask
+        std::uint8_t commit() {
+            std::uint8_t m = 0;
+            RelayBoard *b = std::exchange(board_, nullptr);
+            b->check(relay_commit(b->board_, &m), "commit");
+            return m;
+        }
+
+        void abort() {
+            RelayBoard *b = std::exchange(board_, nullptr);
+            b->check(relay_abort(b->board_), "abort");
+        }
+
+    private:
+        RelayBoard *board_;
+    };
+
+    Batch batch() { return Batch(*this); }
+
+    struct relay_board *native() noexcept { return board_; }
+
+private:
+    void check(enum usbrelay_status st, const char *what) const {
+        if (st != USBRELAY_OK) {
+            int err = (st == USBRELAY_ERR_READ_FAILURE || st == USBRELAY_ERR_WRITE_FAILURE ||
+                       st == USBRELAY_ERR_DEVICE_UNAVAILABLE) ? relay_errno(board_) : 0;
+            throw RelayError(st, err, what);
+        }
+    }
+
+    struct relay_board *board_ = nullptr;
+};
+
+} // namespace usbrelay
+
+#endif // RELAY_HPP
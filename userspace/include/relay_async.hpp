@@ -0,0 +1,636 @@
+// relay_async.hpp - C++20 coroutine client for relay boards (header-only)
+//
+//   usbrelay::Task<> blink(usbrelay::AsyncBoard &b) {
+//       co_await b.set(3, true);
+//       bool on = co_await b.toggle(3);
+//       std::uint8_t m = co_await b.watch();    // next change, from anyone
+//   }
+//
+//   usbrelay::EventLoop loop;
+//   usbrelay::AsyncBoard board(loop, "/dev/usbrelay0");
+//   loop.spawn(blink(board));
+//   loop.run();                                 // until every task is done
+//
+// One thread drives any number of boards and pending operations. Each
+// board is a non-blocking descriptor on /dev/usbrelayN using the same
+// one-byte mask read()/write() as relay_read_mask()/relay_write_mask().
+// The loop waits in epoll: EPOLLOUT runs a board's queued operations,
+// EPOLLPRI (the driver's change notification) wakes watch(). Operations
+// queued on a board while it was busy are applied together in their
+// order, with one mask read and at most one mask write, so thousands of
+// pending operations cost a few device transfers.
+//
+// The driver completes each read/write inside the system call, so the
+// loop overlaps waiting (watchers, timers, many boards), not USB
+// transfers. Descriptors epoll cannot watch (no poll support) are
+// treated as always ready, and their watchers read the mask every
+// watchIntervalMs instead.
+//
+// Failures resume the awaiting coroutine with usbrelay::RelayError. A
+// task must not outlive the boards it uses, and a coroutine lambda must
+// not capture by reference (its closure dies before the task runs).
+#ifndef RELAY_ASYNC_HPP
+#define RELAY_ASYNC_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <map>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "relay.hpp"
+
+namespace usbrelay {
+
+class EventLoop;
+class AsyncBoard;
+
+namespace detail {
+
+struct LoopAccess;
+
+inline std::int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+template <typename T>
+struct TaskResult {
+    std::optional<T> value;
+    template <typename U>
+    void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+    T take() { return std::move(*value); }
+};
+
+template <>
+struct TaskResult<void> {
+    void return_void() noexcept {}
+    void take() noexcept {}
+};
+
+} // namespace detail
+
+// Coroutine result type. Lazy: runs when awaited or spawned on a loop.
+template <typename T = void>
+class Task {
+public:
+    struct promise_type : detail::TaskResult<T> {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+        EventLoop *loop = nullptr;      // set for spawned (detached) tasks
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+
+        struct Final {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+            void await_resume() noexcept {}
+        };
+        Final final_suspend() noexcept { return {}; }
+    };
+
+    Task(Task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (h_) {
+                h_.destroy();
+            }
+            h_ = std::exchange(other.h_, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+    // co_await task: run it, resume the caller when it finishes
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        h_.promise().continuation = caller;
+        return h_;
+    }
+    T await_resume() {
+        if (h_.promise().error) {
+            std::rethrow_exception(h_.promise().error);
+        }
+        return h_.promise().take();
+    }
+
+private:
+    friend class EventLoop;
+    explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+// Single-threaded epoll event loop for AsyncBoard operations and timers
+class EventLoop {
+public:
+    EventLoop() : epfd_(epoll_create1(EPOLL_CLOEXEC)) {
+        if (epfd_ < 0) {
+            throw RelayError(USBRELAY_ERR_INTERNAL_ERROR, errno, "epoll_create1");
+        }
+    }
+    ~EventLoop() {
+        for (auto h : detached_) {
+            h.destroy();
+        }
+        close(epfd_);
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Start a task; the loop owns it from now on
+    void spawn(Task<void> task) {
+        auto h = std::exchange(task.h_, nullptr);
+        h.promise().loop = this;
+        detached_.push_back(h);
+        ready_.push_back(h);
+    }
+
+    // Run until every spawned task has finished. Rethrows the first
+    // exception a spawned task let escape.
+    void run();
+
+    // co_await loop.sleep(ms)
+    auto sleep(long ms) {
+        struct Sleep {
+            EventLoop *loop;
+            std::int64_t due;
+            bool await_ready() const noexcept { return due <= detail::nowNs(); }
+            void await_suspend(std::coroutine_handle<> h) { loop->timers_.emplace(due, h); }
+            void await_resume() const noexcept {}
+        };
+        return Sleep{this, detail::nowNs() + static_cast<std::int64_t>(ms) * 1000000LL};
+    }
+
+private:
+    friend class AsyncBoard;
+    friend struct detail::LoopAccess;
+
+    void post(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+    void taskDone(std::coroutine_handle<> h, std::exception_ptr error) {
+        detached_.erase(std::find(detached_.begin(), detached_.end(), h));
+        if (error && !error_) {
+            error_ = error;
+        }
+    }
+
+    int epfd_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::vector<std::coroutine_handle<>> detached_;     // spawned, not finished
+    std::multimap<std::int64_t, std::coroutine_handle<>> timers_;
+    std::vector<AsyncBoard *> boards_;
+    std::exception_ptr error_;
+};
+
+namespace detail {
+
+struct LoopAccess {
+    static void taskDone(EventLoop *loop, std::coroutine_handle<> h, std::exception_ptr error) {
+        loop->taskDone(h, error);
+    }
+};
+
+} // namespace detail
+
+template <typename T>
+std::coroutine_handle<> Task<T>::promise_type::Final::await_suspend(
+    std::coroutine_handle<promise_type> h) noexcept {
+    promise_type &p = h.promise();
+    if (p.loop) {
+        // Detached: nobody awaits the result
+        detail::LoopAccess::taskDone(p.loop, h, p.error);
+        h.destroy();
+        return std::noop_coroutine();
+    }
+    return p.continuation ? p.continuation : std::noop_coroutine();
+}
+
+// One relay board driven by an EventLoop
+class AsyncBoard {
+    enum class Kind : std::uint8_t { Set, Get, Toggle, WriteMask, Reset, Mask };
+
+    struct Request {
+        Kind kind;
+        int channel = 0;
+        std::uint8_t arg = 0;
+        std::uint8_t result = 0;
+        enum usbrelay_status status = USBRELAY_OK;
+        int sysErrno = 0;
+        std::coroutine_handle<> waiter;
+        Request *next = nullptr;
+    };
+
+public:
+    // Awaitable result of a board operation
+    template <typename T>
+    class Op {
+    public:
+        bool await_ready() const noexcept { return req_.status != USBRELAY_OK; }
+        void await_suspend(std::coroutine_handle<> h) {
+            req_.waiter = h;
+            board_->enqueue(&req_);
+        }
+        T await_resume() const {
+            if (req_.status != USBRELAY_OK) {
+                throw RelayError(req_.status, req_.sysErrno, board_->what(req_.kind));
+            }
+            if constexpr (std::is_same_v<T, bool>) {
+                return req_.result != 0;
+            } else if constexpr (!std::is_void_v<T>) {
+                return req_.result;
+            }
+        }
+
+    private:
+        friend class AsyncBoard;
+        Op(AsyncBoard *board, Kind kind, int ch, std::uint8_t arg) : board_(board) {
+            req_.kind = kind;
+            req_.channel = ch;
+            req_.arg = arg;
+            if ((kind == Kind::Set || kind == Kind::Get || kind == Kind::Toggle) &&
+                (ch < USBRELAY_MIN_CHANNEL || ch > USBRELAY_MAX_CHANNEL)) {
+                req_.status = USBRELAY_ERR_BAD_CHANNEL;
+            } else if (kind == Kind::WriteMask && (arg & ~USBRELAY_MASK_ALL)) {
+                req_.status = USBRELAY_ERR_BAD_MASK;
+            }
+        }
+
+        AsyncBoard *board_;
+        Request req_;
+    };
+
+    // Awaitable for the next mask change (see watch())
+    class Watch {
+    public:
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            waiter_ = h;
+            board_->addWatcher(this);
+        }
+        std::uint8_t await_resume() const {
+            if (status_ != USBRELAY_OK) {
+                throw RelayError(status_, sysErrno_, "watch");
+            }
+            return mask_;
+        }
+
+    private:
+        friend class AsyncBoard;
+        explicit Watch(AsyncBoard *board) : board_(board) {}
+
+        AsyncBoard *board_;
+        std::coroutine_handle<> waiter_;
+        int baseline_ = -1;             // mask when the wait started
+        std::uint8_t mask_ = 0;
+        enum usbrelay_status status_ = USBRELAY_OK;
+        int sysErrno_ = 0;
+    };
+
+    long watchIntervalMs = 100;         // watch() polling without EPOLLPRI
+
+    AsyncBoard(EventLoop &loop, const std::string &path) : loop_(&loop) {
+        fd_ = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd_ < 0) {
+            throw RelayError(USBRELAY_ERR_DEVICE_UNAVAILABLE, errno, "open " + path);
+        }
+        struct epoll_event ev = {};
+        ev.data.ptr = this;
+        // EPERM: the descriptor has no poll support, so it is always ready
+        pollable_ = epoll_ctl(loop_->epfd_, EPOLL_CTL_ADD, fd_, &ev) == 0;
+        loop_->boards_.push_back(this);
+    }
+
+    // Destroy only once no task is waiting on the board
+    ~AsyncBoard() {
+        auto &v = loop_->boards_;
+        v.erase(std::find(v.begin(), v.end(), this));
+        if (pollable_) {
+            epoll_ctl(loop_->epfd_, EPOLL_CTL_DEL, fd_, nullptr);
+        }
+        close(fd_);
+    }
+
+    AsyncBoard(const AsyncBoard &) = delete;
+    AsyncBoard &operator=(const AsyncBoard &) = delete;
+
+    // Trust the last known mask instead of reading the device before
+    // each batch; it is re-read after an error
+    void enableCache() { cached_ = true; }
+    void disableCache() { cached_ = false; }
+
+    Op<void> set(int ch, bool on) { return Op<void>(this, Kind::Set, ch, on ? 1 : 0); }
+    Op<bool> get(int ch) { return Op<bool>(this, Kind::Get, ch, 0); }
+    Op<bool> toggle(int ch) { return Op<bool>(this, Kind::Toggle, ch, 0); }
+    Op<void> writeMask(std::uint8_t m) { return Op<void>(this, Kind::WriteMask, 0, m); }
+    Op<void> reset() { return Op<void>(this, Kind::Reset, 0, 0); }
+    Op<std::uint8_t> mask() { return Op<std::uint8_t>(this, Kind::Mask, 0, 0); }
+
+    // Resolves with the mask the next time it differs from the mask
+    // when watch() was awaited, whoever changed it
+    Watch watch() { return Watch(this); }
+
+    // Device transfers so far, e.g. to compare with operations issued
+    unsigned long deviceReads() const noexcept { return reads_; }
+    unsigned long deviceWrites() const noexcept { return writes_; }
+
+private:
+    friend class EventLoop;
+
+    static const char *what(Kind k) {
+        switch (k) {
+        case Kind::Set:       return "set";
+        case Kind::Get:       return "get";
+        case Kind::Toggle:    return "toggle";
+        case Kind::WriteMask: return "write-mask";
+        case Kind::Reset:     return "reset";
+        case Kind::Mask:      return "getall";
+        }
+        return "?";
+    }
+
+    void enqueue(Request *r) {
+        if (tail_) {
+            tail_->next = r;
+        } else {
+            head_ = r;
+        }
+        tail_ = r;
+        updateInterest();
+    }
+
+    void addWatcher(Watch *w) {
+        if (!(cached_ && valid_) && readDevice() != 0) {
+            w->status_ = USBRELAY_ERR_READ_FAILURE;
+            w->sysErrno_ = errno;
+            loop_->post(w->waiter_);
+            return;
+        }
+        w->baseline_ = mask_;
+        watchers_.push_back(w);
+        nextPollNs_ = detail::nowNs() + watchIntervalMs * 1000000LL;
+        updateInterest();
+    }
+
+    int readDevice() {
+        std::uint8_t m;
+        reads_++;
+        if (::read(fd_, &m, 1) != 1) {
+            if (errno == 0) {
+                errno = EIO;
+            }
+            valid_ = false;
+            return -1;
+        }
+        mask_ = m & USBRELAY_MASK_ALL;
+        valid_ = true;
+        return 0;
+    }
+
+    // EPOLLOUT while operations are queued, EPOLLPRI while watched
+    void updateInterest() {
+        std::uint32_t want = (head_ ? std::uint32_t{EPOLLOUT} : 0) |
+                             (watchers_.empty() ? 0 : std::uint32_t{EPOLLPRI});
+        if (!pollable_ || want == events_) {
+            return;
+        }
+        struct epoll_event ev = {};
+        ev.events = want;
+        ev.data.ptr = this;
+        if (epoll_ctl(loop_->epfd_, EPOLL_CTL_MOD, fd_, &ev) == 0) {
+            events_ = want;
+        }
+    }
+
+    // Would the loop ever hear from this board again?
+    bool armed() const noexcept { return events_ != 0 || (!pollable_ && (head_ || !watchers_.empty())); }
+
+    // Run every queued operation: one read (unless cached or the batch
+    // starts with an absolute write), then one write if any mutated
+    void service() {
+        Request *batch = std::exchange(head_, nullptr);
+        tail_ = nullptr;
+        if (!batch) {
+            updateInterest();
+            return;
+        }
+
+        enum usbrelay_status st = USBRELAY_OK;
+        int err = 0;
+        bool absolute = batch->kind == Kind::WriteMask || batch->kind == Kind::Reset;
+        if (!(cached_ && valid_) && !absolute && readDevice() != 0) {
+            st = USBRELAY_ERR_READ_FAILURE;
+            err = errno;
+        }
+
+        bool dirty = false;
+        for (Request *r = batch; r && st == USBRELAY_OK; r = r->next) {
+            std::uint8_t bit = static_cast<std::uint8_t>(1u << (r->channel - 1));
+            switch (r->kind) {
+            case Kind::Set:
+                mask_ = r->arg ? (mask_ | bit) : (mask_ & ~bit);
+                r->result = r->arg;
+                dirty = true;
+                break;
+            case Kind::Get:
+                r->result = (mask_ & bit) != 0;
+                break;
+            case Kind::Toggle:
+                mask_ ^= bit;
+                r->result = (mask_ & bit) != 0;
+                dirty = true;
+                break;
+            case Kind::WriteMask:
+                mask_ = r->arg;
+                dirty = true;
+                break;
+            case Kind::Reset:
+                mask_ = 0;
+                dirty = true;
+                break;
+            case Kind::Mask:
+                r->result = mask_;
+                break;
+            }
+        }
+        if (st == USBRELAY_OK && dirty) {
+            writes_++;
+            if (::write(fd_, &mask_, 1) != 1) {
+                st = USBRELAY_ERR_WRITE_FAILURE;
+                err = errno ? errno : EIO;
+                valid_ = false;
+            } else {
+                valid_ = true;
+            }
+        }
+
+        for (Request *r = batch; r;) {
+            Request *next = r->next;    // r dies once its waiter resumes
+            bool mutating = r->kind != Kind::Get && r->kind != Kind::Mask;
+            if (st != USBRELAY_OK && (st == USBRELAY_ERR_READ_FAILURE || mutating)) {
+                r->status = st;
+                r->sysErrno = err;
+            }
+            loop_->post(r->waiter);
+            r = next;
+        }
+        updateInterest();
+    }
+
+    // The mask may have changed: read it and resolve the watchers that
+    // see a difference
+    void notifyWatchers() {
+        if (watchers_.empty()) {
+            return;
+        }
+        std::vector<Watch *> keep;
+        if (readDevice() != 0) {
+            int err = errno;
+            for (Watch *w : watchers_) {
+                w->status_ = USBRELAY_ERR_READ_FAILURE;
+                w->sysErrno_ = err;
+                loop_->post(w->waiter_);
+            }
+        } else {
+            for (Watch *w : watchers_) {
+                if (w->baseline_ != mask_) {
+                    w->mask_ = mask_;
+                    loop_->post(w->waiter_);
+                } else {
+                    keep.push_back(w);
+                }
+            }
+        }
+        watchers_.swap(keep);
+        updateInterest();
+    }
+
+    void onEvents(std::uint32_t ev) {
+        if (ev & EPOLLOUT) {
+            service();
+        }
+        if (ev & (EPOLLPRI | EPOLLERR)) {
+            notifyWatchers();
+        }
+        if ((ev & (EPOLLERR | EPOLLHUP)) && events_ == 0) {
+            // Reported even with no interest: stop listening, the next
+            // operation will see the error
+            epoll_ctl(loop_->epfd_, EPOLL_CTL_DEL, fd_, nullptr);
+            pollable_ = false;
+        }
+    }
+
+    // For descriptors epoll cannot watch: run queued work now and poll
+    // the watchers on their interval. Lowers *due to the next deadline.
+    void tick(std::int64_t now, std::int64_t *due) {
+        if (pollable_) {
+            return;
+        }
+        if (head_) {
+            service();
+        }
+        if (!watchers_.empty()) {
+            if (now >= nextPollNs_) {
+                notifyWatchers();
+                nextPollNs_ = now + watchIntervalMs * 1000000LL;
+            }
+            if (!watchers_.empty()) {
+                *due = std::min(*due, nextPollNs_);
+            }
+        }
+    }
+
+    EventLoop *loop_;
+    int fd_ = -1;
+    bool pollable_ = false;
+    std::uint32_t events_ = 0;          // epoll interest registered
+    Request *head_ = nullptr;           // queued operations, FIFO
+    Request *tail_ = nullptr;
+    std::vector<Watch *> watchers_;
+    std::int64_t nextPollNs_ = 0;
+    std::uint8_t mask_ = 0;
+    bool valid_ = false;                // mask_ mirrors the device
+    bool cached_ = false;
+    unsigned long reads_ = 0;
+    unsigned long writes_ = 0;
+};
+
+inline void EventLoop::run() {
+    struct epoll_event evs[64];
+
+    while (!detached_.empty()) {
+        while (!ready_.empty()) {
+            auto h = ready_.front();
+            ready_.pop_front();
+            h.resume();
+        }
+        if (detached_.empty()) {
+            break;
+        }
+
+        std::int64_t now = detail::nowNs();
+        std::int64_t due = INT64_MAX;
+        bool armed = false;
+        for (std::size_t i = 0; i < boards_.size(); i++) {
+            boards_[i]->tick(now, &due);
+            armed |= boards_[i]->armed();
+        }
+        while (!timers_.empty() && timers_.begin()->first <= now) {
+            ready_.push_back(timers_.begin()->second);
+            timers_.erase(timers_.begin());
+        }
+        if (!timers_.empty()) {
+            due = std::min(due, timers_.begin()->first);
+        }
+
+        int timeout = -1;
+        if (!ready_.empty()) {
+            timeout = 0;
+        } else if (due != INT64_MAX) {
+            timeout = static_cast<int>((std::max<std::int64_t>(due - now, 0) + 999999) / 1000000);
+        } else if (!armed) {
+            throw RelayError(USBRELAY_ERR_BAD_STATE, 0,
+                             "event loop: tasks are waiting on nothing");
+        }
+
+        int n = epoll_wait(epfd_, evs, 64, timeout);
+        if (n < 0 && errno != EINTR) {
+            throw RelayError(USBRELAY_ERR_INTERNAL_ERROR, errno, "epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            static_cast<AsyncBoard *>(evs[i].data.ptr)->onEvents(evs[i].events);
+        }
+    }
+
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
+
+} // namespace usbrelay
+
+#endif // RELAY_ASYNC_HPP
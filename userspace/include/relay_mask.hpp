@@ -0,0 +1,139 @@
+// relay_mask.hpp - compile-time relay masks for C++ (header-only)
+//
+// RelayMask<N> is the relay state of an N-channel board (N = 1, 2, 4, 8
+// or 16; the SainSmart variants). Channels are 1-based like the protocol
+// and are template arguments, so an out-of-range channel or a mask with
+// bits above channel N is a compile error rather than ERR BAD_CHANNEL /
+// ERR BAD_MASK at run time:
+//
+//   using usbrelay::Channel;
+//   constexpr auto pump_on = usbrelay::RelayMask<4>()
+//                                .set<1>().set(Channel<3>()).toggle<4>().clear<1>();
+//   static_assert(pump_on.value() == 0x0C, "");
+//   board.writeMask(pump_on);      // a single constant write
+//
+//   usbrelay::RelayMask<4>().set<5>();          // error: channel out of range
+//   usbrelay::RelayMask<4>::of<0x1F>();         // error: bits above channel 4
+//
+// Every operation is constexpr and returns a new mask, so a chain
+// evaluated with constant arguments folds to one integer. The value
+// type is the smallest unsigned integer holding N bits (uint8_t up to
+// eight channels, uint16_t for sixteen).
+#ifndef RELAY_MASK_HPP
+#define RELAY_MASK_HPP
+
+#include <cstdint>
+
+#include "usbrelay.h"
+
+namespace usbrelay {
+
+namespace detail {
+
+template <unsigned N>
+struct mask_storage {
+    static_assert(N == 1 || N == 2 || N == 4 || N == 8 || N == 16,
+                  "SainSmart boards have 1, 2, 4, 8 or 16 channels");
+    using type = typename mask_storage<(N <= 8 ? 8 : 16)>::type;
+};
+
+template <>
+struct mask_storage<8> {
+    using type = std::uint8_t;
+};
+
+template <>
+struct mask_storage<16> {
+    using type = std::uint16_t;
+};
+
+} // namespace detail
+
+// A channel number fixed at compile time; bit<N>() checks it against a
+// board width.
+template <unsigned I>
+struct Channel {
+    static_assert(I >= 1, "channels are numbered from 1");
+
+    static constexpr unsigned index = I;
+
+    template <unsigned N>
+    static constexpr typename detail::mask_storage<N>::type bit() {
+        static_assert(I <= N, "channel out of range for this board");
+        return static_cast<typename detail::mask_storage<N>::type>(1U << (I - 1));
+    }
+};
+
+template <unsigned N>
+class RelayMask {
+public:
+    using value_type = typename detail::mask_storage<N>::type;
+
+    static constexpr unsigned channels = N;
+    static constexpr value_type all_bits =
+        static_cast<value_type>(N == 16 ? 0xFFFFU : (1U << N) - 1);
+
+    constexpr RelayMask() = default;
+
+    static constexpr RelayMask none() { return RelayMask(0); }
+    static constexpr RelayMask all() { return RelayMask(all_bits); }
+
+    // A literal mask, checked against the board width
+    template <value_type V>
+    static constexpr RelayMask of() {
+        static_assert((V & ~all_bits) == 0, "mask has bits above the last channel");
+        return RelayMask(V);
+    }
+
+    // A mask that is only known at run time (e.g. read back from the
+    // device): bits above channel N are dropped.
+    static constexpr RelayMask fromRaw(unsigned raw) {
+        return RelayMask(static_cast<value_type>(raw & all_bits));
+    }
+
+    template <unsigned I>
+    constexpr RelayMask set() const { return RelayMask(bits_ | Channel<I>::template bit<N>()); }
+    template <unsigned I>
+    constexpr RelayMask clear() const {
+        return RelayMask(bits_ & static_cast<value_type>(~Channel<I>::template bit<N>()));
+    }
+    template <unsigned I>
+    constexpr RelayMask toggle() const { return RelayMask(bits_ ^ Channel<I>::template bit<N>()); }
+    template <unsigned I>
+    constexpr RelayMask assign(bool on) const { return on ? set<I>() : clear<I>(); }
+    template <unsigned I>
+    constexpr bool test() const { return (bits_ & Channel<I>::template bit<N>()) != 0; }
+
+    template <unsigned I>
+    constexpr RelayMask set(Channel<I>) const { return set<I>(); }
+    template <unsigned I>
+    constexpr RelayMask clear(Channel<I>) const { return clear<I>(); }
+    template <unsigned I>
+    constexpr RelayMask toggle(Channel<I>) const { return toggle<I>(); }
+    template <unsigned I>
+    constexpr RelayMask assign(Channel<I>, bool on) const { return assign<I>(on); }
+    template <unsigned I>
+    constexpr bool test(Channel<I>) const { return test<I>(); }
+
+    constexpr value_type value() const { return bits_; }
+    constexpr bool any() const { return bits_ != 0; }
+
+    friend constexpr RelayMask operator|(RelayMask a, RelayMask b) { return RelayMask(a.bits_ | b.bits_); }
+    friend constexpr RelayMask operator&(RelayMask a, RelayMask b) { return RelayMask(a.bits_ & b.bits_); }
+    friend constexpr RelayMask operator^(RelayMask a, RelayMask b) { return RelayMask(a.bits_ ^ b.bits_); }
+    friend constexpr RelayMask operator~(RelayMask a) { return RelayMask(a.bits_ ^ all_bits); }
+    friend constexpr bool operator==(RelayMask a, RelayMask b) { return a.bits_ == b.bits_; }
+    friend constexpr bool operator!=(RelayMask a, RelayMask b) { return a.bits_ != b.bits_; }
+
+private:
+    constexpr explicit RelayMask(unsigned bits) : bits_(static_cast<value_type>(bits)) {}
+
+    value_type bits_ = 0;
+};
+
+// The board this tree drives (USBRELAY_NUM_CHANNELS in usbrelay.h)
+using BoardMask = RelayMask<USBRELAY_NUM_CHANNELS>;
+
+} // namespace usbrelay
+
+#endif // RELAY_MASK_HPP
@@ -0,0 +1,108 @@
+#ifndef RELAY_RING_H
+#define RELAY_RING_H
+
+/*
+ * Shared-memory command rings between a relayctl ring server
+ * (relayctl -Q <name>) and client processes on the same host.
+ *
+ * The server owns the boards and a POSIX shared memory object with one
+ * slot per client. A slot holds two single-producer/single-consumer
+ * rings of RELAY_RING_DEPTH binary frames (struct usbrelay_frame, the
+ * 8-byte layout of PROTOCOL.md section 1.4): requests from the client
+ * and responses from the server. Submitting a command is a frame copy
+ * and one release store; no system call is made while the other side
+ * is spinning. A side that has been idle for its spin interval sleeps
+ * on a process-shared futex and is woken by the next submit or
+ * response, so an idle server costs no CPU.
+ *
+ * Requests have the semantics of binary frames on a session's stdin:
+ * one response per request, in order, BEGIN/COMMIT/ABORT per board.
+ * A transaction belongs to the client that began it. While it is open,
+ * BEGIN, COMMIT, ABORT and mutations from other clients on that board
+ * fail with BAD_STATE. It is aborted when its client detaches or dies.
+ * A client may have up to RELAY_RING_DEPTH requests outstanding.
+ *
+ * All functions return 0, or -1 with errno set.
+ */
+
+#include <signal.h>
+#include <stdint.h>
+
+#include "usbrelay.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RELAY_RING_DEPTH            64      /* frames per ring, power of two */
+#define RELAY_RING_MAX_CLIENTS      64
+#define RELAY_RING_DEFAULT_CLIENTS  8
+#define RELAY_RING_SPIN_US          50      /* busy-wait before sleeping */
+
+struct relay_ring;              /* server end */
+struct relay_ring_client;       /* client end */
+
+/* ---- server ---- */
+
+struct relay_ring_stats {
+    unsigned long frames;       /* requests executed */
+    unsigned long sleeps;       /* futex waits after spinning idle */
+    unsigned long clients;      /* attaches served */
+};
+
+/* Run one request of client (its slot, 0..nclients-1); resp must be
+ * filled in (binary protocol semantics) */
+typedef void (*relay_ring_exec_fn)(void *arg, int client, const struct usbrelay_frame *req,
+                                   struct usbrelay_frame *resp);
+
+/* Client has detached or died and its last requests have run; the slot
+ * may be handed to a new client after this returns */
+typedef void (*relay_ring_close_fn)(void *arg, int client);
+
+/* Create the shared memory object name ("/name"; a leading '/' is
+ * added if missing) with room for nclients clients. A ring left by a
+ * server that died is taken over; fails with EEXIST if a live server
+ * owns it or the object is not a relay ring. */
+int relay_ring_create(struct relay_ring **out, const char *name, int nclients);
+
+/* Serve requests until *stop is set: spin for spin_us after the last
+ * request, then sleep. Slots of clients that exit without detaching
+ * are reclaimed; closed (if not NULL) is told about every client that
+ * has gone. */
+int relay_ring_serve(struct relay_ring *r, relay_ring_exec_fn exec, relay_ring_close_fn closed,
+                     void *arg, long spin_us, volatile sig_atomic_t *stop,
+                     struct relay_ring_stats *st);
+
+/* Tell clients the server is gone, unmap and unlink. NULL is a no-op. */
+void relay_ring_destroy(struct relay_ring *r);
+
+/* ---- client ---- */
+
+/* Claim a free slot of the server at name. ENOENT: no such server;
+ * ECONNREFUSED: the server has gone; EBUSY: every slot is taken;
+ * EPROTO: not a ring of this version. */
+int relay_ring_attach(struct relay_ring_client **out, const char *name);
+
+/* Queue one request without waiting; EAGAIN if RELAY_RING_DEPTH
+ * requests are already outstanding. */
+int relay_ring_submit(struct relay_ring_client *c, const struct usbrelay_frame *req);
+
+/* Take the next response, spinning for RELAY_RING_SPIN_US and then
+ * sleeping up to timeout_ms (-1 = no limit). ETIMEDOUT on timeout;
+ * EPIPE if the server has gone. */
+int relay_ring_receive(struct relay_ring_client *c, struct usbrelay_frame *resp,
+                       long timeout_ms);
+
+/* Submit one request and wait for its response */
+int relay_ring_call(struct relay_ring_client *c, const struct usbrelay_frame *req,
+                    struct usbrelay_frame *resp, long timeout_ms);
+
+/* Release the slot (requests still queued are executed) and unmap.
+ * NULL is a no-op. */
+void relay_ring_detach(struct relay_ring_client *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RELAY_RING_H */
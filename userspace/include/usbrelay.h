@@ -15,4 +15,50 @@
 #define USBRELAY_MAX_LINE_LEN    128
 #define USBRELAY_DEFAULT_DEVICE  "/dev/usbrelay0"
 
+/* Status codes; the ASCII protocol prints these as "ERR <NAME> ..." */
+enum usbrelay_status {
+    USBRELAY_OK = 0,
+    USBRELAY_ERR_BAD_COMMAND,
+    USBRELAY_ERR_BAD_CHANNEL,
+    USBRELAY_ERR_BAD_STATE,
+    USBRELAY_ERR_BAD_MASK,
+    USBRELAY_ERR_DEVICE_UNAVAILABLE,
+    USBRELAY_ERR_INTERNAL_ERROR,
+    USBRELAY_ERR_READ_FAILURE,
+    USBRELAY_ERR_WRITE_FAILURE,
+    USBRELAY_ERR_BAD_BOARD,
+    USBRELAY_ERR_INTERLOCK
+};
+
+/* Binary framing (see PROTOCOL.md section 1.4) */
+#define USBRELAY_OP_SET          0x01
+#define USBRELAY_OP_GET          0x02
+#define USBRELAY_OP_GETALL       0x03
+#define USBRELAY_OP_TOGGLE       0x04
+#define USBRELAY_OP_WRITE_MASK   0x05
+#define USBRELAY_OP_READ_MASK    0x06
+#define USBRELAY_OP_RESET        0x07
+#define USBRELAY_OP_PING         0x08
+#define USBRELAY_OP_VERSION      0x09
+#define USBRELAY_OP_BEGIN        0x0A
+#define USBRELAY_OP_COMMIT       0x0B
+#define USBRELAY_OP_ABORT        0x0C
+#define USBRELAY_OP_TEXT         0x7E   /* leave binary mode */
+#define USBRELAY_OP_QUIT         0x7F   /* end the session */
+
+#define USBRELAY_FRAME_SIZE      8
+#define USBRELAY_PROTO_BIN_VERSION 0x11  /* VERSION reply: major << 4 | minor */
+
+/* One request or response frame. seq is little-endian and echoed back. */
+struct usbrelay_frame {
+    uint8_t  op;        /* USBRELAY_OP_* */
+    uint8_t  status;    /* request: 0; response: enum usbrelay_status */
+    uint16_t seq;       /* chosen by the client */
+    uint8_t  channel;   /* 1..4 for channel commands, else 0 */
+    uint8_t  arg;       /* request: state (SET) or mask (WRITE_MASK);
+                           response: channel state for channel commands */
+    uint8_t  mask;      /* response: relay mask after the command */
+    uint8_t  board;     /* board index (0 = first -d device) */
+};
+
 #endif /* USBRELAY_H */
@@ -0,0 +1,416 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/relay.h"
+#include "relay_hist.h"
+#include "relay_transport.h"
+
+/* Holds the state of one open board. */
+struct relay_board {
+    struct relay_transport tp;
+    uint8_t mask;               /* shadow (or staged) relay mask */
+    int last_errno;
+
+    /* Shadow-mask cache: trust mask between operations instead of
+     * re-reading the device every time. */
+    int cached;
+    int mask_valid;             /* mask mirrors the device */
+    long stale_ms;              /* re-read after this long; 0 = never */
+    struct timespec mask_time;  /* when mask was last synced */
+    unsigned long cache_hits;
+    unsigned long dev_reads;
+
+    /* Batching: mutations are staged in mask and flushed with a single
+     * write at commit. */
+    int in_txn;
+    int txn_dirty;              /* staged mask differs from last write */
+    uint8_t txn_base;           /* mask at begin, restored by abort */
+
+    /* Masks that may be applied (all of them unless interlocked) */
+    struct relay_interlock interlock;
+
+    /* Latency of every transport read/write, for relay_io_*() */
+    struct relay_hist io[RELAY_IO_KINDS];
+};
+
+static const char *const relay_status_names[] = {
+    [USBRELAY_OK]                     = "OK",
+    [USBRELAY_ERR_BAD_COMMAND]        = "BAD_COMMAND",
+    [USBRELAY_ERR_BAD_CHANNEL]        = "BAD_CHANNEL",
+    [USBRELAY_ERR_BAD_STATE]          = "BAD_STATE",
+    [USBRELAY_ERR_BAD_MASK]           = "BAD_MASK",
+    [USBRELAY_ERR_DEVICE_UNAVAILABLE] = "DEVICE_UNAVAILABLE",
+    [USBRELAY_ERR_INTERNAL_ERROR]     = "INTERNAL_ERROR",
+    [USBRELAY_ERR_READ_FAILURE]       = "READ_FAILURE",
+    [USBRELAY_ERR_WRITE_FAILURE]      = "WRITE_FAILURE",
+    [USBRELAY_ERR_BAD_BOARD]          = "BAD_BOARD",
+    [USBRELAY_ERR_INTERLOCK]          = "INTERLOCK",
+};
+
+const char *relay_status_name(enum usbrelay_status status) {
+    if ((unsigned)status >= sizeof(relay_status_names) / sizeof(relay_status_names[0])) {
+        return "INTERNAL_ERROR";
+    }
+    return relay_status_names[status];
+}
+
+static int channel_valid(int ch) {
+    return ch >= USBRELAY_MIN_CHANNEL && ch <= USBRELAY_MAX_CHANNEL;
+}
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Mark the shadow mask as in sync with the device as of now */
+static void mask_synced(struct relay_board *b) {
+    b->mask_valid = 1;
+    clock_gettime(CLOCK_MONOTONIC, &b->mask_time);
+}
+
+static enum usbrelay_status dev_read(struct relay_board *b) {
+    uint8_t m;
+    uint64_t t0 = clock_ns();
+    int rc = b->tp.ops->read(&b->tp, &m);
+
+    relay_hist_record(&b->io[RELAY_IO_READ], clock_ns() - t0, rc != 0);
+    b->dev_reads++;
+    if (rc == 0) {
+        b->mask = m & USBRELAY_MASK_ALL;
+        mask_synced(b);
+        return USBRELAY_OK;
+    }
+    b->last_errno = errno;
+    b->mask_valid = 0;
+    return USBRELAY_ERR_READ_FAILURE;
+}
+
+static enum usbrelay_status dev_write(struct relay_board *b) {
+    uint64_t t0;
+    int rc;
+
+    b->mask &= USBRELAY_MASK_ALL;
+    t0 = clock_ns();
+    rc = b->tp.ops->write(&b->tp, b->mask);
+    relay_hist_record(&b->io[RELAY_IO_WRITE], clock_ns() - t0, rc != 0);
+    if (rc == 0) {
+        mask_synced(b);
+        return USBRELAY_OK;
+    }
+    b->last_errno = errno;
+    b->mask_valid = 0;
+    return USBRELAY_ERR_WRITE_FAILURE;
+}
+
+/* Bring mask up to date before acting on it. Without the cache this
+ * always reads the device; with it the shadow mask is trusted until an
+ * error invalidates it or it is older than stale_ms. */
+static enum usbrelay_status refresh(struct relay_board *b) {
+    /* Inside a batch the staged mask is authoritative */
+    if (b->in_txn) {
+        return USBRELAY_OK;
+    }
+    if (b->cached && b->mask_valid) {
+        if (b->stale_ms == 0) {
+            b->cache_hits++;
+            return USBRELAY_OK;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long age_ms = (now.tv_sec - b->mask_time.tv_sec) * 1000L +
+                      (now.tv_nsec - b->mask_time.tv_nsec) / 1000000L;
+        if (age_ms < b->stale_ms) {
+            b->cache_hits++;
+            return USBRELAY_OK;
+        }
+    }
+    return dev_read(b);
+}
+
+static int interlock_allows(const struct relay_board *b, uint8_t mask) {
+    return (b->interlock.allowed[mask >> 5] >> (mask & 31)) & 1;
+}
+
+/* Make mask the board's mask: push it to the device, or only stage it
+ * inside a batch (commit checks the interlocks then). A mask the
+ * interlocks forbid is refused and the board keeps its old mask. */
+static enum usbrelay_status apply(struct relay_board *b, uint8_t mask) {
+    mask &= USBRELAY_MASK_ALL;
+    if (b->in_txn) {
+        b->mask = mask;
+        b->txn_dirty = 1;
+        return USBRELAY_OK;
+    }
+    if (!interlock_allows(b, mask)) {
+        return USBRELAY_ERR_INTERLOCK;
+    }
+    b->mask = mask;
+    return dev_write(b);
+}
+
+enum usbrelay_status relay_open(struct relay_board **out, const char *path) {
+    struct relay_board *b = calloc(1, sizeof(*b));
+
+    *out = NULL;
+    if (!b) {
+        return USBRELAY_ERR_INTERNAL_ERROR;
+    }
+    if (relay_transport_open(&b->tp, path) != 0) {
+        int saved_errno = errno;
+        free(b);
+        errno = saved_errno;
+        return USBRELAY_ERR_DEVICE_UNAVAILABLE;
+    }
+    relay_set_interlock(b, NULL);
+    *out = b;
+    return USBRELAY_OK;
+}
+
+enum usbrelay_status relay_close(struct relay_board *b) {
+    enum usbrelay_status st = USBRELAY_OK;
+
+    if (!b) {
+        return USBRELAY_OK;
+    }
+    if (relay_transport_close(&b->tp) != 0) {
+        st = USBRELAY_ERR_WRITE_FAILURE;
+    }
+    free(b);
+    return st;
+}
+
+void relay_set_cache(struct relay_board *b, int enabled, long stale_ms) {
+    b->cached = enabled;
+    b->stale_ms = stale_ms < 0 ? 0 : stale_ms;
+}
+
+enum usbrelay_status relay_set(struct relay_board *b, int ch, int on) {
+    enum usbrelay_status st;
+
+    if (!channel_valid(ch)) {
+        return USBRELAY_ERR_BAD_CHANNEL;
+    }
+    if ((st = refresh(b)) != USBRELAY_OK) {
+        return st;
+    }
+
+    /* bit 0 -> CH1, etc. */
+    if (on) {
+        return apply(b, b->mask | USBRELAY_CH_TO_BIT(ch));
+    }
+    return apply(b, b->mask & ~USBRELAY_CH_TO_BIT(ch));
+}
+
+enum usbrelay_status relay_get(struct relay_board *b, int ch, int *on) {
+    enum usbrelay_status st;
+
+    if (!channel_valid(ch)) {
+        return USBRELAY_ERR_BAD_CHANNEL;
+    }
+    if ((st = refresh(b)) != USBRELAY_OK) {
+        return st;
+    }
+    if (on) {
+        *on = (b->mask & USBRELAY_CH_TO_BIT(ch)) != 0;
+    }
+    return USBRELAY_OK;
+}
+
+enum usbrelay_status relay_toggle(struct relay_board *b, int ch, int *on) {
+    enum usbrelay_status st;
+
+    if (!channel_valid(ch)) {
+        return USBRELAY_ERR_BAD_CHANNEL;
+    }
+    if ((st = refresh(b)) != USBRELAY_OK) {
+        return st;
+    }
+
+    if ((st = apply(b, b->mask ^ USBRELAY_CH_TO_BIT(ch))) != USBRELAY_OK) {
+        return st;
+    }
+    if (on) {
+        *on = (b->mask & USBRELAY_CH_TO_BIT(ch)) != 0;
+    }
+    return USBRELAY_OK;
+}
+
+enum usbrelay_status relay_get_mask(struct relay_board *b, uint8_t *mask) {
+    enum usbrelay_status st = refresh(b);
+
+    if (st == USBRELAY_OK && mask) {
+        *mask = b->mask;
+    }
+    return st;
+}
+
+enum usbrelay_status relay_read_mask(struct relay_board *b, uint8_t *mask) {
+    /* Inside a batch report the staged mask, not the device */
+    if (!b->in_txn) {
+        enum usbrelay_status st = dev_read(b);
+        if (st != USBRELAY_OK) {
+            return st;
+        }
+    }
+    if (mask) {
+        *mask = b->mask;
+    }
+    return USBRELAY_OK;
+}
+
+enum usbrelay_status relay_write_mask(struct relay_board *b, uint8_t mask) {
+    if (mask & ~USBRELAY_MASK_ALL) {
+        return USBRELAY_ERR_BAD_MASK;
+    }
+    return apply(b, mask);
+}
+
+enum usbrelay_status relay_reset(struct relay_board *b) {
+    return apply(b, 0x00);
+}
+
+void relay_set_interlock(struct relay_board *b, const struct relay_interlock *il) {
+    if (il) {
+        b->interlock = *il;
+    } else {
+        memset(&b->interlock, 0xFF, sizeof(b->interlock));
+    }
+}
+
+int relay_mask_allowed(const struct relay_board *b, uint8_t mask) {
+    return (mask & ~USBRELAY_MASK_ALL) == 0 && interlock_allows(b, mask);
+}
+
+enum usbrelay_status relay_watch(struct relay_board *b, uint8_t *mask, int *fd) {
+    *fd = -1;
+    if (b->in_txn) {
+        return USBRELAY_ERR_BAD_STATE;
+    }
+
+    enum usbrelay_status st = relay_read_mask(b, mask);
+    if (st == USBRELAY_OK) {
+        *fd = relay_transport_watch_fd(&b->tp);
+    }
+    return st;
+}
+
+enum usbrelay_status relay_ping(struct relay_board *b) {
+    uint8_t staged = b->mask;
+    enum usbrelay_status st = dev_read(b);
+
+    if (b->in_txn) {
+        b->mask = staged;       /* keep staged changes intact */
+    }
+    return st == USBRELAY_OK ? USBRELAY_OK : USBRELAY_ERR_DEVICE_UNAVAILABLE;
+}
+
+enum usbrelay_status relay_begin(struct relay_board *b) {
+    enum usbrelay_status st;
+
+    if (b->in_txn) {
+        return USBRELAY_ERR_BAD_COMMAND;
+    }
+    /* Stage on top of the current device state */
+    if ((st = refresh(b)) != USBRELAY_OK) {
+        return st;
+    }
+
+    b->in_txn = 1;
+    b->txn_dirty = 0;
+    b->txn_base = b->mask;
+    return USBRELAY_OK;
+}
+
+enum usbrelay_status relay_commit(struct relay_board *b, uint8_t *applied) {
+    if (!b->in_txn) {
+        return USBRELAY_ERR_BAD_COMMAND;
+    }
+
+    b->in_txn = 0;
+    if (b->txn_dirty && !interlock_allows(b, b->mask)) {
+        b->mask = b->txn_base;
+        b->txn_dirty = 0;
+        return USBRELAY_ERR_INTERLOCK;
+    }
+    if (b->txn_dirty) {
+        enum usbrelay_status st = dev_write(b);
+        if (st != USBRELAY_OK) {
+            return st;
+        }
+    }
+    b->txn_dirty = 0;
+    if (applied) {
+        *applied = b->mask;
+    }
+    return USBRELAY_OK;
+}
+
+enum usbrelay_status relay_abort(struct relay_board *b) {
+    if (!b->in_txn) {
+        return USBRELAY_ERR_BAD_COMMAND;
+    }
+
+    b->mask = b->txn_base;
+    b->in_txn = 0;
+    b->txn_dirty = 0;
+    return USBRELAY_OK;
+}
+
+int relay_in_batch(const struct relay_board *b) {
+    return b->in_txn;
+}
+
+int relay_batch_dirty(const struct relay_board *b) {
+    return b->in_txn && b->txn_dirty;
+}
+
+enum usbrelay_status relay_flush(struct relay_board *b) {
+    if (relay_transport_flush(&b->tp) != 0) {
+        b->last_errno = errno;
+        b->mask_valid = 0;
+        return USBRELAY_ERR_WRITE_FAILURE;
+    }
+    return USBRELAY_OK;
+}
+
+uint8_t relay_mask(const struct relay_board *b) {
+    return b->mask;
+}
+
+int relay_errno(const struct relay_board *b) {
+    return b->last_errno;
+}
+
+void relay_stats(const struct relay_board *b, unsigned long *cache_hits,
+                 unsigned long *dev_reads) {
+    if (cache_hits) {
+        *cache_hits = b->cache_hits;
+    }
+    if (dev_reads) {
+        *dev_reads = b->dev_reads;
+    }
+}
+
+void relay_io_stats(const struct relay_board *b, enum relay_io io, struct relay_io_stats *out) {
+    const struct relay_hist *h = &b->io[io];
+
+    out->count = atomic_load_explicit(&h->total, memory_order_relaxed);
+    out->errors = atomic_load_explicit(&h->errors, memory_order_relaxed);
+    out->sum_ns = atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+    out->max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+}
+
+uint64_t relay_io_quantile(const struct relay_board *b, enum relay_io io, double q) {
+    return relay_hist_quantile(&b->io[io], q);
+}
+
+uint64_t relay_io_count_le(const struct relay_board *b, enum relay_io io, uint64_t ns) {
+    return relay_hist_count_le(&b->io[io], ns);
+}
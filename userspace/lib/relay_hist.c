@@ -0,0 +1,88 @@
+#include "relay_hist.h"
+
+/* Single writer: a relaxed load + store is enough and avoids a locked
+ * read-modify-write on every device operation */
+static void hist_add(_Atomic uint64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v,
+                          memory_order_relaxed);
+}
+
+static uint64_t hist_get(const _Atomic uint64_t *c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static unsigned hist_index(uint64_t ns) {
+    if (ns > RELAY_HIST_MAX_NS) {
+        ns = RELAY_HIST_MAX_NS;
+    }
+    if (ns < 2 * RELAY_HIST_SUB) {
+        return (unsigned)ns;
+    }
+
+    unsigned msb = 63U - (unsigned)__builtin_clzll(ns);
+    unsigned shift = msb - RELAY_HIST_SUB_BITS;
+    return (shift + 1) * RELAY_HIST_SUB + (unsigned)((ns >> shift) - RELAY_HIST_SUB);
+}
+
+/* Largest value that maps to bucket idx */
+static uint64_t hist_upper(unsigned idx) {
+    if (idx < 2 * RELAY_HIST_SUB) {
+        return idx;
+    }
+
+    unsigned shift = idx / RELAY_HIST_SUB - 1;
+    uint64_t lower = (uint64_t)(RELAY_HIST_SUB + idx % RELAY_HIST_SUB) << shift;
+    return lower + (UINT64_C(1) << shift) - 1;
+}
+
+void relay_hist_record(struct relay_hist *h, uint64_t ns, int failed) {
+    hist_add(&h->counts[hist_index(ns)], 1);
+    hist_add(&h->total, 1);
+    hist_add(&h->sum_ns, ns);
+    if (failed) {
+        hist_add(&h->errors, 1);
+    }
+    if (ns > hist_get(&h->max_ns)) {
+        atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+    }
+}
+
+uint64_t relay_hist_quantile(const struct relay_hist *h, double q) {
+    uint64_t total = 0;
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < RELAY_HIST_BUCKETS; i++) {
+        total += hist_get(&h->counts[i]);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    if (q < 0.0) {
+        q = 0.0;
+    } else if (q > 1.0) {
+        q = 1.0;
+    }
+
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (unsigned i = 0; i < RELAY_HIST_BUCKETS; i++) {
+        seen += hist_get(&h->counts[i]);
+        if (seen >= rank) {
+            uint64_t upper = hist_upper(i);
+            uint64_t max = hist_get(&h->max_ns);
+            return (max && upper > max) ? max : upper;
+        }
+    }
+    return hist_get(&h->max_ns);
+}
+
+uint64_t relay_hist_count_le(const struct relay_hist *h, uint64_t ns) {
+    uint64_t n = 0;
+
+    for (unsigned i = 0; i < RELAY_HIST_BUCKETS && hist_upper(i) <= ns; i++) {
+        n += hist_get(&h->counts[i]);
+    }
+    return n;
+}
@@ -0,0 +1,42 @@
+#ifndef RELAY_HIST_H
+#define RELAY_HIST_H
+
+/*
+ * Log-linear latency histogram (HdrHistogram-style) in nanoseconds.
+ *
+ * Values below 2 * RELAY_HIST_SUB get one bucket each; above that every
+ * power of two is split into RELAY_HIST_SUB linear buckets, so a bucket
+ * is never wider than 1/16 of its value (about 6% resolution) from 1 ns
+ * up to RELAY_HIST_MAX_NS. Larger values land in the last bucket.
+ *
+ * One thread records (the one using the board); any thread may read.
+ * Counters are relaxed atomics, so readers see each counter whole but a
+ * snapshot may be a few operations behind.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define RELAY_HIST_SUB_BITS  4
+#define RELAY_HIST_SUB       (1U << RELAY_HIST_SUB_BITS)
+#define RELAY_HIST_MAX_MSB   39                  /* ~550 s */
+#define RELAY_HIST_MAX_NS    ((UINT64_C(1) << (RELAY_HIST_MAX_MSB + 1)) - 1)
+#define RELAY_HIST_BUCKETS   ((RELAY_HIST_MAX_MSB - RELAY_HIST_SUB_BITS + 2) * RELAY_HIST_SUB)
+
+struct relay_hist {
+    _Atomic uint64_t counts[RELAY_HIST_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t errors;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t max_ns;
+};
+
+void relay_hist_record(struct relay_hist *h, uint64_t ns, int failed);
+
+/* Upper bound of the bucket holding quantile q (0..1); 0 when empty */
+uint64_t relay_hist_quantile(const struct relay_hist *h, double q);
+
+/* Recorded values in buckets that lie entirely at or below ns */
+uint64_t relay_hist_count_le(const struct relay_hist *h, uint64_t ns);
+
+#endif /* RELAY_HIST_H */
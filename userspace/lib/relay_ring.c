@@ -0,0 +1,563 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE     /* syscall() for futex(2) */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/relay_ring.h"
+
+/*
+ * Shared memory layout (host byte order). Producer and consumer
+ * indices live on separate cache lines so that the two sides of a ring
+ * only share a line when one of them actually publishes.
+ *
+ * A side about to sleep sets its "sleeping" flag and re-checks its
+ * ring before futex_wait(wake); the other side publishes and then, only
+ * if the flag is set, bumps wake and calls futex_wake. Both use
+ * sequentially consistent accesses, so either the sleeper sees the new
+ * frame or the publisher sees the flag.
+ */
+
+#define RING_MAGIC          "RLYRING"
+#define RING_VERSION        1
+#define RING_SLOT_FREE      0u
+#define RING_SLOT_CLOSING   UINT32_MAX      /* detached, not yet reclaimed */
+#define RING_IDLE_NS        100000000LL     /* sleep slice: check for dead peers */
+#define RING_ATTACH_TRIES   100             /* 1 ms apart, waiting for a CLOSING slot */
+
+struct ring_queue {
+    alignas(64) _Atomic uint32_t head;      /* frames published (producer) */
+    alignas(64) _Atomic uint32_t tail;      /* frames consumed (consumer) */
+    alignas(64) struct usbrelay_frame frame[RELAY_RING_DEPTH];
+};
+
+struct ring_slot {
+    alignas(64) _Atomic uint32_t owner;     /* client pid, FREE or CLOSING */
+    _Atomic uint32_t wake;                  /* futex: responses posted */
+    _Atomic uint32_t sleeping;              /* client waits on wake */
+    struct ring_queue req;                  /* client -> server */
+    struct ring_queue resp;                 /* server -> client */
+};
+
+struct ring_shm {
+    char             magic[8];
+    uint32_t         version;
+    uint32_t         nslots;
+    uint32_t         depth;                 /* RELAY_RING_DEPTH */
+    uint32_t         frame_size;            /* sizeof(struct usbrelay_frame) */
+    _Atomic uint32_t server_pid;            /* 0 once the server has gone */
+    alignas(64) _Atomic uint32_t wake;      /* futex: requests submitted */
+    _Atomic uint32_t sleeping;              /* server waits on wake */
+    alignas(64) struct ring_slot slot[];
+};
+
+struct relay_ring {
+    struct ring_shm *shm;
+    size_t           len;
+    char             name[NAME_MAX];
+    uint32_t         nslots;        /* private: the shared copy is writable by clients */
+    uint32_t         seen[RELAY_RING_MAX_CLIENTS];  /* last owner per slot */
+};
+
+struct relay_ring_client {
+    struct ring_shm  *shm;
+    size_t            len;
+    struct ring_slot *slot;
+};
+
+static int64_t ring_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void ring_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Busy-waiting only pays off when the other side runs on another CPU;
+ * on a uniprocessor it just delays it, so go straight to the futex */
+static int64_t ring_spin_ns(long spin_us) {
+    static long ncpus;
+
+    if (ncpus == 0) {
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return ncpus > 1 && spin_us > 0 ? (int64_t)spin_us * 1000 : 0;
+}
+
+static size_t ring_size(uint32_t nslots) {
+    return sizeof(struct ring_shm) + (size_t)nslots * sizeof(struct ring_slot);
+}
+
+static int ring_path(char *buf, size_t len, const char *name) {
+    int n = snprintf(buf, len, "%s%s", name[0] == '/' ? "" : "/", name);
+    if (n < 2 || (size_t)n >= len || strchr(buf + 1, '/')) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Map an existing ring read-write and check its header (EPROTO if it is
+ * not a ring this library understands) */
+static int ring_map(const char *path, struct ring_shm **out, size_t *len) {
+    struct ring_shm *shm;
+    struct stat sb;
+    int fd;
+
+    fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    if ((size_t)sb.st_size < sizeof(struct ring_shm)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    shm = mmap(NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return -1;
+    }
+    if (memcmp(shm->magic, RING_MAGIC, sizeof(RING_MAGIC)) != 0 ||
+        shm->version != RING_VERSION || shm->depth != RELAY_RING_DEPTH ||
+        shm->frame_size != sizeof(struct usbrelay_frame) ||
+        shm->nslots > RELAY_RING_MAX_CLIENTS || ring_size(shm->nslots) > (size_t)sb.st_size) {
+        munmap(shm, (size_t)sb.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+    *out = shm;
+    *len = (size_t)sb.st_size;
+    return 0;
+}
+
+static int ring_server_alive(struct ring_shm *shm) {
+    uint32_t pid = atomic_load(&shm->server_pid);
+    return pid != 0 && !(kill((pid_t)pid, 0) != 0 && errno == ESRCH);
+}
+
+/* ---- futex wakeups ---- */
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t val, int64_t timeout_ns) {
+    struct timespec ts = {
+        .tv_sec = (time_t)(timeout_ns / 1000000000LL),
+        .tv_nsec = (long)(timeout_ns % 1000000000LL),
+    };
+    /* Not FUTEX_PRIVATE_FLAG: the word is shared between processes */
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void ring_kick(_Atomic uint32_t *wake, _Atomic uint32_t *sleeping) {
+    if (atomic_load(sleeping)) {
+        atomic_fetch_add(wake, 1);
+        syscall(SYS_futex, (uint32_t *)wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/* ---- single-producer/single-consumer queue ---- */
+
+static int queue_push(struct ring_queue *q, const struct usbrelay_frame *f) {
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head - tail == RELAY_RING_DEPTH) {
+        return -1;
+    }
+    q->frame[head & (RELAY_RING_DEPTH - 1)] = *f;
+    atomic_store(&q->head, head + 1);   /* seq_cst: pairs with "sleeping" */
+    return 0;
+}
+
+/* *was_full tells the consumer to kick a producer that may be waiting
+ * for room */
+static int queue_pop(struct ring_queue *q, struct usbrelay_frame *f, int *was_full) {
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (head == tail) {
+        return -1;
+    }
+    *f = q->frame[tail & (RELAY_RING_DEPTH - 1)];
+    *was_full = head - tail == RELAY_RING_DEPTH;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+static uint32_t queue_count(struct ring_queue *q) {
+    return atomic_load(&q->head) - atomic_load(&q->tail);
+}
+
+/* ---- server ---- */
+
+int relay_ring_create(struct relay_ring **out, const char *name, int nclients) {
+    struct relay_ring *r;
+    char path[NAME_MAX];
+    int fd;
+
+    *out = NULL;
+    if (nclients < 1 || nclients > RELAY_RING_MAX_CLIENTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ring_path(path, sizeof(path), name) != 0) {
+        return -1;
+    }
+
+    fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd < 0 && errno == EEXIST) {
+        /* Take over only a ring of ours whose server has died; an
+         * object that is not a ring belongs to someone else */
+        struct ring_shm *old;
+        size_t old_len;
+        if (ring_map(path, &old, &old_len) != 0) {
+            if (errno == EPROTO) {
+                errno = EEXIST;
+            }
+            return -1;
+        }
+        int alive = ring_server_alive(old);
+        munmap(old, old_len);
+        if (alive) {
+            errno = EEXIST;
+            return -1;
+        }
+        shm_unlink(path);
+        fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0660);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t len = ring_size((uint32_t)nclients);
+    r = calloc(1, sizeof(*r));
+    if (!r || ftruncate(fd, (off_t)len) != 0) {
+        int saved_errno = r ? errno : ENOMEM;
+        free(r);
+        close(fd);
+        shm_unlink(path);
+        errno = saved_errno;
+        return -1;
+    }
+    r->shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->shm == MAP_FAILED) {
+        int saved_errno = errno;
+        free(r);
+        shm_unlink(path);
+        errno = saved_errno;
+        return -1;
+    }
+    r->len = len;
+    r->nslots = (uint32_t)nclients;
+    strcpy(r->name, path);
+
+    /* ftruncate zeroed it: every slot is FREE with empty queues */
+    memcpy(r->shm->magic, RING_MAGIC, sizeof(RING_MAGIC));
+    r->shm->version = RING_VERSION;
+    r->shm->nslots = (uint32_t)nclients;
+    r->shm->depth = RELAY_RING_DEPTH;
+    r->shm->frame_size = sizeof(struct usbrelay_frame);
+    atomic_store(&r->shm->server_pid, (uint32_t)getpid());
+    *out = r;
+    return 0;
+}
+
+static void slot_reset(struct ring_slot *sl) {
+    atomic_store(&sl->req.head, 0);
+    atomic_store(&sl->req.tail, 0);
+    atomic_store(&sl->resp.head, 0);
+    atomic_store(&sl->resp.tail, 0);
+    atomic_store(&sl->sleeping, 0);
+    atomic_store_explicit(&sl->owner, RING_SLOT_FREE, memory_order_release);
+}
+
+/* Execute what one slot has queued; returns the number of requests */
+static unsigned long slot_serve(struct relay_ring *r, int i, relay_ring_exec_fn exec,
+                                relay_ring_close_fn closed, void *arg,
+                                struct relay_ring_stats *st) {
+    struct ring_slot *sl = &r->shm->slot[i];
+    uint32_t owner = atomic_load_explicit(&sl->owner, memory_order_acquire);
+    struct usbrelay_frame req, discard;
+    unsigned long n = 0;
+    int was_full = 0;
+
+    if (owner == RING_SLOT_FREE) {
+        return 0;
+    }
+    if (owner != r->seen[i]) {
+        r->seen[i] = owner;
+        if (owner != RING_SLOT_CLOSING) {
+            st->clients++;
+        }
+    }
+
+    if (owner == RING_SLOT_CLOSING) {
+        /* The client has gone: run what it queued, drop the answers */
+        while (queue_pop(&sl->req, &req, &was_full) == 0) {
+            exec(arg, i, &req, &discard);
+            n++;
+        }
+        if (closed) {
+            closed(arg, i);
+        }
+        slot_reset(sl);
+        r->seen[i] = RING_SLOT_FREE;
+        st->frames += n;
+        return n;
+    }
+
+    for (;;) {
+        uint32_t head = atomic_load_explicit(&sl->resp.head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&sl->resp.tail, memory_order_acquire) ==
+            RELAY_RING_DEPTH) {
+            break;      /* client is not reading: leave its requests queued */
+        }
+        if (queue_pop(&sl->req, &req, &was_full) != 0) {
+            break;
+        }
+        exec(arg, i, &req, &sl->resp.frame[head & (RELAY_RING_DEPTH - 1)]);
+        atomic_store(&sl->resp.head, head + 1);
+        n++;
+        if (was_full) {
+            ring_kick(&sl->wake, &sl->sleeping);
+        }
+    }
+    if (n > 0) {
+        ring_kick(&sl->wake, &sl->sleeping);
+    }
+    st->frames += n;
+    return n;
+}
+
+/* Does any slot have work the server can do right now? */
+static int ring_pending(struct relay_ring *r) {
+    for (uint32_t i = 0; i < r->nslots; i++) {
+        struct ring_slot *sl = &r->shm->slot[i];
+        uint32_t owner = atomic_load(&sl->owner);
+        if (owner == RING_SLOT_CLOSING ||
+            (owner != RING_SLOT_FREE && queue_count(&sl->req) > 0 &&
+             queue_count(&sl->resp) < RELAY_RING_DEPTH)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Mark the slots of clients that died without detaching */
+static void ring_reap(struct relay_ring *r) {
+    for (uint32_t i = 0; i < r->nslots; i++) {
+        uint32_t owner = atomic_load(&r->shm->slot[i].owner);
+        if (owner != RING_SLOT_FREE && owner != RING_SLOT_CLOSING &&
+            kill((pid_t)owner, 0) != 0 && errno == ESRCH) {
+            atomic_store(&r->shm->slot[i].owner, RING_SLOT_CLOSING);
+        }
+    }
+}
+
+int relay_ring_serve(struct relay_ring *r, relay_ring_exec_fn exec, relay_ring_close_fn closed,
+                     void *arg, long spin_us, volatile sig_atomic_t *stop,
+                     struct relay_ring_stats *st) {
+    struct ring_shm *shm = r->shm;
+    int64_t spin_ns = ring_spin_ns(spin_us);
+    int64_t idle_since = ring_now_ns();
+
+    memset(st, 0, sizeof(*st));
+    while (!*stop) {
+        unsigned long n = 0;
+        for (uint32_t i = 0; i < r->nslots; i++) {
+            n += slot_serve(r, (int)i, exec, closed, arg, st);
+        }
+        if (n > 0) {
+            idle_since = ring_now_ns();
+            continue;
+        }
+        if (ring_now_ns() - idle_since < spin_ns) {
+            ring_relax();
+            continue;
+        }
+
+        uint32_t w = atomic_load(&shm->wake);
+        atomic_store(&shm->sleeping, 1);
+        if (!ring_pending(r) && !*stop) {
+            int64_t t0 = ring_now_ns();
+            futex_wait(&shm->wake, w, RING_IDLE_NS);
+            st->sleeps++;
+            if (ring_now_ns() - t0 >= RING_IDLE_NS) {
+                ring_reap(r);
+            }
+        }
+        atomic_store(&shm->sleeping, 0);
+        idle_since = ring_now_ns();
+    }
+    return 0;
+}
+
+void relay_ring_destroy(struct relay_ring *r) {
+    if (!r) {
+        return;
+    }
+    atomic_store(&r->shm->server_pid, 0);
+    for (uint32_t i = 0; i < r->nslots; i++) {
+        struct ring_slot *sl = &r->shm->slot[i];
+        atomic_fetch_add(&sl->wake, 1);
+        syscall(SYS_futex, (uint32_t *)&sl->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+    munmap(r->shm, r->len);
+    shm_unlink(r->name);
+    free(r);
+}
+
+/* ---- client ---- */
+
+int relay_ring_attach(struct relay_ring_client **out, const char *name) {
+    struct relay_ring_client *c;
+    struct ring_shm *shm;
+    char path[NAME_MAX];
+    size_t len;
+
+    *out = NULL;
+    if (ring_path(path, sizeof(path), name) != 0 || ring_map(path, &shm, &len) != 0) {
+        return -1;
+    }
+    if (!ring_server_alive(shm)) {
+        munmap(shm, len);
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    c = calloc(1, sizeof(*c));
+    if (!c) {
+        munmap(shm, len);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* Read nslots once: ring_map() checked it against the mapping, but
+     * the shared copy can change under us */
+    uint32_t nslots = shm->nslots;
+    if (nslots > RELAY_RING_MAX_CLIENTS || ring_size(nslots) > len) {
+        nslots = 0;
+    }
+
+    uint32_t pid = (uint32_t)getpid();
+    for (int tries = 0; tries < RING_ATTACH_TRIES; tries++) {
+        int closing = 0;
+        for (uint32_t i = 0; i < nslots; i++) {
+            uint32_t expected = RING_SLOT_FREE;
+            if (atomic_compare_exchange_strong(&shm->slot[i].owner, &expected, pid)) {
+                c->shm = shm;
+                c->len = len;
+                c->slot = &shm->slot[i];
+                *out = c;
+                return 0;
+            }
+            closing |= expected == RING_SLOT_CLOSING;
+        }
+        if (!closing) {
+            break;
+        }
+        /* A client has just detached: let the server reclaim its slot */
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+        atomic_fetch_add(&shm->wake, 1);
+        syscall(SYS_futex, (uint32_t *)&shm->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        nanosleep(&ts, NULL);
+    }
+    free(c);
+    munmap(shm, len);
+    errno = EBUSY;
+    return -1;
+}
+
+int relay_ring_submit(struct relay_ring_client *c, const struct usbrelay_frame *req) {
+    if (queue_push(&c->slot->req, req) != 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    ring_kick(&c->shm->wake, &c->shm->sleeping);
+    return 0;
+}
+
+int relay_ring_receive(struct relay_ring_client *c, struct usbrelay_frame *resp,
+                       long timeout_ms) {
+    struct ring_slot *sl = c->slot;
+    int64_t start = ring_now_ns();
+    int64_t spin_end = start + ring_spin_ns(RELAY_RING_SPIN_US);
+    int64_t deadline = timeout_ms < 0 ? -1 : start + (int64_t)timeout_ms * 1000000LL;
+    int was_full;
+
+    for (;;) {
+        if (queue_pop(&sl->resp, resp, &was_full) == 0) {
+            if (was_full) {
+                ring_kick(&c->shm->wake, &c->shm->sleeping);
+            }
+            return 0;
+        }
+
+        int64_t now = ring_now_ns();
+        if (now < spin_end) {
+            ring_relax();
+            continue;
+        }
+        if (deadline >= 0 && now >= deadline) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (!ring_server_alive(c->shm)) {
+            errno = EPIPE;
+            return -1;
+        }
+
+        int64_t slice = RING_IDLE_NS;
+        if (deadline >= 0 && deadline - now < slice) {
+            slice = deadline - now;
+        }
+        uint32_t w = atomic_load(&sl->wake);
+        atomic_store(&sl->sleeping, 1);
+        if (queue_count(&sl->resp) == 0) {
+            futex_wait(&sl->wake, w, slice);
+        }
+        atomic_store(&sl->sleeping, 0);
+    }
+}
+
+int relay_ring_call(struct relay_ring_client *c, const struct usbrelay_frame *req,
+                    struct usbrelay_frame *resp, long timeout_ms) {
+    if (relay_ring_submit(c, req) != 0) {
+        return -1;
+    }
+    return relay_ring_receive(c, resp, timeout_ms);
+}
+
+void relay_ring_detach(struct relay_ring_client *c) {
+    if (!c) {
+        return;
+    }
+    atomic_store(&c->slot->owner, RING_SLOT_CLOSING);
+    atomic_fetch_add(&c->shm->wake, 1);
+    syscall(SYS_futex, (uint32_t *)&c->shm->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    munmap(c->shm, c->len);
+    free(c);
+}
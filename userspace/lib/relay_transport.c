@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "relay_transport.h"
+
+/* Character device backend: one read()/write() per mask */
+
+static int chardev_open(struct relay_transport *t, const char *path) {
+    t->fd = open(path, O_RDWR);
+    return t->fd < 0 ? -1 : 0;
+}
+
+static void chardev_close(struct relay_transport *t) {
+    if (t->fd >= 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+}
+
+static int chardev_read(struct relay_transport *t, uint8_t *mask) {
+    ssize_t ret = read(t->fd, mask, 1);
+    if (ret == 1) {
+        return 0;
+    }
+    if (ret >= 0) {
+        errno = EIO;
+    }
+    return -1;
+}
+
+static int chardev_write(struct relay_transport *t, uint8_t mask) {
+    ssize_t ret = write(t->fd, &mask, 1);
+    if (ret == 1) {
+        return 0;
+    }
+    if (ret >= 0) {
+        errno = EIO;
+    }
+    return -1;
+}
+
+/* relay_driver.ko and the CUSE emulator raise POLLPRI once the mask has
+ * changed since this file last read it. A driver without poll support
+ * reports every file readable at once, without POLLPRI. */
+static int chardev_watch_fd(struct relay_transport *t) {
+    struct pollfd pfd = { .fd = t->fd, .events = POLLIN | POLLPRI };
+    int ret = poll(&pfd, 1, 0);
+
+    if (ret < 0) {
+        return -1;
+    }
+    if (ret > 0 && (pfd.revents & (POLLPRI | POLLERR | POLLHUP | POLLNVAL)) == 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return t->fd;
+}
+
+static const struct relay_transport_ops relay_transport_chardev = {
+    .name  = "chardev",
+    .open  = chardev_open,
+    .close = chardev_close,
+    .read  = chardev_read,
+    .write = chardev_write,
+    .flush = NULL,
+    .watch_fd = chardev_watch_fd,
+};
+
+int relay_transport_open(struct relay_transport *t, const char *path) {
+    t->fd = -1;
+    t->priv = NULL;
+    t->ops = &relay_transport_chardev;
+
+    if (strcmp(path, "usb") == 0 || strncmp(path, "usb:", 4) == 0) {
+#ifdef RELAYCTL_HAVE_LIBUSB
+        t->ops = &relay_transport_usb;
+#else
+        t->ops = NULL;
+        errno = ENOTSUP;    /* built without LIBUSB=1 */
+        return -1;
+#endif
+    }
+
+    if (t->ops->open(t, path) != 0) {
+        t->ops = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int relay_transport_close(struct relay_transport *t) {
+    if (!t->ops) {
+        return 0;
+    }
+
+    int rc = relay_transport_flush(t);
+    int saved_errno = errno;
+    t->ops->close(t);
+    t->ops = NULL;
+    errno = saved_errno;
+    return rc;
+}
@@ -0,0 +1,62 @@
+#ifndef RELAY_TRANSPORT_H
+#define RELAY_TRANSPORT_H
+
+#include <errno.h>
+#include <stdint.h>
+
+/*
+ * How relayctl reaches a board. Every backend moves the same 1-byte mask
+ * as the kernel ABI (docs/PROTOCOL.md section 2); they differ only in the
+ * path underneath:
+ *
+ *   chardev   /dev/usbrelayN via relay_driver.ko (or the CUSE emulator)
+ *   usb       "usb" / "usb:N": the Nth FT232R relay board, driven directly
+ *             with libusb (built with "make LIBUSB=1")
+ *
+ * All operations return 0 on success, or -1 with errno set.
+ */
+struct relay_transport;
+
+struct relay_transport_ops {
+    const char *name;
+    int  (*open)(struct relay_transport *t, const char *path);
+    void (*close)(struct relay_transport *t);
+    int  (*read)(struct relay_transport *t, uint8_t *mask);
+    int  (*write)(struct relay_transport *t, uint8_t mask);
+    /* Wait for queued writes; NULL if writes complete synchronously */
+    int  (*flush)(struct relay_transport *t);
+    /* Descriptor that polls POLLPRI when the mask changes, called right
+     * after a read; -1 (errno ENOTSUP) if the device cannot notify.
+     * NULL if the backend never can. */
+    int  (*watch_fd)(struct relay_transport *t);
+};
+
+struct relay_transport {
+    const struct relay_transport_ops *ops;
+    int   fd;       /* chardev backend */
+    void *priv;     /* backend-private state */
+};
+
+/* Pick a backend from the device path and open it */
+int relay_transport_open(struct relay_transport *t, const char *path);
+
+/* Flush queued writes (if any) and release the device */
+int relay_transport_close(struct relay_transport *t);
+
+static inline int relay_transport_flush(struct relay_transport *t) {
+    return (t->ops && t->ops->flush) ? t->ops->flush(t) : 0;
+}
+
+static inline int relay_transport_watch_fd(struct relay_transport *t) {
+    if (t->ops && t->ops->watch_fd) {
+        return t->ops->watch_fd(t);
+    }
+    errno = ENOTSUP;
+    return -1;
+}
+
+#ifdef RELAYCTL_HAVE_LIBUSB
+extern const struct relay_transport_ops relay_transport_usb;
+#endif
+
+#endif /* RELAY_TRANSPORT_H */
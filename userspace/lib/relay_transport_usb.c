@@ -0,0 +1,306 @@
+/*
+ * libusb backend: drives an FT232R relay board without relay_driver.ko.
+ *
+ * open() does what usbrelay_probe() does (claim the interface, find the
+ * bulk OUT endpoint, SET_BITMODE to bit-bang on all pins); every write is
+ * the 1-byte bulk OUT of usbrelay_push_state(). Unlike the driver it does
+ * not push 0x00 on open, since each relayctl run opens the board afresh;
+ * reads return the live pin state (FTDI READ_PINS) instead.
+ *
+ * Writes are asynchronous: up to RELAY_USB_QUEUE transfers may be in
+ * flight, so a burst of commands pipelines on the bus instead of paying
+ * one round trip each. Bulk transfers on one endpoint complete in order.
+ * read() and flush() wait for the queue to drain; a failed transfer is
+ * reported by the next read, write or flush.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libusb.h>
+
+#include "relay_transport.h"
+
+#define RELAY_USB_VID           0x0403
+#define RELAY_USB_PID           0x6001
+#define RELAY_USB_INTERFACE     0
+#define FTDI_SIO_SET_BITMODE    0x0B
+#define FTDI_SIO_READ_PINS      0x0C
+#define FTDI_BITMODE_BITBANG    0x01
+#define FTDI_ALL_PINS_MASK      0xFF
+#define RELAY_USB_TIMEOUT_MS    1000
+#define RELAY_USB_QUEUE         8
+
+struct relay_usb_slot {
+    struct libusb_transfer *xfer;
+    struct relay_usb       *usb;
+    uint8_t                 buf;
+    int                     busy;
+};
+
+struct relay_usb {
+    libusb_context        *ctx;
+    libusb_device_handle  *handle;
+    uint8_t                bulk_out_ep;
+    int                    inflight;
+    int                    error;       /* errno of a failed transfer, or 0 */
+    struct relay_usb_slot  slots[RELAY_USB_QUEUE];
+};
+
+static int usb_errno(int err) {
+    switch (err) {
+    case LIBUSB_ERROR_NO_DEVICE: return ENODEV;
+    case LIBUSB_ERROR_NOT_FOUND: return ENODEV;
+    case LIBUSB_ERROR_ACCESS:    return EACCES;
+    case LIBUSB_ERROR_BUSY:      return EBUSY;
+    case LIBUSB_ERROR_TIMEOUT:   return ETIMEDOUT;
+    case LIBUSB_ERROR_NO_MEM:    return ENOMEM;
+    default:                     return EIO;
+    }
+}
+
+static int usb_fail(int err) {
+    errno = usb_errno(err);
+    return -1;
+}
+
+static void LIBUSB_CALL usb_write_done(struct libusb_transfer *xfer) {
+    struct relay_usb_slot *slot = xfer->user_data;
+    struct relay_usb *u = slot->usb;
+
+    if (xfer->status != LIBUSB_TRANSFER_COMPLETED || xfer->actual_length != 1) {
+        if (!u->error) {
+            u->error = (xfer->status == LIBUSB_TRANSFER_NO_DEVICE) ? ENODEV :
+                       (xfer->status == LIBUSB_TRANSFER_TIMED_OUT) ? ETIMEDOUT : EIO;
+        }
+    }
+    slot->busy = 0;
+    u->inflight--;
+}
+
+/* Run libusb events until at most "limit" writes are in flight */
+static int usb_drain(struct relay_usb *u, int limit) {
+    while (u->inflight > limit) {
+        int rc = libusb_handle_events(u->ctx);
+        if (rc < 0 && rc != LIBUSB_ERROR_INTERRUPTED) {
+            return usb_fail(rc);
+        }
+    }
+    return 0;
+}
+
+/* Report (once) a failure from an already completed transfer */
+static int usb_take_error(struct relay_usb *u) {
+    if (u->error) {
+        errno = u->error;
+        u->error = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* "usb" or "usb:N" -> N-th relay board on the bus (0-based) */
+static libusb_device_handle *usb_open_nth(libusb_context *ctx, int index) {
+    libusb_device **list;
+    libusb_device_handle *handle = NULL;
+    int err = LIBUSB_ERROR_NOT_FOUND;
+    ssize_t n = libusb_get_device_list(ctx, &list);
+
+    if (n < 0) {
+        errno = usb_errno((int)n);
+        return NULL;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        struct libusb_device_descriptor desc;
+
+        if (libusb_get_device_descriptor(list[i], &desc) != 0 ||
+            desc.idVendor != RELAY_USB_VID || desc.idProduct != RELAY_USB_PID) {
+            continue;
+        }
+        if (index-- == 0) {
+            err = libusb_open(list[i], &handle);
+            break;
+        }
+    }
+    libusb_free_device_list(list, 1);
+    if (!handle) {
+        errno = usb_errno(err);
+    }
+    return handle;
+}
+
+static int usb_find_bulk_out(libusb_device_handle *h, uint8_t *ep) {
+    struct libusb_config_descriptor *cfg;
+    int rc = libusb_get_active_config_descriptor(libusb_get_device(h), &cfg);
+
+    if (rc != 0) {
+        return rc;
+    }
+    rc = LIBUSB_ERROR_NOT_FOUND;
+    if (cfg->bNumInterfaces > RELAY_USB_INTERFACE) {
+        const struct libusb_interface_descriptor *alt =
+            &cfg->interface[RELAY_USB_INTERFACE].altsetting[0];
+        for (int i = 0; i < alt->bNumEndpoints; i++) {
+            const struct libusb_endpoint_descriptor *d = &alt->endpoint[i];
+            if ((d->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_BULK &&
+                (d->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_OUT) {
+                *ep = d->bEndpointAddress;
+                rc = 0;
+                break;
+            }
+        }
+    }
+    libusb_free_config_descriptor(cfg);
+    return rc;
+}
+
+static void usb_close(struct relay_transport *t) {
+    struct relay_usb *u = t->priv;
+
+    if (!u) {
+        return;
+    }
+    if (u->handle) {
+        usb_drain(u, 0);
+        libusb_release_interface(u->handle, RELAY_USB_INTERFACE);
+        libusb_close(u->handle);
+    }
+    for (int i = 0; i < RELAY_USB_QUEUE; i++) {
+        libusb_free_transfer(u->slots[i].xfer);
+    }
+    if (u->ctx) {
+        libusb_exit(u->ctx);
+    }
+    free(u);
+    t->priv = NULL;
+}
+
+static int usb_open(struct relay_transport *t, const char *path) {
+    struct relay_usb *u = calloc(1, sizeof(*u));
+    int index = 0;
+    int rc;
+
+    if (!u) {
+        return -1;
+    }
+    t->priv = u;
+
+    if (path[3] == ':') {
+        char *endp;
+        long v = strtol(path + 4, &endp, 10);
+        if (endp == path + 4 || *endp != '\0' || v < 0 || v > 255) {
+            usb_close(t);
+            errno = EINVAL;
+            return -1;
+        }
+        index = (int)v;
+    }
+
+    rc = libusb_init(&u->ctx);
+    if (rc != 0) {
+        u->ctx = NULL;
+        usb_close(t);
+        return usb_fail(rc);
+    }
+    u->handle = usb_open_nth(u->ctx, index);
+    if (!u->handle) {
+        int saved_errno = errno;
+        usb_close(t);
+        errno = saved_errno;
+        return -1;
+    }
+
+    /* Take the interface from ftdi_sio if it is bound */
+    libusb_set_auto_detach_kernel_driver(u->handle, 1);
+    rc = libusb_claim_interface(u->handle, RELAY_USB_INTERFACE);
+    if (rc == 0) {
+        rc = usb_find_bulk_out(u->handle, &u->bulk_out_ep);
+    }
+    if (rc == 0) {
+        /* Same request as usbrelay_probe(): bit-bang mode, all pins output */
+        rc = libusb_control_transfer(u->handle,
+                                     LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE |
+                                     LIBUSB_ENDPOINT_OUT,
+                                     FTDI_SIO_SET_BITMODE,
+                                     (FTDI_BITMODE_BITBANG << 8) | FTDI_ALL_PINS_MASK,
+                                     RELAY_USB_INTERFACE, NULL, 0, RELAY_USB_TIMEOUT_MS);
+        rc = rc < 0 ? rc : 0;
+    }
+    for (int i = 0; rc == 0 && i < RELAY_USB_QUEUE; i++) {
+        u->slots[i].usb = u;
+        u->slots[i].xfer = libusb_alloc_transfer(0);
+        if (!u->slots[i].xfer) {
+            rc = LIBUSB_ERROR_NO_MEM;
+        }
+    }
+    if (rc != 0) {
+        usb_close(t);
+        return usb_fail(rc);
+    }
+    return 0;
+}
+
+static int usb_write(struct relay_transport *t, uint8_t mask) {
+    struct relay_usb *u = t->priv;
+    struct relay_usb_slot *slot = NULL;
+
+    if (usb_drain(u, RELAY_USB_QUEUE - 1) != 0 || usb_take_error(u) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < RELAY_USB_QUEUE; i++) {
+        if (!u->slots[i].busy) {
+            slot = &u->slots[i];
+            break;
+        }
+    }
+
+    slot->buf = mask;
+    libusb_fill_bulk_transfer(slot->xfer, u->handle, u->bulk_out_ep, &slot->buf, 1,
+                              usb_write_done, slot, RELAY_USB_TIMEOUT_MS);
+    int rc = libusb_submit_transfer(slot->xfer);
+    if (rc != 0) {
+        return usb_fail(rc);
+    }
+    slot->busy = 1;
+    u->inflight++;
+    return 0;
+}
+
+static int usb_flush(struct relay_transport *t) {
+    struct relay_usb *u = t->priv;
+
+    if (usb_drain(u, 0) != 0) {
+        return -1;
+    }
+    return usb_take_error(u);
+}
+
+static int usb_read(struct relay_transport *t, uint8_t *mask) {
+    struct relay_usb *u = t->priv;
+
+    /* Reads must observe every write queued before them */
+    if (usb_flush(t) != 0) {
+        return -1;
+    }
+    int rc = libusb_control_transfer(u->handle,
+                                     LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE |
+                                     LIBUSB_ENDPOINT_IN,
+                                     FTDI_SIO_READ_PINS, 0, RELAY_USB_INTERFACE,
+                                     mask, 1, RELAY_USB_TIMEOUT_MS);
+    if (rc == 1) {
+        return 0;
+    }
+    return usb_fail(rc < 0 ? rc : LIBUSB_ERROR_IO);
+}
+
+const struct relay_transport_ops relay_transport_usb = {
+    .name  = "usb",
+    .open  = usb_open,
+    .close = usb_close,
+    .read  = usb_read,
+    .write = usb_write,
+    .flush = usb_flush,
+    .watch_fd = NULL,   /* bit-bang mode has no change notification */
+};
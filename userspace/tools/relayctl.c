@@ -1,14 +1,28 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <string.h>  
-#include <strings.h>  
 #include <stdlib.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 
 #include "../include/usbrelay.h"
+#include "../include/relay.h"
+#include "../include/relay_ring.h"
+#include "relayctl_interlock.h"
+#include "relayctl_parse.h"
+#include "relayctl_log.h"
+#include "relayctl_metrics.h"
+#include "relayctl_scene.h"
+#include "relayctl_sched.h"
+#include "relayctl_watch.h"
 
 #ifndef PATH_MAX
 #define PATH_MAX    128
@@ -16,84 +30,147 @@
 
 #define RELAYCTL_TOOL_VERSION "0.1"
 
-/* Holds state for a single use of relayctl. */
+#define RELAYCTL_MAX_BOARDS     16  /* -d devices per session */
+#define RELAYCTL_MAX_GROUPS     16  /* -g named board groups */
+#define RELAYCTL_GROUP_NAME_MAX 32
+
+/* What a handler produced; rendered as a text line or a binary frame */
+enum relay_reply_kind {
+    RELAY_REPLY_NONE = 0,
+    RELAY_REPLY_OK,             /* OK */
+    RELAY_REPLY_STATE,          /* OK CH=<n> STATE=<ON|OFF> */
+    RELAY_REPLY_MASK,           /* OK MASK=0xHH */
+    RELAY_REPLY_VERSION,        /* OK VERSION=<ver> TOOL=<tool> */
+    RELAY_REPLY_HELP            /* help text */
+};
+
+struct relay_reply {
+    enum relay_reply_kind kind;
+    enum usbrelay_status  status;   /* USBRELAY_OK unless an error was set */
+    int                   channel;
+    int                   state;
+    uint8_t               mask;
+    char                  msg[128]; /* error message */
+};
+
+/* Holds state for one relay board (one -d device). The device logic
+ * itself (shadow mask, cache, transactions) lives in librelay. */
 struct relay_context {
-    int fd;
-    uint8_t mask;
+    int board;                  /* index in the session, 0 = first -d */
+    struct relay_board *dev;    /* NULL until opened */
     char dev_path[PATH_MAX];
     int verbose;
     int interactive;
-};
+    int cached;                 /* -c given */
+    long stale_ms;              /* -c staleness interval (0 = never) */
+    const struct relay_interlock *interlock;    /* -L rules, or NULL */
 
-enum relayctl_cmd {
-    RELAYCTL_CMD_NONE = 0,
-    RELAYCTL_CMD_SET,
-    RELAYCTL_CMD_GET,
-    RELAYCTL_CMD_GETALL,
-    RELAYCTL_CMD_TOGGLE,
-    RELAYCTL_CMD_WRITE_MASK,
-    RELAYCTL_CMD_READ_MASK,
-    RELAYCTL_CMD_RESET,
-    RELAYCTL_CMD_PING,
-    RELAYCTL_CMD_VERSION,
-    RELAYCTL_CMD_HELP
+    struct relay_reply reply;   /* result of the current command */
 };
 
-/* ON/OFF state used when parsing "set" commands. */
-enum relayctl_state {
-    RELAYCTL_STATE_OFF = 0,
-    RELAYCTL_STATE_ON  = 1
+/* A named set of boards, defined with -g name=selector */
+struct relay_group {
+    char     name[RELAYCTL_GROUP_NAME_MAX];
+    uint32_t boards;            /* bit n -> board n */
 };
 
+/* Holds state for a single use of relayctl: every board it drives. */
+struct relay_session {
+    struct relay_context boards[RELAYCTL_MAX_BOARDS];
+    int                  nboards;
+    struct relay_group   groups[RELAYCTL_MAX_GROUPS];
+    int                  ngroups;
+    int                  verbose;
+    int                  in_txn;        /* BEGIN issued on every board */
+    int                  txn_implicit;  /* opened by a ';' compound line */
+    FILE                *out;           /* replies: stdout, or a ';' line's buffer */
+    struct relayctl_log *log;           /* -r command log, or NULL */
+    const struct relayctl_scenes *scenes;   /* -C scenes, or NULL */
+
+    /* Binary transactions belong to the client that began them: a -Q
+     * ring slot, or 0 for stdin */
+    int                  client;        /* client of the frame being run */
+    int                  txn_client[RELAYCTL_MAX_BOARDS];
+
+    /* REPL input, watched so that a new line ends WATCH (NULL if none) */
+    relayctl_watch_input_fn watch_input;
+    void                   *watch_input_arg;
+    int                     watch_input_fd;
+};
 
 /* Holds the result of parsing argv. */
 struct relayctl_args {
-    enum relayctl_cmd   cmd;        /* which high-level command */
-    int                 channel;    /* channel number for channel-based commands (1..4 or 0) */
-    enum relayctl_state state;     /* ON/OFF for set, if relevant */
-    uint8_t             mask;       /* mask for write-mask, if relevant */
-    char                dev_path[PATH_MAX]; /* device path override, if provided */
+    struct relayctl_command command; /* protocol command, if any */
+    const char         *dev_paths[RELAYCTL_MAX_BOARDS]; /* -d devices, in board order */
+    int                 ndevs;
+    const char         *group_defs[RELAYCTL_MAX_GROUPS]; /* -g name=selector */
+    int                 ngroups;
     int                 interactive; /* nonzero if -i / interactive requested */
     int                 verbose;     /* nonzero if verbose mode requested */
+    int                 cached;      /* nonzero if -c shadow-mask cache requested */
+    long                stale_ms;    /* -c staleness interval in ms (0 = never) */
+    const char         *sched_path;  /* -S schedule file ("-" = stdin), or NULL */
+    const char         *scene_path;  /* -C scene file, or NULL */
+    const char         *interlock_path; /* -L interlock rules, or NULL */
+    int                 rt_prio;     /* -R SCHED_FIFO priority (0 = off) */
+    const char         *metrics;     /* -m metrics file or unix:<socket>, or NULL */
+    const char         *record_path; /* -r command log, or NULL */
+    uint64_t            record_size; /* -r ring capacity in records */
+    const char         *replay_path; /* -P log to replay, or NULL */
+    double              replay_speed;/* -x speed factor (0 = as fast as possible) */
+    const char         *ring_name;   /* -Q shared-memory ring server, or NULL */
+    int                 ring_clients;/* -Q client slots */
 };
 
-/* forward declarations used by parse_args */
-static int parse_channel_arg(const char *arg, int *out_channel);
-static int parse_mask_arg(const char *arg, uint8_t *out_mask);
-
 /* Help messages on failure */
 static void print_usage(void) {
     fprintf(stderr,
         "Usage:\n"
-        "  relayctl set <ch> <on|off>        Set channel on or off\n"
-        "  relayctl get <ch>                 Get state of a single channel\n"
+        "  relayctl set <[b:]ch> <on|off>    Set channel on or off\n"
+        "  relayctl get <[b:]ch>             Get state of a single channel\n"
         "  relayctl getall                   Get state of all channels (mask)\n"
-        "  relayctl toggle <ch>              Toggle a single channel\n"
+        "  relayctl toggle <[b:]ch>          Toggle a single channel\n"
         "  relayctl write-mask 0xHH          Write full 4-bit mask (0x00-0x0F)\n"
         "  relayctl read-mask                Read current mask from device\n"
         "  relayctl reset                    Turn all channels off\n"
         "  relayctl ping                     Check device responsiveness\n"
         "  relayctl version                  Show tool/protocol version\n"
+        "  relayctl watch [<ms>]             Print mask changes until input or SIGINT\n"
+        "  relayctl scene <name>             Apply a scene loaded with -C\n"
+        "  relayctl stats                    Session counters and I/O latency (with -i)\n"
         "  relayctl help                     Show detailed help\n"
+        "  begin / commit / abort            Batch commands (interactive only)\n"
         "\n"
         "Options:\n"
-        "  -d <device>                        Device path (default: /dev/usbrelay0)\n"
+        "  -d <device>                        Device path (default: /dev/usbrelay0);\n"
+        "                                     repeat to drive several boards;\n"
+        "                                     usb[:N] = libusb, no kernel module\n"
+        "  -g <name>=<boards>                 Define a named board group\n"
         "  -v                                 Verbose output (debug logging)\n"
         "  -i                                 Interactive mode (REPL)\n"
+        "  -c <ms>                            Cache mask between commands (0 = never re-read)\n"
+        "  -S <file>                          Run timed actions from a schedule (- = stdin)\n"
+        "  -R <prio>                          With -S/-Q: SCHED_FIFO priority, locked memory\n"
+        "  -m <file|unix:path>                Export Prometheus metrics\n"
+        "  -C <file>                          Load named scenes for the scene command\n"
+        "  -L <file>                          Refuse writes that break interlock rules\n"
+        "  -r <log>[:<records>]               Record every command to a ring log\n"
+        "  -P <log> [-x <speed>]              Replay a recorded log (0 = no delays)\n"
+        "  -Q <name>[:<clients>]              Serve binary frames on shared-memory rings\n"
     );
 }
-static void print_help(void) {
-    printf(
+static void print_help(FILE *out) {
+    fprintf(out,
         "relayctl - SainSmart 4-Channel 5V USB Relay Controller\n"
         "\n"
         "This tool controls a 4-channel USB relay board using a simple ASCII\n"
         "protocol on top of a 1-byte mask ABI exposed by the kernel driver.\n"
         "\n"
         "Commands:\n"
-        "  set <ch> <on|off>\n"
+        "  set <[b:]ch> <on|off>\n"
         "      Set channel <ch> (1-4) ON or OFF.\n"
         "\n"
-        "  get <ch>\n"
+        "  get <[b:]ch>\n"
         "      Print the current state of channel <ch> as:\n"
         "          OK CH=<ch> STATE=<ON|OFF>\n"
         "\n"
@@ -101,7 +178,7 @@ static void print_help(void) {
         "      Print the full 4-bit mask for all channels as:\n"
         "          OK MASK=0xHH\n"
         "\n"
-        "  toggle <ch>\n"
+        "  toggle <[b:]ch>\n"
         "      Flip the state of channel <ch> and report the new state.\n"
         "\n"
         "  write-mask 0xHH\n"
@@ -124,9 +201,62 @@ static void print_help(void) {
         "  help\n"
         "      Print this help text.\n"
         "\n"
+        "  scene <name>\n"
+        "      Apply a scene loaded with -C: one write-mask per board it\n"
+        "      covers, answered like write-mask (OK MASK=0xHH).\n"
+        "\n"
+        "  stats\n"
+        "      Report this session's counters as STAT lines followed by OK:\n"
+        "          STAT CMD=<name> COUNT=<n> FAILED=<n>\n"
+        "          STAT ERR=<code> COUNT=<n>\n"
+        "          STAT BOARD=<b> IO=<read|write> COUNT=<n> ERRORS=<n> AVG_US=...\n"
+        "              P50_US=... P90_US=... P99_US=... P999_US=... MAX_US=...\n"
+        "      (the IO lines time each device mask read/write).\n"
+        "\n"
+        "  watch [<ms>]\n"
+        "      Print OK MASK=0xHH (OK BOARD=<n> MASK=0xHH with several\n"
+        "      boards) now and whenever the mask changes, until the next\n"
+        "      input line or SIGINT, then\n"
+        "          OK WATCH CHANGES=<n> READS=<n> SKIPPED=<n> MODE=<mode>\n"
+        "      Devices that support it wake relayctl on a change\n"
+        "      (MODE=NOTIFY); others are read every <ms> milliseconds\n"
+        "      (default 100) after a change, backing off to 16 x <ms>\n"
+        "      while idle (MODE=POLL). SKIPPED counts the reads saved\n"
+        "      compared to a getall every <ms>.\n"
+        "\n"
+        "  begin / commit / abort   (interactive mode only)\n"
+        "      BEGIN stages every following set/toggle/write-mask/reset in a\n"
+        "      local mask; COMMIT writes it to the device in one transfer and\n"
+        "      prints OK MASK=0xHH; ABORT discards the staged changes.\n"
+        "      A line of ';'-separated commands is batched the same way, e.g.\n"
+        "          set 1 on; set 2 off; toggle 4\n"
+        "      Its replies are printed once the batch is written; if any of\n"
+        "      its commands fails the line is discarded and only the ERR\n"
+        "      lines are printed.\n"
+        "\n"
+        "  Multiple boards\n"
+        "      With several -d options the boards are numbered 0, 1, ... in\n"
+        "      order. Channels may be qualified as <boards>:<ch> and getall,\n"
+        "      read-mask, reset, ping and write-mask take an optional leading\n"
+        "      <boards> argument, where <boards> is an index (2), a list or\n"
+        "      range (0,2 / 0-3), a -g group name or \"all\". Unqualified\n"
+        "      commands act on board 0. Commands that span several boards run\n"
+        "      on all of them concurrently and answer one line per board:\n"
+        "          OK BOARD=<n> ...\n"
+        "\n"
+        "  binary   (interactive mode only)\n"
+        "      Answer OK MODE=BINARY and switch the session to fixed 8-byte\n"
+        "      frames (see docs/PROTOCOL.md). Opcode 0x7E returns to text.\n"
+        "\n"
         "Options:\n"
         "  -d <device>\n"
-        "      Override the device path (default: /dev/usbrelay0).\n"
+        "      Override the device path (default: /dev/usbrelay0). Repeat\n"
+        "      to drive several boards from one session. \"usb\" or \"usb:N\"\n"
+        "      opens the Nth relay board directly through libusb, without\n"
+        "      the kernel module (needs a build with LIBUSB=1).\n"
+        "\n"
+        "  -g <name>=<boards>\n"
+        "      Name a set of boards, e.g. -g lab=0-3, for use as <boards>.\n"
         "\n"
         "  -v\n"
         "      Enable verbose logging to stderr (debug information) while\n"
@@ -136,30 +266,111 @@ static void print_help(void) {
         "      Interactive mode (REPL): read commands from stdin repeatedly\n"
         "      and print a response line for each.\n"
         "\n"
+        "  -c <ms>\n"
+        "      Cache the relay mask between commands instead of reading the\n"
+        "      device before every set/get/toggle/getall. The device is\n"
+        "      re-read after an error, after <ms> milliseconds (0 = never),\n"
+        "      or on demand with read-mask / ping. With -v, cache hit counts\n"
+        "      are reported on stderr when the session ends.\n"
+        "\n"
+        "  -S <file>\n"
+        "      Scheduler mode: read timed actions from <file> (- = stdin),\n"
+        "      one per line, and run each at its time:\n"
+        "          at <HH:MM:SS[.frac]|@unix-time> <command>\n"
+        "          after <ms> <command>\n"
+        "          every <ms> [count <n>] <command>\n"
+        "      \"after\" and \"every\" count from the start of the run; <ms>\n"
+        "      may be fractional. Each firing prints its replies and\n"
+        "          OK SCHED ID=<n> RUN=<k> LATE_US=<us> EXEC_US=<us>\n"
+        "      and a summary per entry is printed when the schedule is\n"
+        "      done or on SIGINT/SIGTERM.\n"
+        "\n"
+        "  -R <prio>\n"
+        "      With -S or -Q: run at SCHED_FIFO priority <prio> (1-99)\n"
+        "      with all memory locked, for the lowest jitter (needs\n"
+        "      CAP_SYS_NICE and CAP_IPC_LOCK or suitable rlimits).\n"
+        "\n"
+        "  -C <file>\n"
+        "      Load scenes, one per line:\n"
+        "          SCENE <name> = <[board:]ch> <on|off>, ...\n"
+        "      Each scene sets the channels it lists and turns every\n"
+        "      other channel of its boards OFF.\n"
+        "\n"
+        "  -L <file>\n"
+        "      Load interlock rules, one per line:\n"
+        "          EXCLUSIVE <[board:]ch> <[board:]ch> ...   at most one ON\n"
+        "          REQUIRE <[board:]ch> <[board:]ch> ...     first ON only\n"
+        "                                                    with the rest ON\n"
+        "      A set, toggle, write-mask, reset, scene or commit whose\n"
+        "      resulting mask breaks a rule fails with ERR INTERLOCK and\n"
+        "      changes nothing.\n"
+        "\n"
+        "  -m <file|unix:path>\n"
+        "      Export the stats counters and device latency histograms in\n"
+        "      Prometheus text format: rewrite <file> every second and at\n"
+        "      exit, or serve them on a Unix socket to each connection\n"
+        "      (curl --unix-socket <path> http://localhost/metrics).\n"
+        "\n"
+        "  -r <log>[:<records>]\n"
+        "      Record every command run against a board (time, board,\n"
+        "      opcode, arguments, status and resulting mask) in an mmap'd\n"
+        "      ring of <records> entries (default 65536, 16 bytes each).\n"
+        "      An existing log is appended to.\n"
+        "\n"
+        "  -P <log>\n"
+        "      Replay a recorded log against the -d boards with its\n"
+        "      original timing, then print\n"
+        "          OK REPLAY RECORDS=<n> FAILED=<n> DIVERGED=<n> ...\n"
+        "      DIVERGED counts commands whose status or mask differ from\n"
+        "      the recording (exit status 1 if any). -x <speed> scales the\n"
+        "      timing (2 = twice as fast); -x 0 replays without delays.\n"
+        "\n"
+        "  -Q <name>[:<clients>]\n"
+        "      Ring server: own the -d boards and serve binary frames from\n"
+        "      up to <clients> processes (default 8) through lock-free rings\n"
+        "      in the shared memory object /<name> (include/relay_ring.h).\n"
+        "      Prints OK RING NAME=/<name> CLIENTS=<n> when ready and\n"
+        "          OK RING FRAMES=<n> CLIENTS=<n> SLEEPS=<n>\n"
+        "      on SIGINT/SIGTERM. Combine with -R for SCHED_FIFO.\n"
+        "\n"
         "Examples:\n"
         "  relayctl set 1 on\n"
         "  relayctl toggle 3\n"
         "  relayctl write-mask 0x05\n"
         "  relayctl getall\n"
+        "  relayctl -d /dev/usbrelay0 -d /dev/usbrelay1 set 1:3 on\n"
+        "  relayctl -d /dev/usbrelay0 -d /dev/usbrelay1 write-mask all 0x05\n"
         "\n"
     );
 }
 
-
-/* Parse our arguments to determine if user made a valid call */
+/* Print a parser error as a protocol ERR line */
+static void print_parse_error(const struct relayctl_command *cmd) {
+    if (cmd->cmd != RELAYCTL_CMD_NONE) {
+        relayctl_metrics_command(cmd->cmd, 1);     /* e.g. "set 9 on" */
+    }
+    relayctl_metrics_error_code(cmd->err_code);
+    if (cmd->err_arg) {
+        fprintf(stderr, "ERR %s %s %s\n", cmd->err_code, cmd->err_msg, cmd->err_arg);
+    } else {
+        fprintf(stderr, "ERR %s %s\n", cmd->err_code, cmd->err_msg);
+    }
+}
 
 /* Parse our arguments to determine if user made a valid call */
 
 static int parse_args(int argc, char **argv, struct relayctl_args *out_args) {
     memset(out_args, 0, sizeof(*out_args));
-    out_args->cmd         = RELAYCTL_CMD_NONE;
-    out_args->channel     = 0;
-    out_args->state       = RELAYCTL_STATE_OFF;
-    out_args->mask        = 0;
+    out_args->command.cmd = RELAYCTL_CMD_NONE;
     out_args->interactive = 0;
     out_args->verbose     = 0;
-    strncpy(out_args->dev_path, USBRELAY_DEFAULT_DEVICE, PATH_MAX - 1);
-    out_args->dev_path[PATH_MAX - 1] = '\0';
+    out_args->cached      = 0;
+    out_args->stale_ms    = 0;
+    out_args->ndevs       = 0;
+    out_args->ngroups     = 0;
+    out_args->record_size = RELAYCTL_LOG_DEFAULT_RECORDS;
+    out_args->replay_speed = 1.0;
+    out_args->ring_clients = RELAY_RING_DEFAULT_CLIENTS;
 
     // Flag handling for verbose and interactive mode
     int i = 1;
@@ -175,8 +386,136 @@ static int parse_args(int argc, char **argv, struct relayctl_args *out_args) {
                 fprintf(stderr, "ERR BAD_COMMAND -d requires a device path\n");
                 return 1;
             }
-            strncpy(out_args->dev_path, argv[i + 1], PATH_MAX - 1);
-            out_args->dev_path[PATH_MAX - 1] = '\0';
+            if (out_args->ndevs == RELAYCTL_MAX_BOARDS) {
+                fprintf(stderr, "ERR BAD_COMMAND At most %d devices\n", RELAYCTL_MAX_BOARDS);
+                return 1;
+            }
+            out_args->dev_paths[out_args->ndevs++] = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-g") == 0) {
+            if (i + 1 >= argc || !strchr(argv[i + 1], '=')) {
+                fprintf(stderr, "ERR BAD_COMMAND -g requires <name>=<boards>\n");
+                return 1;
+            }
+            if (out_args->ngroups == RELAYCTL_MAX_GROUPS) {
+                fprintf(stderr, "ERR BAD_COMMAND At most %d groups\n", RELAYCTL_MAX_GROUPS);
+                return 1;
+            }
+            out_args->group_defs[out_args->ngroups++] = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            char *endp = NULL;
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -c requires a staleness interval in ms\n");
+                return 1;
+            }
+            out_args->stale_ms = strtol(argv[i + 1], &endp, 10);
+            if (*argv[i + 1] == '\0' || *endp != '\0' || out_args->stale_ms < 0) {
+                fprintf(stderr, "ERR BAD_COMMAND -c interval must be a non-negative integer\n");
+                return 1;
+            }
+            out_args->cached = 1;
+            i += 2;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -S requires a schedule file\n");
+                return 1;
+            }
+            out_args->sched_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-C") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -C requires a scene file\n");
+                return 1;
+            }
+            out_args->scene_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-L") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -L requires a rule file\n");
+                return 1;
+            }
+            out_args->interlock_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-R") == 0) {
+            char *endp = NULL;
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -R requires a priority\n");
+                return 1;
+            }
+            long prio = strtol(argv[i + 1], &endp, 10);
+            if (*argv[i + 1] == '\0' || *endp != '\0' || prio < 1 || prio > 99) {
+                fprintf(stderr, "ERR BAD_COMMAND -R priority must be 1..99\n");
+                return 1;
+            }
+            out_args->rt_prio = (int)prio;
+            i += 2;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -m requires a file or unix:<socket path>\n");
+                return 1;
+            }
+            out_args->metrics = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -r requires a log file\n");
+                return 1;
+            }
+            /* "<log>:<records>" sets the ring size of a new log */
+            char *colon = strrchr(argv[i + 1], ':');
+            out_args->record_path = argv[i + 1];
+            if (colon) {
+                char *endp;
+                long long n = strtoll(colon + 1, &endp, 10);
+                if (colon[1] == '\0' || *endp != '\0' || n <= 0 ||
+                    n > RELAYCTL_LOG_MAX_RECORDS) {
+                    fprintf(stderr, "ERR BAD_COMMAND -r record count must be 1..%u\n",
+                            RELAYCTL_LOG_MAX_RECORDS);
+                    return 1;
+                }
+                *colon = '\0';
+                out_args->record_size = (uint64_t)n;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-P") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -P requires a log file\n");
+                return 1;
+            }
+            out_args->replay_path = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-x") == 0) {
+            char *endp = NULL;
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -x requires a speed factor\n");
+                return 1;
+            }
+            out_args->replay_speed = strtod(argv[i + 1], &endp);
+            if (*argv[i + 1] == '\0' || *endp != '\0' || out_args->replay_speed < 0.0) {
+                fprintf(stderr, "ERR BAD_COMMAND -x speed must be a non-negative number\n");
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-Q") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERR BAD_COMMAND -Q requires a ring name\n");
+                return 1;
+            }
+            /* "<name>:<clients>" sets the number of client slots */
+            char *colon = strrchr(argv[i + 1], ':');
+            out_args->ring_name = argv[i + 1];
+            if (colon) {
+                char *endp;
+                long n = strtol(colon + 1, &endp, 10);
+                if (colon[1] == '\0' || *endp != '\0' || n < 1 || n > RELAY_RING_MAX_CLIENTS) {
+                    fprintf(stderr, "ERR BAD_COMMAND -Q clients must be 1..%d\n",
+                            RELAY_RING_MAX_CLIENTS);
+                    return 1;
+                }
+                *colon = '\0';
+                out_args->ring_clients = (int)n;
+            }
             i += 2;
         } else {
             fprintf(stderr, "ERR BAD_COMMAND Unknown option: %s\n", argv[i]);
@@ -184,534 +523,1676 @@ static int parse_args(int argc, char **argv, struct relayctl_args *out_args) {
         }
     }
 
-    /* Now argv[i] should be protocol command (unless interactive-only) */
-    if (i >= argc) {
-        if (out_args->interactive) {
-            /* Interactive REPL with no initial command is allowed */
-            out_args->cmd = RELAYCTL_CMD_NONE;
-            return 0;
-        }
-        print_usage();
-        return 1;
+    if (out_args->ndevs == 0) {
+        out_args->dev_paths[out_args->ndevs++] = USBRELAY_DEFAULT_DEVICE;
     }
 
-    const char *cmd = argv[i];
-    i++;
-
-    /* Case-insensitive match on command name */
-    if (strcasecmp(cmd, "set") == 0) {
-        if (i + 1 >= argc) {
-            fprintf(stderr, "ERR BAD_COMMAND set requires: set <ch> <on|off>\n");
-            return 1;
-        }
-        out_args->cmd = RELAYCTL_CMD_SET;
-
-        /* Parse channel (argv[i]) */
-        if (parse_channel_arg(argv[i], &out_args->channel) != 0) {
-            return 1;
-        }
-        i++;
-
-        /* Parse state (argv[i]) */
-        const char *state_str = argv[i];
-        if (strcasecmp(state_str, "on") == 0) {
-            out_args->state = RELAYCTL_STATE_ON;
-        } else if (strcasecmp(state_str, "off") == 0) {
-            out_args->state = RELAYCTL_STATE_OFF;
-        } else {
-            fprintf(stderr, "ERR BAD_STATE State must be ON or OFF\n");
-            return 1;
-        }
-        i++;
-
-    } else if (strcasecmp(cmd, "get") == 0) {
-        if (i >= argc) {
-            fprintf(stderr, "ERR BAD_COMMAND get requires: get <ch>\n");
-            return 1;
-        }
-        out_args->cmd = RELAYCTL_CMD_GET;
-
-        if (parse_channel_arg(argv[i], &out_args->channel) != 0) {
-            return 1;
-        }
-        i++;
-
-    } else if (strcasecmp(cmd, "getall") == 0) {
-        out_args->cmd = RELAYCTL_CMD_GETALL;
-
-    } else if (strcasecmp(cmd, "toggle") == 0) {
-        if (i >= argc) {
-            fprintf(stderr, "ERR BAD_COMMAND toggle requires: toggle <ch>\n");
+    if (out_args->replay_path) {
+        if (i < argc || out_args->interactive || out_args->sched_path) {
+            fprintf(stderr, "ERR BAD_COMMAND -P cannot be combined with a command, -i or -S\n");
             return 1;
         }
-        out_args->cmd = RELAYCTL_CMD_TOGGLE;
-
-        if (parse_channel_arg(argv[i], &out_args->channel) != 0) {
-            return 1;
-        }
-        i++;
-
-    } else if (strcasecmp(cmd, "write-mask") == 0) {
-        if (i >= argc) {
-            fprintf(stderr, "ERR BAD_COMMAND write-mask requires: write-mask 0xHH\n");
+        return 0;
+    }
+    if (out_args->ring_name) {
+        if (i < argc || out_args->interactive || out_args->sched_path) {
+            fprintf(stderr, "ERR BAD_COMMAND -Q cannot be combined with a command, -i or -S\n");
             return 1;
         }
-        out_args->cmd = RELAYCTL_CMD_WRITE_MASK;
-
-        if (parse_mask_arg(argv[i], &out_args->mask) != 0) {
+        return 0;
+    }
+    if (out_args->sched_path) {
+        if (i < argc || out_args->interactive) {
+            fprintf(stderr, "ERR BAD_COMMAND -S cannot be combined with a command or -i\n");
             return 1;
         }
-        i++;
-
-    } else if (strcasecmp(cmd, "read-mask") == 0) {
-        out_args->cmd = RELAYCTL_CMD_READ_MASK;
-
-    } else if (strcasecmp(cmd, "reset") == 0) {
-        out_args->cmd = RELAYCTL_CMD_RESET;
-
-    } else if (strcasecmp(cmd, "ping") == 0) {
-        out_args->cmd = RELAYCTL_CMD_PING;
-
-    } else if (strcasecmp(cmd, "version") == 0) {
-        out_args->cmd = RELAYCTL_CMD_VERSION;
-
-    } else if (strcasecmp(cmd, "help") == 0) {
-        out_args->cmd = RELAYCTL_CMD_HELP;
-
-    } else {
-        fprintf(stderr, "ERR BAD_COMMAND Unknown command: %s\n", cmd);
-        return 1;
+        return 0;
     }
-
-    if (i < argc) {
-        fprintf(stderr, "ERR BAD_COMMAND Unexpected extra arguments\n");
+    if (out_args->rt_prio) {
+        fprintf(stderr, "ERR BAD_COMMAND -R requires -S or -Q\n");
         return 1;
     }
 
-    return 0;
-}
-
-
-/* Helper 1 parse a channel argument "1".."4" */
-static int parse_channel_arg(const char *arg, int *out_channel) {
-    char *endp = NULL;
-    long ch = strtol(arg, &endp, 10);
-    if (*arg == '\0' || *endp != '\0' ||
-        ch < USBRELAY_MIN_CHANNEL || ch > USBRELAY_MAX_CHANNEL) {
-        fprintf(stderr, "ERR BAD_CHANNEL Channel must be 1..4\n");
+    /* Now argv[i] should be protocol command (unless interactive-only) */
+    if (i >= argc) {
+        if (out_args->interactive) {
+            /* Interactive REPL with no initial command is allowed */
+            out_args->command.cmd = RELAYCTL_CMD_NONE;
+            return 0;
+        }
+        print_usage();
         return 1;
     }
-    *out_channel = (int)ch;
-    return 0;
-}
 
-/* Helper 2 parse a mask argument "0xHH" (0x00-0x0F) */
-static int parse_mask_arg(const char *arg, uint8_t *out_mask) {
-    const char *mask_str = arg;
-    char *endp = NULL;
-    long val = strtol(mask_str, &endp, 0); /* base 0: allows 0x prefix */
-    if (*mask_str == '\0' || *endp != '\0' || val < 0 || val > 0xFF) {
-        fprintf(stderr, "ERR BAD_MASK Mask must be 0xHH\n");
+    /* The rest of argv is one protocol command, parsed by the same
+     * table-driven parser the REPL uses */
+    if (relayctl_parse_tokens(argc - i, argv + i, &out_args->command) != 0) {
+        print_parse_error(&out_args->command);
         return 1;
     }
-    if ((uint8_t)val & ~USBRELAY_MASK_ALL) {
-        fprintf(stderr, "ERR BAD_MASK Mask must be in range 0x00-0x0F\n");
-        return 1;
-    }
-    *out_mask = (uint8_t)val;
-    return 0;
-}
 
-/* Helper 3 keep lower 3 bits of relay mask */
-static void relay_sanitize_mask(struct relay_context *ctx) {
-    ctx->mask &= USBRELAY_MASK_ALL;
+    return 0;
 }
 
-/* Get the context initialized using the parsed args */
-static void relay_context_init(struct relay_context *ctx, const struct relayctl_args *args) {
-    ctx->fd  = -1;
-    ctx->mask = args->mask;
-    strncpy(ctx->dev_path, args->dev_path, PATH_MAX - 1);
+/* Get the context for board number "board" initialized using the parsed args */
+static void relay_context_init(struct relay_context *ctx, const struct relayctl_args *args,
+                               int board) {
+    ctx->board = board;
+    ctx->dev = NULL;
+    strncpy(ctx->dev_path, args->dev_paths[board], PATH_MAX - 1);
     ctx->dev_path[PATH_MAX - 1] = '\0';
     ctx->verbose = args->verbose;
     ctx->interactive = args->interactive;
+    ctx->cached = args->cached;
+    ctx->stale_ms = args->stale_ms;
 }
 
 static int relay_open_device(struct relay_context *ctx) {
-    int fd = open(ctx->dev_path, O_RDWR);
-    if (fd < 0) {
+    if (relay_open(&ctx->dev, ctx->dev_path) != USBRELAY_OK) {
         fprintf(stderr, "ERR DEVICE_UNAVAILABLE Failed to open device %s (errno=%d)\n", ctx->dev_path, errno);
         return 1;
     }
-    ctx->fd = fd;
+    relay_set_cache(ctx->dev, ctx->cached, ctx->stale_ms);
+    if (ctx->interlock) {
+        relay_set_interlock(ctx->dev, ctx->interlock);
+    }
     return 0;
 }
 
-static void relay_close_device(struct relay_context *ctx) {
-    if (ctx->fd >= 0) {
-        close(ctx->fd);
-        ctx->fd = -1;
-    }
+/* Returns nonzero if writes still queued in the transport failed */
+static int relay_close_device(struct relay_context *ctx) {
+    enum usbrelay_status st = relay_close(ctx->dev);
+    ctx->dev = NULL;
+    return st != USBRELAY_OK;
 }
 
-static int relay_read_mask(struct relay_context *ctx)
-{
-    char buf[1];
-    ssize_t ret = read(ctx->fd, buf, 1);
-    if (ret == 1) {
-        ctx->mask = (unsigned char)buf[0];
-        relay_sanitize_mask(ctx);
-        return 0;
-    }
+static void reply_reset(struct relay_context *ctx) {
+    ctx->reply.kind = RELAY_REPLY_NONE;
+    ctx->reply.status = USBRELAY_OK;
+    ctx->reply.msg[0] = '\0';
+}
 
-    fprintf(stderr, "ERR READ_FAILURE Failed to read character driver for device. (errno=%d)\n", errno);
-    return 1;
+static uint8_t relay_current_mask(const struct relay_context *ctx) {
+    return ctx->dev ? relay_mask(ctx->dev) : 0;
 }
 
-static int relay_write_mask(struct relay_context *ctx) {
-    char buf[1];
+static void reply_state(struct relay_context *ctx, int ch, int on) {
+    ctx->reply.kind = RELAY_REPLY_STATE;
+    ctx->reply.channel = ch;
+    ctx->reply.state = on;
+    ctx->reply.mask = relay_current_mask(ctx);
+}
 
-    relay_sanitize_mask(ctx);
-    buf[0] = (char)ctx->mask;
+static void reply_mask(struct relay_context *ctx) {
+    ctx->reply.kind = RELAY_REPLY_MASK;
+    ctx->reply.mask = relay_current_mask(ctx);
+}
 
-    ssize_t ret = write(ctx->fd, buf, 1);
-    if (ret == 1) {
-        return 0;
-    }
+static void reply_ok(struct relay_context *ctx, enum relay_reply_kind kind) {
+    ctx->reply.kind = kind;
+    ctx->reply.mask = relay_current_mask(ctx);
+}
 
-    fprintf(stderr,
-            "ERR WRITE_FAILURE Failed to write mask to device. (errno=%d)\n",
-            errno);
+/* Record an error for the current command; always returns 1 */
+static int reply_error(struct relay_context *ctx, enum usbrelay_status status,
+                       const char *fmt, ...) {
+    va_list ap;
+
+    ctx->reply.status = status;
+    va_start(ap, fmt);
+    vsnprintf(ctx->reply.msg, sizeof(ctx->reply.msg), fmt, ap);
+    va_end(ap);
     return 1;
 }
 
-static int handle_set(struct relay_context *ctx, const struct relayctl_args *args) {
-    int ch = args->channel;
-    unsigned int bit;
-    const char *state_str;
+/* Print the current reply as a protocol line (errors go to stderr).
+ * Board-qualified replies carry BOARD=<n> right after OK / the ERR code. */
+static void reply_print_text(FILE *out, const struct relay_context *ctx, int qualified) {
+    const struct relay_reply *r = &ctx->reply;
+    char board[24] = "";
 
-    if (ch < USBRELAY_MIN_CHANNEL || ch > USBRELAY_MAX_CHANNEL) {
-        fprintf(stderr, "ERR BAD_CHANNEL Channel must be 1..4\n");
-        return 1;
+    if (qualified) {
+        snprintf(board, sizeof(board), " BOARD=%d", ctx->board);
     }
-    if (relay_read_mask(ctx) != 0) {return 1;}
 
-    /* Compute bit for this channel (bit 0 -> CH1, etc.) */
-#ifdef USBRELAY_CH_TO_BIT
-    bit = USBRELAY_CH_TO_BIT(ch);
-#else
-    bit = 1U << (ch - 1);
-#endif
-
-    if (args->state == RELAYCTL_STATE_ON) {
-        ctx->mask |= bit;
-        state_str = "ON";
-    } else {
-        ctx->mask &= ~bit;
-        state_str = "OFF";
+    if (r->status != USBRELAY_OK) {
+        relayctl_metrics_error(r->status);
+        fprintf(stderr, "ERR %s%s %s\n", relay_status_name(r->status), board, r->msg);
+        return;
     }
 
-    if (relay_write_mask(ctx) != 0) {return 1;}
-
-    printf("OK CH=%d STATE=%s\n", ch, state_str);
-    return 0;
+    switch (r->kind) {
+    case RELAY_REPLY_OK:
+        fprintf(out, "OK%s\n", board);
+        break;
+    case RELAY_REPLY_STATE:
+        fprintf(out, "OK%s CH=%d STATE=%s\n", board, r->channel, r->state ? "ON" : "OFF");
+        break;
+    case RELAY_REPLY_MASK:
+        fprintf(out, "OK%s MASK=0x%02X\n", board, (unsigned int)r->mask);
+        break;
+    case RELAY_REPLY_VERSION:
+        fprintf(out, "OK VERSION=%s TOOL=relayctl/%s\n",
+                USBRELAY_PROTO_VERSION,
+                RELAYCTL_TOOL_VERSION);
+        break;
+    case RELAY_REPLY_HELP:
+        print_help(out);
+        break;
+    case RELAY_REPLY_NONE:
+        break;
+    }
 }
 
-
-
-static int handle_get(struct relay_context *ctx, const struct relayctl_args *args) {
-    int ch = args->channel;
-    unsigned int bit;
-    const char *state_str;
-
-    if (ch < USBRELAY_MIN_CHANNEL || ch > USBRELAY_MAX_CHANNEL) {
-        fprintf(stderr, "ERR BAD_CHANNEL Channel must be 1..4\n");
-        return 1;
+/* Turn a librelay status into the protocol error for the current command.
+ * Always returns 1. */
+static int reply_status(struct relay_context *ctx, enum usbrelay_status st) {
+    switch (st) {
+    case USBRELAY_ERR_BAD_CHANNEL:
+        return reply_error(ctx, st, "Channel must be 1..4");
+    case USBRELAY_ERR_BAD_MASK:
+        return reply_error(ctx, st, "Mask must be in range 0x00-0x0F");
+    case USBRELAY_ERR_READ_FAILURE:
+        return reply_error(ctx, st, "Failed to read character driver for device. (errno=%d)",
+                           relay_errno(ctx->dev));
+    case USBRELAY_ERR_WRITE_FAILURE:
+        return reply_error(ctx, st, "Failed to write mask to device. (errno=%d)",
+                           relay_errno(ctx->dev));
+    case USBRELAY_ERR_DEVICE_UNAVAILABLE:
+        return reply_error(ctx, st, "Unable to communicate with device");
+    case USBRELAY_ERR_INTERLOCK:
+        return reply_error(ctx, st, "Resulting mask is not allowed by the interlock rules");
+    case USBRELAY_ERR_BAD_COMMAND:
+        /* only BEGIN/COMMIT/ABORT fail this way */
+        return reply_error(ctx, st, "%s", relay_in_batch(ctx->dev) ?
+                           "Transaction already open" : "No open transaction");
+    default:
+        return reply_error(ctx, st, "Unexpected failure");
     }
+}
 
-    if (relay_read_mask(ctx) != 0) {return 1;}
-
-#ifdef USBRELAY_CH_TO_BIT
-    bit = USBRELAY_CH_TO_BIT(ch);
-#else
-    bit = 1U << (ch - 1);
-#endif
+static int handle_set(struct relay_context *ctx, const struct relayctl_command *args) {
+    int on = args->state == RELAYCTL_STATE_ON;
+    enum usbrelay_status st = relay_set(ctx->dev, args->channel, on);
 
-    if (ctx->mask & bit) {
-        state_str = "ON";
-    } else {
-        state_str = "OFF";
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
     }
-
-    printf("OK CH=%d STATE=%s\n", ch, state_str);
+    reply_state(ctx, args->channel, on);
     return 0;
 }
 
+static int handle_get(struct relay_context *ctx, const struct relayctl_command *args) {
+    int on;
+    enum usbrelay_status st = relay_get(ctx->dev, args->channel, &on);
 
-static int handle_getall(struct relay_context *ctx) {
-    if (relay_read_mask(ctx) != 0) {return 1;}
-    printf("OK MASK=0x%02X\n", (unsigned int)ctx->mask);
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
+    }
+    reply_state(ctx, args->channel, on);
     return 0;
 }
 
-static int handle_toggle(struct relay_context *ctx, const struct relayctl_args *args) {
-    int ch = args->channel;
-    unsigned int bit;
-    const char *state_str;
+static int handle_getall(struct relay_context *ctx) {
+    enum usbrelay_status st = relay_get_mask(ctx->dev, NULL);
 
-    if (ch < USBRELAY_MIN_CHANNEL || ch > USBRELAY_MAX_CHANNEL) {
-        fprintf(stderr, "ERR BAD_CHANNEL Channel must be 1..4\n");
-        return 1;
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
     }
-    if (relay_read_mask(ctx) != 0) {return 1;}
+    reply_mask(ctx);
+    return 0;
+}
 
-#ifdef USBRELAY_CH_TO_BIT
-    bit = USBRELAY_CH_TO_BIT(ch);
-#else
-    bit = 1U << (ch - 1);
-#endif
-    ctx->mask ^= bit;
-    if (relay_write_mask(ctx) != 0) {return 1;}
+static int handle_toggle(struct relay_context *ctx, const struct relayctl_command *args) {
+    int on;
+    enum usbrelay_status st = relay_toggle(ctx->dev, args->channel, &on);
 
-    if (ctx->mask & bit) {
-        state_str = "ON";
-    } else {
-        state_str = "OFF";
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
     }
-    printf("OK CH=%d STATE=%s\n", ch, state_str);
+    reply_state(ctx, args->channel, on);
     return 0;
 }
 
-static int handle_write_mask(struct relay_context *ctx, const struct relayctl_args *args) {
-    uint8_t m = args->mask;
-    if (m & ~USBRELAY_MASK_ALL) {
-        fprintf(stderr, "ERR BAD_MASK Mask must be in range 0x00-0x0F\n");
-        return 1;
-    }
-
-    ctx->mask = m;
-    relay_sanitize_mask(ctx);
-    if (relay_write_mask(ctx) != 0) {return 1;}
+static int handle_write_mask(struct relay_context *ctx, const struct relayctl_command *args) {
+    enum usbrelay_status st = relay_write_mask(ctx->dev, args->mask);
 
-    printf("OK MASK=0x%02X\n", (unsigned int)ctx->mask);
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
+    }
+    reply_mask(ctx);
     return 0;
 }
 
+/* Inside a transaction this reports the staged mask, not the device */
 static int handle_read_mask(struct relay_context *ctx)
 {
-    if (relay_read_mask(ctx) != 0) {return 1;}
+    enum usbrelay_status st = relay_read_mask(ctx->dev, NULL);
 
-    printf("OK MASK=0x%02X\n", (unsigned int)ctx->mask);
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
+    }
+    reply_mask(ctx);
     return 0;
 }
 
 static int handle_reset(struct relay_context *ctx) {
-    ctx->mask = 0x00;
-    if (relay_write_mask(ctx) != 0) {
-        return 1;
+    enum usbrelay_status st = relay_reset(ctx->dev);
+
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
     }
-    printf("OK MASK=0x00\n");
+    reply_mask(ctx);
     return 0;
 }
 
 static int handle_ping(struct relay_context *ctx) {
-    if (relay_read_mask(ctx) == 0) {
-        printf("OK\n");
-        return 0;
-    }
+    enum usbrelay_status st = relay_ping(ctx->dev);
 
-    fprintf(stderr, "ERR DEVICE_UNAVAILABLE Unable to communicate with device\n");
-    return 1;
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
+    }
+    reply_ok(ctx, RELAY_REPLY_OK);
+    return 0;
 }
 
+static int handle_begin(struct relay_context *ctx) {
+    enum usbrelay_status st = relay_begin(ctx->dev);
 
-static int handle_version(void) {
-    printf("OK VERSION=%s TOOL=relayctl/%s\n",
-           USBRELAY_PROTO_VERSION,
-           RELAYCTL_TOOL_VERSION);
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
+    }
+    reply_ok(ctx, RELAY_REPLY_OK);
     return 0;
 }
 
-static int handle_help(void) {
-    print_help();
-    /* You could also add: printf("OK\n"); if you want strict protocol lines */
+static int handle_commit(struct relay_context *ctx) {
+    enum usbrelay_status st = relay_commit(ctx->dev, NULL);
+
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
+    }
+    reply_mask(ctx);
     return 0;
 }
 
-static int run_interactive(struct relay_context *ctx) {
-    char line[USBRELAY_MAX_LINE_LEN];
-    int exit_status = 0;
-    print_help();
-    for (;;) {
-        if (ctx->verbose) {
-            fputs("> ", stdout);
-            fflush(stdout);
-        }
-
-        /* Read one line from stdin; EOF -> exit loop */
-        if (!fgets(line, sizeof(line), stdin)) {
-            break;
-        }
-
-        /* Trim leading whitespace */
-        char *p = line;
-        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
-            p++;
-        }
-        if (*p == '\0') {
-            continue;
-        }
+static int handle_abort(struct relay_context *ctx) {
+    enum usbrelay_status st = relay_abort(ctx->dev);
 
-        if (strcasecmp(p, "quit\n") == 0 || strcasecmp(p, "quit") == 0 ||
-            strcasecmp(p, "exit\n") == 0 || strcasecmp(p, "exit") == 0) {
-            break;
-        }
+    if (st != USBRELAY_OK) {
+        return reply_status(ctx, st);
+    }
+    reply_ok(ctx, RELAY_REPLY_OK);
+    return 0;
+}
 
-        /* Tokenize the line */
-        char *argv_buf[16];
-        int argc_buf = 0;
-        char *token = strtok(p, " \t\r\n");
-        while (token && argc_buf < (int)(sizeof(argv_buf) / sizeof(argv_buf[0]))) {
-            argv_buf[argc_buf++] = token;
-            token = strtok(NULL, " \t\r\n");
-        }
-        if (argc_buf == 0) {
-            continue;
-        }
+static int handle_version(struct relay_context *ctx) {
+    reply_ok(ctx, RELAY_REPLY_VERSION);
+    return 0;
+}
 
-        char *fake_argv[1 + 16];
-        int fake_argc = argc_buf + 1;
-        fake_argv[0] = (char *)"relayctl";
-        for (int i = 0; i < argc_buf; i++) {
-            fake_argv[i + 1] = argv_buf[i];
-        }
+static int handle_help(struct relay_context *ctx) {
+    reply_ok(ctx, RELAY_REPLY_HELP);
+    /* You could also add: printf("OK\n"); if you want strict protocol lines */
+    return 0;
+}
 
-        struct relayctl_args args;
-        int rc = parse_args(fake_argc, fake_argv, &args);
-        if (rc != 0) {
-            exit_status = rc;
-            continue;
-        }
+/* Run one parsed command against the device. Shared by one-shot mode and
+ * the REPL; callers deal with QUIT and with mode restrictions. */
+static int relay_run_command(struct relay_context *ctx,
+                             const struct relayctl_command *cmd) {
+    int rc;
 
-        // Same usual handlers
-        switch (args.cmd) {
-        case RELAYCTL_CMD_SET:
-            rc = handle_set(ctx, &args);
-            break;
-        case RELAYCTL_CMD_GET:
-            rc = handle_get(ctx, &args);
-            break;
-        case RELAYCTL_CMD_GETALL:
-            rc = handle_getall(ctx);
-            break;
-        case RELAYCTL_CMD_TOGGLE:
-            rc = handle_toggle(ctx, &args);
-            break;
-        case RELAYCTL_CMD_WRITE_MASK:
-            rc = handle_write_mask(ctx, &args);
-            break;
-        case RELAYCTL_CMD_READ_MASK:
-            rc = handle_read_mask(ctx);
-            break;
-        case RELAYCTL_CMD_RESET:
-            rc = handle_reset(ctx);
-            break;
-        case RELAYCTL_CMD_PING:
-            rc = handle_ping(ctx);
-            break;
-        case RELAYCTL_CMD_VERSION:
-            rc = handle_version();
-            break;
-        case RELAYCTL_CMD_HELP:
-            rc = handle_help();
-            break;
-        default:
-            fprintf(stderr,
-                    "ERR INTERNAL_ERROR Unknown command in interactive mode\n");
-            rc = 1;
-            break;
-        }
-        if (rc != 0) {
-            exit_status = rc;
+    reply_reset(ctx);
+    switch (cmd->cmd) {
+    case RELAYCTL_CMD_SET:
+        rc = handle_set(ctx, cmd);
+        break;
+    case RELAYCTL_CMD_GET:
+        rc = handle_get(ctx, cmd);
+        break;
+    case RELAYCTL_CMD_GETALL:
+        rc = handle_getall(ctx);
+        break;
+    case RELAYCTL_CMD_TOGGLE:
+        rc = handle_toggle(ctx, cmd);
+        break;
+    case RELAYCTL_CMD_WRITE_MASK:
+        rc = handle_write_mask(ctx, cmd);
+        break;
+    case RELAYCTL_CMD_READ_MASK:
+        rc = handle_read_mask(ctx);
+        break;
+    case RELAYCTL_CMD_RESET:
+        rc = handle_reset(ctx);
+        break;
+    case RELAYCTL_CMD_PING:
+        rc = handle_ping(ctx);
+        break;
+    case RELAYCTL_CMD_VERSION:
+        rc = handle_version(ctx);
+        break;
+    case RELAYCTL_CMD_HELP:
+        rc = handle_help(ctx);
+        break;
+    case RELAYCTL_CMD_BEGIN:
+        rc = handle_begin(ctx);
+        break;
+    case RELAYCTL_CMD_COMMIT:
+        rc = handle_commit(ctx);
+        break;
+    case RELAYCTL_CMD_ABORT:
+        rc = handle_abort(ctx);
+        break;
+    case RELAYCTL_CMD_BINARY:
+    case RELAYCTL_CMD_QUIT:
+    case RELAYCTL_CMD_STATS:
+    case RELAYCTL_CMD_WATCH:
+    case RELAYCTL_CMD_SCENE:
+    case RELAYCTL_CMD_NONE:
+    default:
+        reply_error(ctx, USBRELAY_ERR_INTERNAL_ERROR, "Unknown or unsupported command");
+        rc = 3;
+        break;
+    }
+    return rc;
+}
+
+/* Returned by run_interactive_command() for quit/exit and binary mode */
+#define RELAYCTL_RC_QUIT    (-1)
+#define RELAYCTL_RC_BINARY  (-2)
+
+static uint32_t session_all_boards(const struct relay_session *s) {
+    return (s->nboards >= 32) ? 0xFFFFFFFFu : ((1U << s->nboards) - 1);
+}
+
+/* Resolve a board selector: "all", a -g group name, or a list of
+ * indexes and ranges ("2", "0,2", "0-3"). Returns 0 and the board bits,
+ * or 1 with an error message. */
+static int session_resolve_boards(const struct relay_session *s, const char *sel,
+                                  uint32_t *out, char *err, size_t errlen) {
+    uint32_t bits = 0;
+    const char *p = sel;
+
+    if (strcmp(sel, "all") == 0) {
+        *out = session_all_boards(s);
+        return 0;
+    }
+    if (!(*sel >= '0' && *sel <= '9')) {
+        for (int g = 0; g < s->ngroups; g++) {
+            if (strcmp(s->groups[g].name, sel) == 0) {
+                *out = s->groups[g].boards;
+                return 0;
+            }
+        }
+        snprintf(err, errlen, "Unknown board group: %s", sel);
+        return 1;
+    }
+
+    while (*p) {
+        char *endp;
+        long lo = strtol(p, &endp, 10);
+        long hi = lo;
+
+        if (endp == p) {
+            break;
+        }
+        if (*endp == '-') {
+            p = endp + 1;
+            hi = strtol(p, &endp, 10);
+            if (endp == p) {
+                break;
+            }
+        }
+        if (lo > hi || lo < 0 || hi >= s->nboards) {
+            snprintf(err, errlen, "Board must be 0..%d: %s", s->nboards - 1, sel);
+            return 1;
+        }
+        for (long b = lo; b <= hi; b++) {
+            bits |= 1U << b;
+        }
+        p = endp;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            break;
+        }
+    }
+    if (*p != '\0' || bits == 0) {
+        snprintf(err, errlen, "Bad board selector: %s", sel);
+        return 1;
+    }
+    *out = bits;
+    return 0;
+}
+
+/* Define a group from a -g "name=selector" argument */
+static int session_add_group(struct relay_session *s, const char *def) {
+    const char *eq = strchr(def, '=');
+    size_t len = (size_t)(eq - def);
+    char err[96];
+    uint32_t bits;
+
+    if (len == 0 || len >= RELAYCTL_GROUP_NAME_MAX ||
+        (def[0] >= '0' && def[0] <= '9') || strchr(def, ':') ||
+        (len == 3 && strncmp(def, "all", 3) == 0)) {
+        fprintf(stderr, "ERR BAD_BOARD Bad group name in -g %s\n", def);
+        return 1;
+    }
+    if (session_resolve_boards(s, eq + 1, &bits, err, sizeof(err)) != 0) {
+        fprintf(stderr, "ERR BAD_BOARD %s\n", err);
+        return 1;
+    }
+
+    struct relay_group *g = &s->groups[s->ngroups++];
+    memcpy(g->name, def, len);
+    g->name[len] = '\0';
+    g->boards = bits;
+    return 0;
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Binary opcode for a command that acts on a board; 0 for the rest */
+static uint8_t relay_cmd_opcode(enum relayctl_cmd cmd) {
+    switch (cmd) {
+    case RELAYCTL_CMD_SET:        return USBRELAY_OP_SET;
+    case RELAYCTL_CMD_GET:        return USBRELAY_OP_GET;
+    case RELAYCTL_CMD_GETALL:     return USBRELAY_OP_GETALL;
+    case RELAYCTL_CMD_TOGGLE:     return USBRELAY_OP_TOGGLE;
+    case RELAYCTL_CMD_WRITE_MASK: return USBRELAY_OP_WRITE_MASK;
+    case RELAYCTL_CMD_READ_MASK:  return USBRELAY_OP_READ_MASK;
+    case RELAYCTL_CMD_RESET:      return USBRELAY_OP_RESET;
+    case RELAYCTL_CMD_PING:       return USBRELAY_OP_PING;
+    case RELAYCTL_CMD_BEGIN:      return USBRELAY_OP_BEGIN;
+    case RELAYCTL_CMD_COMMIT:     return USBRELAY_OP_COMMIT;
+    case RELAYCTL_CMD_ABORT:      return USBRELAY_OP_ABORT;
+    default:                      return 0;
+    }
+}
+
+/* Append the command just run on ctx, with its reply, to the -r log */
+static void session_record(struct relay_session *s, const struct relay_context *ctx,
+                           const struct relayctl_command *cmd, int64_t t_ns) {
+    struct relayctl_log_rec rec;
+
+    if (!s->log || !(rec.op = relay_cmd_opcode(cmd->cmd))) {
+        return;
+    }
+    rec.t_ns = t_ns;
+    rec.status = (uint8_t)ctx->reply.status;
+    rec.board = (uint8_t)ctx->board;
+    rec.channel = (uint8_t)cmd->channel;
+    rec.arg = cmd->cmd == RELAYCTL_CMD_SET ? (uint8_t)cmd->state : cmd->mask;
+    rec.mask = relay_current_mask(ctx);
+    rec.flags = 0;
+    relayctl_log_append(s->log, &rec);
+}
+
+/* One board's share of a command that spans several boards */
+struct relay_job {
+    pthread_t                      thread;
+    struct relay_context          *ctx;
+    const struct relayctl_command *cmd;
+    int                            rc;
+};
+
+static void *relay_job_run(void *arg) {
+    struct relay_job *job = arg;
+    job->rc = relay_run_command(job->ctx, job->cmd);
+    return NULL;
+}
+
+/* Run cmds[b] on every board b in "boards". When that means device I/O
+ * on more than one board, each extra board gets its own thread so the
+ * total latency stays close to that of a single board. Replies are left
+ * in each board's context. */
+static int session_run_each(struct relay_session *s, uint32_t boards,
+                            const struct relayctl_command *const cmds[]) {
+    struct relay_job jobs[RELAYCTL_MAX_BOARDS];
+    int64_t t_ns = s->log ? monotonic_ns() : 0;
+    int njobs = 0;
+    int rc = 0;
+
+    for (int b = 0; b < s->nboards; b++) {
+        if (boards & (1U << b)) {
+            jobs[njobs].ctx = &s->boards[b];
+            jobs[njobs].cmd = cmds[b];
+            jobs[njobs].rc = 0;
+            njobs++;
+        }
+    }
+    if (njobs == 0) {
+        return 0;
+    }
+
+    /* Staged transaction commands never touch the device: no threads */
+    const struct relayctl_command *cmd = jobs[0].cmd;
+    int concurrent = njobs > 1 &&
+        !(s->in_txn && cmd->cmd != RELAYCTL_CMD_COMMIT && cmd->cmd != RELAYCTL_CMD_PING);
+
+    int started = 0;
+    if (concurrent) {
+        for (started = 1; started < njobs; started++) {
+            if (pthread_create(&jobs[started].thread, NULL, relay_job_run, &jobs[started]) != 0) {
+                break;      /* run the rest inline below */
+            }
         }
     }
+    relay_job_run(&jobs[0]);
+    for (int j = started ? started : 1; j < njobs; j++) {
+        relay_job_run(&jobs[j]);
+    }
+    for (int j = 1; j < started; j++) {
+        pthread_join(jobs[j].thread, NULL);
+    }
+
+    for (int j = 0; j < njobs; j++) {
+        if (jobs[j].rc != 0) {
+            rc = jobs[j].rc;
+        }
+        session_record(s, jobs[j].ctx, jobs[j].cmd, t_ns);
+    }
+    return rc;
+}
+
+/* Run the same cmd on every board in "boards" */
+static int session_run(struct relay_session *s, uint32_t boards,
+                       const struct relayctl_command *cmd) {
+    const struct relayctl_command *cmds[RELAYCTL_MAX_BOARDS];
+
+    for (int b = 0; b < s->nboards; b++) {
+        cmds[b] = cmd;
+    }
+    return session_run_each(s, boards, cmds);
+}
+
+static void session_print_text(const struct relay_session *s, uint32_t boards,
+                               int qualified) {
+    for (int b = 0; b < s->nboards; b++) {
+        if (boards & (1U << b)) {
+            reply_print_text(s->out, &s->boards[b], qualified);
+        }
+    }
+}
+
+/* The session's boards, as labelled in STATS and exported metrics */
+static int session_metrics_boards(const struct relay_session *s,
+                                  struct relayctl_metrics_board *out) {
+    for (int b = 0; b < s->nboards; b++) {
+        out[b].dev = s->boards[b].dev;
+        out[b].path = s->boards[b].dev_path;
+    }
+    return s->nboards;
+}
+
+/* Interlocks (-L) are checked by each board as it writes, so a SCENE or
+ * COMMIT spanning several boards checks all of them first: one refused
+ * mask then leaves every board untouched. masks[b] is the mask board b
+ * would get. Prints ERR INTERLOCK per refused board; nonzero if any. */
+static int session_interlocked(struct relay_session *s, uint32_t boards,
+                               const uint8_t masks[]) {
+    int refused = 0;
+
+    for (int b = 0; b < s->nboards; b++) {
+        struct relay_context *ctx = &s->boards[b];
+
+        if ((boards & (1U << b)) && !relay_mask_allowed(ctx->dev, masks[b])) {
+            reply_reset(ctx);
+            reply_error(ctx, USBRELAY_ERR_INTERLOCK,
+                        "Mask 0x%02X is not allowed by the interlock rules",
+                        (unsigned int)masks[b]);
+            reply_print_text(s->out, ctx, s->nboards > 1);
+            refused = 1;
+        }
+    }
+    return refused;
+}
+
+/* Before a COMMIT on several boards: if any staged mask is refused,
+ * drop the transaction on every board and return nonzero. Like
+ * relay_commit(), only boards with staged changes are checked. */
+static int session_commit_interlocked(struct relay_session *s) {
+    uint8_t masks[RELAYCTL_MAX_BOARDS];
+    uint32_t dirty = 0;
+
+    if (s->nboards < 2) {
+        return 0;           /* relay_commit() checks a single board */
+    }
+    for (int b = 0; b < s->nboards; b++) {
+        masks[b] = relay_mask(s->boards[b].dev);
+        if (relay_batch_dirty(s->boards[b].dev)) {
+            dirty |= 1U << b;
+        }
+    }
+    if (!session_interlocked(s, dirty, masks)) {
+        return 0;
+    }
+    for (int b = 0; b < s->nboards; b++) {
+        if (relay_in_batch(s->boards[b].dev)) {
+            relay_abort(s->boards[b].dev);
+        }
+    }
+    s->in_txn = 0;
+    return 1;
+}
+
+/* SCENE: write each board's precompiled mask, one transfer per board */
+static int session_scene(struct relay_session *s, const struct relayctl_command *cmd) {
+    const struct relayctl_scene *sc = s->scenes ? relayctl_scene_find(s->scenes, cmd->name) : NULL;
+    struct relayctl_command wm[RELAYCTL_MAX_BOARDS];
+    const struct relayctl_command *cmds[RELAYCTL_MAX_BOARDS];
+
+    if (!sc) {
+        relayctl_metrics_error(USBRELAY_ERR_BAD_COMMAND);
+        fprintf(stderr, "ERR BAD_COMMAND Unknown scene: %s\n", cmd->name);
+        return 1;
+    }
+    if (sc->boards & ~session_all_boards(s)) {
+        relayctl_metrics_error(USBRELAY_ERR_BAD_BOARD);
+        fprintf(stderr, "ERR BAD_BOARD Scene %s uses more boards than -d gave\n", sc->name);
+        return 1;
+    }
+
+    /* Inside a transaction the masks are checked at COMMIT */
+    if (!s->in_txn && session_interlocked(s, sc->boards, sc->mask)) {
+        return 1;
+    }
+
+    for (int b = 0; b < s->nboards; b++) {
+        memset(&wm[b], 0, sizeof(wm[b]));
+        wm[b].cmd = RELAYCTL_CMD_WRITE_MASK;
+        wm[b].mask = sc->mask[b];
+        cmds[b] = &wm[b];
+    }
+    int rc = session_run_each(s, sc->boards, cmds);
+    session_print_text(s, sc->boards, sc->boards != 1);
+    return rc;
+}
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_on_signal(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+/* WATCH on every board until SIGINT/SIGTERM or the next REPL line */
+static int session_watch(struct relay_session *s, const struct relayctl_command *cmd) {
+    struct relay_board *devs[RELAYCTL_MAX_BOARDS];
+    struct relayctl_watch_stats st;
+    struct sigaction sa, old_int, old_term;
+    int failed;
+
+    if (s->in_txn) {
+        relayctl_metrics_error(USBRELAY_ERR_BAD_STATE);
+        fprintf(stderr, "ERR BAD_STATE Cannot watch inside a transaction\n");
+        return 1;
+    }
+    for (int b = 0; b < s->nboards; b++) {
+        devs[b] = s->boards[b].dev;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watch_on_signal;    /* no SA_RESTART: wake poll() */
+    sigemptyset(&sa.sa_mask);
+    watch_stop = 0;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    enum usbrelay_status status = relayctl_watch_run(
+        devs, s->nboards, s->nboards > 1,
+        cmd->interval_ms ? cmd->interval_ms : RELAYCTL_WATCH_DEFAULT_MS,
+        s->watch_input ? s->watch_input_fd : -1, s->watch_input, s->watch_input_arg,
+        &watch_stop, &st, &failed);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    if (status != USBRELAY_OK) {
+        struct relay_context *ctx = &s->boards[failed >= 0 ? failed : 0];
+        reply_reset(ctx);
+        reply_status(ctx, status);
+        relayctl_metrics_error(status);
+        reply_print_text(s->out, ctx, s->nboards > 1);
+        return 1;
+    }
+    printf("OK WATCH CHANGES=%lu READS=%lu SKIPPED=%lu MODE=%s\n",
+           st.changes, st.reads, st.skipped,
+           !st.polled ? "NOTIFY" : !st.notified ? "POLL" : "MIXED");
+    return 0;
+}
+
+/* Run a parsed command against the boards it addresses and print the
+ * replies. Unqualified commands act on board 0; transaction commands
+ * always span every board. */
+static int session_dispatch_text(struct relay_session *s, const struct relayctl_command *cmd) {
+    uint32_t boards = 1;
+    int qualified = 0;
+
+    if (cmd->cmd == RELAYCTL_CMD_STATS) {
+        struct relayctl_metrics_board mb[RELAYCTL_MAX_BOARDS];
+        relayctl_metrics_print(s->out, mb, session_metrics_boards(s, mb));
+        return 0;
+    }
+    if (cmd->cmd == RELAYCTL_CMD_WATCH) {
+        return session_watch(s, cmd);
+    }
+    if (cmd->cmd == RELAYCTL_CMD_SCENE) {
+        return session_scene(s, cmd);
+    }
+    if (cmd->cmd == RELAYCTL_CMD_BEGIN || cmd->cmd == RELAYCTL_CMD_COMMIT ||
+        cmd->cmd == RELAYCTL_CMD_ABORT) {
+        boards = session_all_boards(s);
+        qualified = s->nboards > 1;
+    } else if (cmd->boards) {
+        char err[96];
+        if (session_resolve_boards(s, cmd->boards, &boards, err, sizeof(err)) != 0) {
+            relayctl_metrics_error(USBRELAY_ERR_BAD_BOARD);
+            fprintf(stderr, "ERR BAD_BOARD %s\n", err);
+            return 1;
+        }
+        qualified = 1;
+    }
+    if (cmd->cmd == RELAYCTL_CMD_COMMIT && s->in_txn && session_commit_interlocked(s)) {
+        return 1;
+    }
+
+    int rc = session_run(s, boards, cmd);
+
+    if (cmd->cmd == RELAYCTL_CMD_BEGIN) {
+        if (rc != 0) {
+            /* All boards or none: roll back the ones that did begin */
+            for (int b = 0; b < s->nboards; b++) {
+                if (relay_in_batch(s->boards[b].dev)) {
+                    relay_abort(s->boards[b].dev);
+                }
+            }
+        } else {
+            s->in_txn = 1;
+        }
+    } else if (cmd->cmd == RELAYCTL_CMD_COMMIT || cmd->cmd == RELAYCTL_CMD_ABORT) {
+        s->in_txn = 0;
+    }
+
+    session_print_text(s, boards, qualified);
+    return rc;
+}
+
+/* session_dispatch_text(), counted in the session metrics */
+static int session_run_text(struct relay_session *s, const struct relayctl_command *cmd) {
+    int rc = session_dispatch_text(s, cmd);
+
+    relayctl_metrics_command(cmd->cmd, rc != 0);
+    return rc;
+}
+
+/* Wait for writes the transports still have queued (libusb backend).
+ * Failures are reported like any other write failure. */
+static int session_flush(struct relay_session *s) {
+    int rc = 0;
+
+    for (int b = 0; b < s->nboards; b++) {
+        struct relay_context *ctx = &s->boards[b];
+
+        if (ctx->dev && relay_flush(ctx->dev) != USBRELAY_OK) {
+            reply_reset(ctx);
+            rc = reply_status(ctx, USBRELAY_ERR_WRITE_FAILURE);
+            reply_print_text(s->out, ctx, s->nboards > 1);
+        }
+    }
+    return rc;
+}
+
+/* Parse (in place) and run a single command from an interactive line */
+static int run_interactive_command(struct relay_session *s, char *cmd_line) {
+    char *tok[RELAYCTL_MAX_TOKENS];
+    struct relayctl_command cmd;
+
+    int ntok = relayctl_tokenize(cmd_line, tok, RELAYCTL_MAX_TOKENS);
+    if (ntok == 0) {
+        return 0;
+    }
+    if (ntok < 0) {
+        relayctl_metrics_error(USBRELAY_ERR_BAD_COMMAND);
+        fprintf(stderr, "ERR BAD_COMMAND Too many arguments\n");
+        return 1;
+    }
+    if (relayctl_parse_tokens(ntok, tok, &cmd) != 0) {
+        print_parse_error(&cmd);
+        return 1;
+    }
+
+    if (s->txn_implicit &&
+        (cmd.cmd == RELAYCTL_CMD_BEGIN || cmd.cmd == RELAYCTL_CMD_COMMIT ||
+         cmd.cmd == RELAYCTL_CMD_ABORT || cmd.cmd == RELAYCTL_CMD_QUIT ||
+         cmd.cmd == RELAYCTL_CMD_BINARY || cmd.cmd == RELAYCTL_CMD_WATCH)) {
+        relayctl_metrics_error(USBRELAY_ERR_BAD_COMMAND);
+        fprintf(stderr,
+                "ERR BAD_COMMAND %s not allowed in ';' lines\n",
+                relayctl_cmd_name(cmd.cmd));
+        return 1;
+    }
+    if (cmd.cmd == RELAYCTL_CMD_QUIT) {
+        return RELAYCTL_RC_QUIT;
+    }
+    if (cmd.cmd == RELAYCTL_CMD_BINARY) {
+        printf("OK MODE=BINARY\n");
+        return RELAYCTL_RC_BINARY;
+    }
+
+    return session_run_text(s, &cmd);
+}
+
+/* Run a "cmd; cmd; cmd" line as one implicit transaction: every command
+ * is staged and the result is written once per board. If any command
+ * fails the whole line is discarded. */
+static int run_compound_line(struct relay_session *s, char *line) {
+    int implicit = !s->in_txn;
+    int rc = 0;
+
+    if (implicit) {
+        struct relayctl_command begin = { .cmd = RELAYCTL_CMD_BEGIN };
+        uint32_t all = session_all_boards(s);
+
+        if (session_run(s, all, &begin) != 0) {
+            for (int b = 0; b < s->nboards; b++) {
+                struct relay_context *ctx = &s->boards[b];
+                if (relay_in_batch(ctx->dev)) {
+                    relay_abort(ctx->dev);
+                } else {
+                    reply_print_text(s->out, ctx, s->nboards > 1);
+                }
+            }
+            return 1;
+        }
+        s->in_txn = 1;
+        s->txn_implicit = 1;
+    }
+
+    /* Hold the segments' replies until the line commits: an OK for a
+     * change that is then discarded would be a lie. Without memory for
+     * the buffer they are printed as they come. */
+    char *held = NULL;
+    size_t held_len = 0;
+    FILE *held_out = implicit ? open_memstream(&held, &held_len) : NULL;
+    if (held_out) {
+        s->out = held_out;
+    }
+
+    char *seg = line;
+    while (seg) {
+        char *next = strchr(seg, ';');
+        if (next) {
+            *next++ = '\0';
+        }
+        rc = run_interactive_command(s, seg);
+        if (rc != 0) {
+            break;
+        }
+        seg = next;
+    }
+
+    if (!implicit) {
+        return rc;
+    }
+
+    s->txn_implicit = 0;
+    s->out = stdout;
+    if (held_out) {
+        fclose(held_out);
+    }
+    if (rc != 0) {
+        struct relayctl_command abort_cmd = { .cmd = RELAYCTL_CMD_ABORT };
+        session_run(s, session_all_boards(s), &abort_cmd);
+        s->in_txn = 0;
+        free(held);
+        return rc;
+    }
+
+    /* Silent commit: only failures are reported */
+    if (session_commit_interlocked(s)) {
+        free(held);
+        return 1;
+    }
+    struct relayctl_command commit = { .cmd = RELAYCTL_CMD_COMMIT };
+    rc = session_run(s, session_all_boards(s), &commit);
+    s->in_txn = 0;
+    for (int b = 0; b < s->nboards; b++) {
+        if (s->boards[b].reply.status != USBRELAY_OK) {
+            reply_print_text(stdout, &s->boards[b], s->nboards > 1);
+        }
+    }
+    if (rc == 0 && held) {
+        fwrite(held, 1, held_len, stdout);
+    }
+    free(held);
+    return rc;
+}
+
+/*
+ * Buffered line reader for the REPL. stdin is read in large chunks and
+ * each line is handed out in place (newline replaced by NUL), so a piped
+ * command stream costs one read() per buffer rather than per line.
+ */
+struct relayctl_reader {
+    int fd;
+    size_t start;       /* first unconsumed byte */
+    size_t end;         /* one past the last buffered byte */
+    int eof;
+    int discard;        /* skipping the rest of an over-long line */
+    char buf[4096];
+};
+
+static void reader_init(struct relayctl_reader *r, int fd) {
+    r->fd = fd;
+    r->start = 0;
+    r->end = 0;
+    r->eof = 0;
+    r->discard = 0;
+}
+
+/* Move unconsumed bytes to the front and read more; sets eof on EOF/error */
+static void reader_fill(struct relayctl_reader *r) {
+    size_t avail = r->end - r->start;
+
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, avail);
+        r->start = 0;
+        r->end = avail;
+    }
+
+    /* About to block: let queued responses out first */
+    fflush(stdout);
+
+    for (;;) {
+        ssize_t n = read(r->fd, r->buf + r->end, sizeof(r->buf) - 1 - r->end);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            r->eof = 1;
+        } else {
+            r->end += (size_t)n;
+        }
+        return;
+    }
+}
+
+/* Next input line, or NULL at EOF. Over-long lines are dropped and
+ * reported through *too_long. */
+static char *reader_next_line(struct relayctl_reader *r, int *too_long) {
+    *too_long = 0;
+    for (;;) {
+        char *base = r->buf + r->start;
+        size_t avail = r->end - r->start;
+        char *nl = memchr(base, '\n', avail);
+
+        if (nl) {
+            *nl = '\0';
+            r->start += (size_t)(nl - base) + 1;
+            if (r->discard || (size_t)(nl - base) >= USBRELAY_MAX_LINE_LEN) {
+                r->discard = 0;
+                *too_long = 1;
+            }
+            return base;
+        }
+
+        if (r->eof) {
+            if (avail == 0) {
+                return NULL;
+            }
+            /* Final line without a trailing newline */
+            r->buf[r->end] = '\0';
+            r->start = r->end;
+            if (r->discard || avail >= USBRELAY_MAX_LINE_LEN) {
+                r->discard = 0;
+                *too_long = 1;
+            }
+            return base;
+        }
+
+        if (avail >= USBRELAY_MAX_LINE_LEN) {
+            /* No newline in sight: drop what we have and skip to the next one */
+            r->discard = 1;
+            r->start = r->end = 0;
+        }
+        reader_fill(r);
+    }
+}
+
+/* Would cmd touch a transaction another client has open on ctx? */
+static int binary_foreign_txn(const struct relay_session *s, const struct relay_context *ctx,
+                              const struct relayctl_command *cmd) {
+    if (!relay_in_batch(ctx->dev) || s->txn_client[ctx->board] == s->client) {
+        return 0;
+    }
+    switch (cmd->cmd) {
+    case RELAYCTL_CMD_SET:
+    case RELAYCTL_CMD_TOGGLE:
+    case RELAYCTL_CMD_WRITE_MASK:
+    case RELAYCTL_CMD_RESET:
+    case RELAYCTL_CMD_BEGIN:
+    case RELAYCTL_CMD_COMMIT:
+    case RELAYCTL_CMD_ABORT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Map one binary request onto a parsed command, run it on the board the
+ * frame addresses and fill in the response frame. Returns the handler's
+ * status (0 on success). */
+static int binary_exec(struct relay_session *s, const struct usbrelay_frame *req,
+                       struct usbrelay_frame *resp) {
+    struct relay_context *ctx = &s->boards[req->board < s->nboards ? req->board : 0];
+    struct relayctl_command cmd;
+    int rc = 0;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.channel = req->channel;
+    cmd.mask = req->arg;
+    cmd.state = req->arg ? RELAYCTL_STATE_ON : RELAYCTL_STATE_OFF;
+
+    switch (req->op) {
+    case USBRELAY_OP_SET:        cmd.cmd = RELAYCTL_CMD_SET;        break;
+    case USBRELAY_OP_GET:        cmd.cmd = RELAYCTL_CMD_GET;        break;
+    case USBRELAY_OP_GETALL:     cmd.cmd = RELAYCTL_CMD_GETALL;     break;
+    case USBRELAY_OP_TOGGLE:     cmd.cmd = RELAYCTL_CMD_TOGGLE;     break;
+    case USBRELAY_OP_WRITE_MASK: cmd.cmd = RELAYCTL_CMD_WRITE_MASK; break;
+    case USBRELAY_OP_READ_MASK:  cmd.cmd = RELAYCTL_CMD_READ_MASK;  break;
+    case USBRELAY_OP_RESET:      cmd.cmd = RELAYCTL_CMD_RESET;      break;
+    case USBRELAY_OP_PING:       cmd.cmd = RELAYCTL_CMD_PING;       break;
+    case USBRELAY_OP_VERSION:    cmd.cmd = RELAYCTL_CMD_VERSION;    break;
+    case USBRELAY_OP_BEGIN:      cmd.cmd = RELAYCTL_CMD_BEGIN;      break;
+    case USBRELAY_OP_COMMIT:     cmd.cmd = RELAYCTL_CMD_COMMIT;     break;
+    case USBRELAY_OP_ABORT:      cmd.cmd = RELAYCTL_CMD_ABORT;      break;
+    case USBRELAY_OP_TEXT:
+    case USBRELAY_OP_QUIT:       cmd.cmd = RELAYCTL_CMD_NONE;       break;
+    default:
+        reply_reset(ctx);
+        rc = reply_error(ctx, USBRELAY_ERR_BAD_COMMAND, "Unknown opcode");
+        break;
+    }
+
+    if (rc == 0 && req->board >= s->nboards) {
+        reply_reset(ctx);
+        rc = reply_error(ctx, USBRELAY_ERR_BAD_BOARD, "No such board");
+    } else if (rc == 0 && req->op == USBRELAY_OP_SET && req->arg > 1) {
+        reply_reset(ctx);
+        rc = reply_error(ctx, USBRELAY_ERR_BAD_STATE, "State must be ON or OFF");
+    } else if (rc == 0 && binary_foreign_txn(s, ctx, &cmd)) {
+        reply_reset(ctx);
+        rc = reply_error(ctx, USBRELAY_ERR_BAD_STATE, "Board is in another client's transaction");
+    } else if (rc == 0 && cmd.cmd != RELAYCTL_CMD_NONE) {
+        /* Binary transactions are per board: the frame names one */
+        int64_t t_ns = s->log ? monotonic_ns() : 0;
+        rc = relay_run_command(ctx, &cmd);
+        session_record(s, ctx, &cmd, t_ns);
+        if (cmd.cmd == RELAYCTL_CMD_BEGIN && rc == 0) {
+            s->txn_client[ctx->board] = s->client;
+        }
+    } else if (rc == 0) {
+        reply_reset(ctx);
+    }
+
+    relayctl_metrics_command(cmd.cmd, rc != 0);
+    relayctl_metrics_error(ctx->reply.status);
+
+    resp->op = req->op;
+    resp->status = (uint8_t)ctx->reply.status;
+    resp->seq = req->seq;
+    resp->channel = req->channel;
+    resp->arg = 0;
+    resp->mask = relay_current_mask(ctx);
+    resp->board = req->board;
+    if (ctx->reply.status == USBRELAY_OK) {
+        if (ctx->reply.kind == RELAY_REPLY_STATE) {
+            resp->arg = (uint8_t)ctx->reply.state;
+        } else if (ctx->reply.kind == RELAY_REPLY_VERSION) {
+            resp->arg = USBRELAY_PROTO_BIN_VERSION;
+        }
+    }
+    return rc;
+}
+
+/* Write out queued response frames with a single write() */
+static int binary_flush(struct usbrelay_frame *out, size_t *nout) {
+    const char *p = (const char *)out;
+    size_t left = *nout * sizeof(*out);
+
+    *nout = 0;
+    while (left > 0) {
+        ssize_t n = write(STDOUT_FILENO, p, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Binary session, entered with the BINARY command. Every complete frame
+ * already buffered is executed before the responses go out in one
+ * write(), so a client can pipeline many commands per syscall.
+ * Returns 0 to resume the text protocol (OP_TEXT) or RELAYCTL_RC_QUIT.
+ */
+static int run_binary_session(struct relay_session *s, struct relayctl_reader *r,
+                              int *exit_status) {
+    static struct usbrelay_frame out[256];
+    size_t nout = 0;
+
+    fflush(stdout);
+    for (;;) {
+        while (r->end - r->start >= USBRELAY_FRAME_SIZE) {
+            struct usbrelay_frame req;
+
+            memcpy(&req, r->buf + r->start, sizeof(req));
+            r->start += sizeof(req);
+            if (binary_exec(s, &req, &out[nout++]) != 0) {
+                *exit_status = 1;
+            }
+
+            if (req.op == USBRELAY_OP_TEXT || req.op == USBRELAY_OP_QUIT) {
+                if (binary_flush(out, &nout) != 0) {
+                    return RELAYCTL_RC_QUIT;
+                }
+                return req.op == USBRELAY_OP_TEXT ? 0 : RELAYCTL_RC_QUIT;
+            }
+            if (nout == sizeof(out) / sizeof(out[0]) && binary_flush(out, &nout) != 0) {
+                return RELAYCTL_RC_QUIT;
+            }
+        }
+
+        if (nout > 0 && binary_flush(out, &nout) != 0) {
+            return RELAYCTL_RC_QUIT;
+        }
+        if (r->eof) {
+            return RELAYCTL_RC_QUIT;
+        }
+        reader_fill(r);
+    }
+}
+
+/* A line (or part of one) is buffered or arrived during WATCH: end it,
+ * unless stdin is at EOF, in which case keep watching until a signal */
+static int repl_watch_input(void *arg, int readable) {
+    struct relayctl_reader *r = arg;
+
+    if (readable) {
+        reader_fill(r);
+    }
+    if (r->end > r->start) {
+        return 1;
+    }
+    return readable && r->eof ? -1 : 0;
+}
+
+static int run_interactive(struct relay_session *s) {
+    static struct relayctl_reader reader;
+    int exit_status = 0;
+
+    reader_init(&reader, STDIN_FILENO);
+    s->watch_input = repl_watch_input;
+    s->watch_input_arg = &reader;
+    s->watch_input_fd = STDIN_FILENO;
+    print_help(stdout);
+    for (;;) {
+        if (s->verbose) {
+            fputs("> ", stdout);
+            fflush(stdout);
+        }
+
+        /* Read one line from stdin; EOF -> exit loop */
+        int too_long;
+        char *p = reader_next_line(&reader, &too_long);
+        if (!p) {
+            break;
+        }
+        if (too_long) {
+            relayctl_metrics_error(USBRELAY_ERR_BAD_COMMAND);
+            fprintf(stderr, "ERR BAD_COMMAND Line too long\n");
+            exit_status = 1;
+            continue;
+        }
+
+        int rc;
+        if (strchr(p, ';')) {
+            rc = run_compound_line(s, p);
+        } else {
+            rc = run_interactive_command(s, p);
+        }
+        if (rc == RELAYCTL_RC_BINARY) {
+            rc = run_binary_session(s, &reader, &exit_status);
+        }
+        if (rc == RELAYCTL_RC_QUIT) {
+            break;
+        }
+        if (rc != 0) {
+            exit_status = rc;
+        }
+        /* Input drained: report failures of queued writes before blocking */
+        if (reader.start == reader.end && session_flush(s) != 0) {
+            exit_status = 1;
+        }
+    }
+
+    int open_txn = 0;
+    for (int b = 0; b < s->nboards; b++) {
+        if (relay_in_batch(s->boards[b].dev)) {
+            relay_abort(s->boards[b].dev);
+            open_txn = 1;
+        }
+    }
+    if (open_txn) {
+        fprintf(stderr,
+                "ERR BAD_COMMAND Transaction not committed; changes discarded\n");
+        exit_status = 1;
+    }
+
+    unsigned long hits = 0, reads = 0;
+    for (int b = 0; b < s->nboards; b++) {
+        unsigned long h, r;
+        relay_stats(s->boards[b].dev, &h, &r);
+        hits += h;
+        reads += r;
+    }
+    if (s->boards[0].cached && s->verbose) {
+        fprintf(stderr, "relayctl: cache hits=%lu device reads=%lu\n", hits, reads);
+    }
     return exit_status;
 }
 
+/* ---- scheduler mode (-S) ---- */
+
+static volatile sig_atomic_t sched_stop;
+
+static void sched_on_signal(int sig) {
+    (void)sig;
+    sched_stop = 1;
+}
+
+/* Run one scheduled action like a REPL line, then wait for the write to
+ * reach the board so EXEC_US covers the whole action */
+static int sched_fire_line(void *arg, char *line) {
+    struct relay_session *s = arg;
+    int rc;
+
+    if (strchr(line, ';')) {
+        rc = run_compound_line(s, line);
+    } else {
+        rc = run_interactive_command(s, line);
+    }
+    if (session_flush(s) != 0) {
+        rc = 1;
+    }
+    return rc;
+}
+
+static int run_schedule(struct relay_session *s, struct relayctl_sched *sched, int rt_prio) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sched_on_signal;    /* no SA_RESTART: wake the timer read */
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (rt_prio && relayctl_sched_realtime(rt_prio) != 0) {
+        fprintf(stderr, "ERR INTERNAL_ERROR Cannot enable SCHED_FIFO/mlockall (errno=%d)\n",
+                errno);
+        return 1;
+    }
+    return relayctl_sched_run(sched, sched_fire_line, s, &sched_stop);
+}
+
+/* Replay a -r log against the session's boards, pacing the commands by
+ * their recorded gaps divided by speed (0 = no pacing). Pacing restarts
+ * at the first record of each recording run instead of waiting out the
+ * time between runs. */
+static int run_replay(struct relay_session *s, const char *path, double speed) {
+    struct relayctl_log log = { .fd = -1 };
+    uint64_t first, count, failed = 0, diverged = 0, paced = 0;
+    int64_t late_sum = 0, late_max = 0;
+    int rc = 0;
+
+    if (relayctl_log_open_read(&log, path) != 0) {
+        fprintf(stderr, "ERR BAD_COMMAND Cannot read log %s (errno=%d)\n", path, errno);
+        return 1;
+    }
+    relayctl_log_span(&log, &first, &count);
+
+    int64_t start = monotonic_ns();
+    int64_t due = start;
+    for (uint64_t i = 0; i < count; i++) {
+        const struct relayctl_log_rec *rec = &log.recs[(first + i) % log.hdr->capacity];
+        struct usbrelay_frame req, resp;
+
+        if (rec->flags & RELAYCTL_LOG_F_SESSION) {
+            due = monotonic_ns();
+        } else if (i > 0 && speed > 0.0) {
+            const struct relayctl_log_rec *prev =
+                &log.recs[(first + i - 1) % log.hdr->capacity];
+            int64_t gap = rec->t_ns - prev->t_ns;
+            struct timespec ts;
+
+            due += gap > 0 ? (int64_t)((double)gap / speed) : 0;
+            ts.tv_sec = due / 1000000000LL;
+            ts.tv_nsec = due % 1000000000LL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+            }
+
+            int64_t late = monotonic_ns() - due;
+            late_sum += late;
+            paced++;
+            if (late > late_max) {
+                late_max = late;
+            }
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.op = rec->op;
+        req.seq = (uint16_t)i;     /* wraps after 65536 records, like a client's */
+        req.board = rec->board;
+        req.channel = rec->channel;
+        req.arg = rec->arg;
+        if (binary_exec(s, &req, &resp) != 0) {
+            failed++;
+        }
+        if (resp.status != rec->status || resp.mask != rec->mask) {
+            diverged++;
+            if (s->verbose) {
+                fprintf(stderr, "REPLAY %" PRIu64 " BOARD=%u OP=0x%02x STATUS=%u/%u MASK=0x%02x/0x%02x\n",
+                        i, rec->board, rec->op, resp.status, rec->status, resp.mask, rec->mask);
+            }
+        }
+    }
+    if (session_flush(s) != 0) {
+        rc = 1;
+    }
+
+    double elapsed = (double)(monotonic_ns() - start) / 1e9;
+    printf("OK REPLAY RECORDS=%" PRIu64 " FAILED=%" PRIu64 " DIVERGED=%" PRIu64
+           " ELAPSED_S=%.6f OPS_PER_S=%.0f LATE_US_AVG=%" PRId64 " LATE_US_MAX=%" PRId64 "\n",
+           count, failed, diverged, elapsed, elapsed > 0.0 ? (double)count / elapsed : 0.0,
+           paced ? late_sum / (int64_t)paced / 1000 : 0, late_max / 1000);
+    relayctl_log_close(&log);
+    return diverged ? 1 : rc;
+}
+
+/* ---- ring server mode (-Q) ---- */
+
+static volatile sig_atomic_t ring_stop;
+
+static void ring_on_signal(int sig) {
+    (void)sig;
+    ring_stop = 1;
+}
+
+static void ring_exec(void *arg, int client, const struct usbrelay_frame *req,
+                      struct usbrelay_frame *resp) {
+    struct relay_session *s = arg;
+
+    s->client = client;
+    binary_exec(s, req, resp);
+}
+
+/* A ring client has gone: drop the transactions it left open */
+static void ring_closed(void *arg, int client) {
+    struct relay_session *s = arg;
+
+    for (int b = 0; b < s->nboards; b++) {
+        if (relay_in_batch(s->boards[b].dev) && s->txn_client[b] == client) {
+            relay_abort(s->boards[b].dev);
+        }
+    }
+}
+
+/* Serve binary frames from shared-memory rings until SIGINT/SIGTERM */
+static int run_ring_server(struct relay_session *s, const char *name, int nclients,
+                           int rt_prio) {
+    struct relay_ring *ring;
+    struct relay_ring_stats st;
+    struct sigaction sa;
+
+    if (relay_ring_create(&ring, name, nclients) != 0) {
+        fprintf(stderr, "ERR %s Cannot create ring %s (errno=%d)\n",
+                errno == EEXIST ? "BAD_STATE" : "INTERNAL_ERROR", name, errno);
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ring_on_signal;     /* no SA_RESTART: wake the futex wait */
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (rt_prio && relayctl_sched_realtime(rt_prio) != 0) {
+        fprintf(stderr, "ERR INTERNAL_ERROR Cannot enable SCHED_FIFO/mlockall (errno=%d)\n",
+                errno);
+        relay_ring_destroy(ring);
+        return 1;
+    }
+
+    printf("OK RING NAME=%s%s CLIENTS=%d\n", name[0] == '/' ? "" : "/", name, nclients);
+    fflush(stdout);
+    relay_ring_serve(ring, ring_exec, ring_closed, s, RELAY_RING_SPIN_US, &ring_stop, &st);
+    relay_ring_destroy(ring);
+
+    printf("OK RING FRAMES=%lu CLIENTS=%lu SLEEPS=%lu\n", st.frames, st.clients, st.sleeps);
+    return 0;
+}
+
+static int session_close(struct relay_session *s) {
+    int rc = session_flush(s);
+
+    /* Final export before the boards go away */
+    if (relayctl_metrics_export_stop() != 0) {
+        rc = 1;
+    }
+
+    for (int b = 0; b < s->nboards; b++) {
+        relay_close_device(&s->boards[b]);
+    }
+    if (s->log) {
+        relayctl_log_close(s->log);
+        s->log = NULL;
+    }
+    return rc;
+}
+
 int main(int argc, char **argv) {
     struct relayctl_args args;
-    struct relay_context ctx;
+    static struct relay_session session;
+    struct relay_session *s = &session;
     int ret = 0;
 
+    relayctl_metrics_init();
+
     /* 1. Parse command-line arguments */
     ret = parse_args(argc, argv, &args);
     if (ret != 0) {
         return ret;
     }
 
-    /* 2. Handle commands that do not require device access */
-    if (args.cmd == RELAYCTL_CMD_HELP) {
-        return handle_help();
+    /* 2. Initialize one context per board from parsed arguments */
+    s->nboards = args.ndevs;
+    s->verbose = args.verbose;
+    s->out = stdout;
+    for (int b = 0; b < s->nboards; b++) {
+        relay_context_init(&s->boards[b], &args, b);
+    }
+    for (int g = 0; g < args.ngroups; g++) {
+        if (session_add_group(s, args.group_defs[g]) != 0) {
+            return 1;
+        }
     }
 
-    if (args.cmd == RELAYCTL_CMD_VERSION) {
-        return handle_version();
+    /* 3. Handle commands that do not require device access */
+    if (args.command.cmd == RELAYCTL_CMD_HELP ||
+        args.command.cmd == RELAYCTL_CMD_VERSION) {
+        ret = relay_run_command(&s->boards[0], &args.command);
+        reply_print_text(stdout, &s->boards[0], 0);
+        return ret;
     }
 
-    /* 3. Initialize context from parsed arguments */
-    relay_context_init(&ctx, &args);
+    /* 4. Load the scenes (-C) and schedule (-S) before touching any device */
+    static struct relayctl_scenes scenes;
+    relayctl_scenes_init(&scenes);
+    if (args.scene_path) {
+        FILE *in = fopen(args.scene_path, "r");
+        if (!in) {
+            fprintf(stderr, "ERR BAD_COMMAND Cannot open scenes %s (errno=%d)\n",
+                    args.scene_path, errno);
+            return 1;
+        }
+        ret = relayctl_scenes_load(&scenes, in, args.scene_path);
+        fclose(in);
+        if (ret != 0) {
+            return ret;
+        }
+        s->scenes = &scenes;
+    }
 
-    /* 4. Open the relay device for all other commands */
-    if (relay_open_device(&ctx) != 0) {
-        return 2; /* device-related error code */
+    static struct relayctl_interlocks interlocks;
+    relayctl_interlocks_init(&interlocks);
+    if (args.interlock_path) {
+        FILE *in = fopen(args.interlock_path, "r");
+        if (!in) {
+            fprintf(stderr, "ERR BAD_COMMAND Cannot open interlock rules %s (errno=%d)\n",
+                    args.interlock_path, errno);
+            return 1;
+        }
+        ret = relayctl_interlocks_load(&interlocks, in, args.interlock_path);
+        fclose(in);
+        if (ret != 0) {
+            return ret;
+        }
+        if (interlocks.boards & ~session_all_boards(s)) {
+            fprintf(stderr, "ERR BAD_BOARD Interlock rules use more boards than -d gave\n");
+            return 1;
+        }
+        for (int b = 0; b < s->nboards; b++) {
+            if (interlocks.boards & (1U << b)) {
+                s->boards[b].interlock = &interlocks.table[b];
+            }
+        }
+    }
+
+    struct relayctl_sched sched;
+    relayctl_sched_init(&sched);
+    if (args.sched_path) {
+        FILE *in = strcmp(args.sched_path, "-") == 0 ? stdin : fopen(args.sched_path, "r");
+        if (!in) {
+            fprintf(stderr, "ERR BAD_COMMAND Cannot open schedule %s (errno=%d)\n",
+                    args.sched_path, errno);
+            return 1;
+        }
+        ret = relayctl_sched_load(&sched, in, args.sched_path);
+        if (in != stdin) {
+            fclose(in);
+        }
+        if (ret != 0) {
+            relayctl_sched_free(&sched);
+            return ret;
+        }
+    }
+
+    /* 5. Open every relay device for all other commands */
+    for (int b = 0; b < s->nboards; b++) {
+        if (relay_open_device(&s->boards[b]) != 0) {
+            session_close(s);
+            relayctl_sched_free(&sched);
+            return 2; /* device-related error code */
+        }
+    }
+    if (args.metrics) {
+        struct relayctl_metrics_board mb[RELAYCTL_MAX_BOARDS];
+        if (relayctl_metrics_export_start(args.metrics, mb, session_metrics_boards(s, mb),
+                                          1000) != 0) {
+            session_close(s);
+            relayctl_sched_free(&sched);
+            return 1;
+        }
+    }
+
+    static struct relayctl_log record_log = { .fd = -1 };
+    if (args.record_path) {
+        if (relayctl_log_open_append(&record_log, args.record_path, args.record_size) != 0) {
+            fprintf(stderr, "ERR BAD_COMMAND Cannot open log %s (errno=%d)\n",
+                    args.record_path, errno);
+            session_close(s);
+            relayctl_sched_free(&sched);
+            return 1;
+        }
+        s->log = &record_log;
+    }
+
+    /* 6. Replay, ring server or scheduler mode, if requested */
+    if (args.replay_path) {
+        ret = run_replay(s, args.replay_path, args.replay_speed);
+        if (session_close(s) != 0 && ret == 0) {
+            ret = 1;
+        }
+        return ret;
+    }
+
+    if (args.ring_name) {
+        ret = run_ring_server(s, args.ring_name, args.ring_clients, args.rt_prio);
+        if (session_close(s) != 0 && ret == 0) {
+            ret = 1;
+        }
+        return ret;
     }
 
-    /* 5. Interactive (REPL) mode, if requested */
+    if (args.sched_path) {
+        ret = run_schedule(s, &sched, args.rt_prio);
+        relayctl_sched_free(&sched);
+        if (session_close(s) != 0 && ret == 0) {
+            ret = 1;
+        }
+        return ret;
+    }
+
+    /* 7. Interactive (REPL) mode, if requested */
     if (args.interactive) {
-        ret = run_interactive(&ctx);
-        relay_close_device(&ctx);
+        ret = run_interactive(s);
+        if (session_close(s) != 0 && ret == 0) {
+            ret = 1;
+        }
         return ret;
     }
 
-    /* 6. One-shot command dispatch */
-    switch (args.cmd) {
-    case RELAYCTL_CMD_SET:
-        ret = handle_set(&ctx, &args);
-        break;
-    case RELAYCTL_CMD_GET:
-        ret = handle_get(&ctx, &args);
-        break;
-    case RELAYCTL_CMD_GETALL:
-        ret = handle_getall(&ctx);
-        break;
-    case RELAYCTL_CMD_TOGGLE:
-        ret = handle_toggle(&ctx, &args);
-        break;
-    case RELAYCTL_CMD_WRITE_MASK:
-        ret = handle_write_mask(&ctx, &args);
-        break;
-    case RELAYCTL_CMD_READ_MASK:
-        ret = handle_read_mask(&ctx);
-        break;
-    case RELAYCTL_CMD_RESET:
-        ret = handle_reset(&ctx);
-        break;
-    case RELAYCTL_CMD_PING:
-        ret = handle_ping(&ctx);
+    /* 8. One-shot command dispatch */
+    switch (args.command.cmd) {
+    case RELAYCTL_CMD_BEGIN:
+    case RELAYCTL_CMD_COMMIT:
+    case RELAYCTL_CMD_ABORT:
+    case RELAYCTL_CMD_QUIT:
+    case RELAYCTL_CMD_BINARY:
+        fprintf(stderr,
+                "ERR BAD_COMMAND %s requires interactive mode (-i)\n",
+                relayctl_cmd_name(args.command.cmd));
+        ret = 1;
         break;
-
-    /* HELP / VERSION already handled above; NONE is a bug */
-    case RELAYCTL_CMD_HELP:
-    case RELAYCTL_CMD_VERSION:
-    case RELAYCTL_CMD_NONE:
     default:
-        fprintf(stderr,
-                "ERR INTERNAL_ERROR Unknown or unsupported command in main\n");
-        ret = 3;
+        ret = session_run_text(s, &args.command);
         break;
     }
 
-    /* 7. Clean up and exit */
-    relay_close_device(&ctx);
+    /* 9. Clean up and exit (waits for queued writes) */
+    if (session_close(s) != 0 && ret == 0) {
+        ret = 1;
+    }
     return ret;
 }
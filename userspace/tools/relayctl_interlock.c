@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../include/usbrelay.h"
+#include "relayctl_interlock.h"
+
+#define INTERLOCK_MAX_ITEMS     (USBRELAY_NUM_CHANNELS + 1)
+
+enum interlock_kind {
+    INTERLOCK_EXCLUSIVE,
+    INTERLOCK_REQUIRE
+};
+
+/* Clear the bit of every mask the rule forbids. first is the dependent
+ * channel of a REQUIRE rule; others holds the remaining channels. */
+static void interlock_compile(struct relay_interlock *t, enum interlock_kind kind,
+                              uint8_t first, uint8_t others) {
+    for (unsigned int m = 0; m < (1U << USBRELAY_NUM_CHANNELS); m++) {
+        unsigned int on = m & (first | others);
+        int forbidden;
+
+        if (kind == INTERLOCK_EXCLUSIVE) {
+            forbidden = (on & (on - 1)) != 0;       /* two or more ON */
+        } else {
+            forbidden = (m & first) && (m & others) != others;
+        }
+        if (forbidden) {
+            t->allowed[m >> 5] &= ~(1U << (m & 31));
+        }
+    }
+}
+
+void relayctl_interlocks_init(struct relayctl_interlocks *il) {
+    memset(il, 0, sizeof(*il));
+    memset(il->table, 0xFF, sizeof(il->table));
+}
+
+int relayctl_interlocks_load(struct relayctl_interlocks *il, FILE *in, const char *name) {
+    char line[USBRELAY_MAX_LINE_LEN];
+    int lineno = 0;
+    int rc = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+
+        char *tok[INTERLOCK_MAX_ITEMS + 1];
+        int ntok = 0;
+        char *save;
+        for (char *p = strtok_r(line, " \t\r\n", &save); p;
+             p = strtok_r(NULL, " \t\r\n", &save)) {
+            if (ntok == INTERLOCK_MAX_ITEMS + 1) {
+                ntok++;
+                break;
+            }
+            tok[ntok++] = p;
+        }
+        if (ntok == 0) {
+            continue;
+        }
+
+        enum interlock_kind kind;
+        if (strcasecmp(tok[0], "exclusive") == 0) {
+            kind = INTERLOCK_EXCLUSIVE;
+        } else if (strcasecmp(tok[0], "require") == 0) {
+            kind = INTERLOCK_REQUIRE;
+        } else {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND",
+                                        "Expected EXCLUSIVE or REQUIRE:", tok[0]);
+            continue;
+        }
+        if (ntok < 3 || ntok > INTERLOCK_MAX_ITEMS + 1) {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND",
+                                        kind == INTERLOCK_EXCLUSIVE ?
+                                        "Expected EXCLUSIVE <ch> <ch> ..." :
+                                        "Expected REQUIRE <ch> <ch> ...", NULL);
+            continue;
+        }
+
+        int board = -1;
+        uint8_t first = 0, others = 0;
+        const char *err = NULL;
+        const char *bad = NULL;
+        for (int i = 1; i < ntok && !err; i++) {
+            int b, ch;
+
+            bad = tok[i];
+            err = relayctl_parse_board_channel(tok[i], &b, &ch);
+            if (err) {
+                break;
+            }
+            uint8_t bit = (uint8_t)USBRELAY_CH_TO_BIT(ch);
+            if (board >= 0 && b != board) {
+                err = "Channels of one rule must be on one board:";
+            } else if ((first | others) & bit) {
+                err = "Channel listed twice:";
+            } else if (i == 1 && kind == INTERLOCK_REQUIRE) {
+                first = bit;
+            } else {
+                others |= bit;
+            }
+            board = b;
+        }
+        if (err) {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND", err, bad);
+            continue;
+        }
+
+        interlock_compile(&il->table[board], kind, first, others);
+        il->boards |= 1U << board;
+        il->nrules++;
+    }
+    return rc;
+}
@@ -0,0 +1,42 @@
+#ifndef RELAYCTL_INTERLOCK_H
+#define RELAYCTL_INTERLOCK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../include/relay.h"
+#include "relayctl_parse.h"
+
+/*
+ * Interlock rules for relayctl -L. A rule file holds lines
+ *
+ *     EXCLUSIVE <[board:]ch> <[board:]ch> {<[board:]ch>}
+ *     REQUIRE <[board:]ch> <[board:]ch> {<[board:]ch>}
+ *
+ * ('#' starts a comment). EXCLUSIVE: at most one of the channels may be
+ * ON. REQUIRE: the first channel may only be ON while every other one
+ * is ON. All channels of a rule belong to one board; unqualified
+ * channels belong to board 0.
+ *
+ * Rules are compiled when loaded into one struct relay_interlock per
+ * board, a bitmap over all 16 masks, so checking a write costs one bit
+ * test whatever the number of rules. All OFF satisfies every rule.
+ */
+
+#define RELAYCTL_INTERLOCK_MAX_BOARDS   RELAYCTL_CONFIG_MAX_BOARDS
+
+struct relayctl_interlocks {
+    uint32_t               boards;      /* bit n -> board n has rules */
+    int                    nrules;
+    struct relay_interlock table[RELAYCTL_INTERLOCK_MAX_BOARDS];
+};
+
+/* No rules: every mask allowed on every board */
+void relayctl_interlocks_init(struct relayctl_interlocks *il);
+
+/* Read and compile a rule file. Errors are printed as protocol ERR
+ * lines with the offending line number; returns nonzero if any line was
+ * rejected. */
+int relayctl_interlocks_load(struct relayctl_interlocks *il, FILE *in, const char *name);
+
+#endif /* RELAYCTL_INTERLOCK_H */
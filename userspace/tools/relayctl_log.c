@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "relayctl_log.h"
+
+_Static_assert(sizeof(struct relayctl_log_header) == 64, "log header must stay 64 bytes");
+_Static_assert(sizeof(struct relayctl_log_rec) == 16, "log record must stay 16 bytes");
+_Static_assert(RELAYCTL_LOG_MAX_RECORDS <=
+               (SIZE_MAX - sizeof(struct relayctl_log_header)) / sizeof(struct relayctl_log_rec),
+               "largest log must fit in size_t");
+
+static int log_header_valid(const struct relayctl_log_header *h, size_t file_len) {
+    return memcmp(h->magic, RELAYCTL_LOG_MAGIC, sizeof(RELAYCTL_LOG_MAGIC)) == 0 &&
+           h->version == RELAYCTL_LOG_VERSION &&
+           h->rec_size == sizeof(struct relayctl_log_rec) &&
+           h->capacity > 0 &&
+           h->capacity <= (file_len - sizeof(*h)) / sizeof(struct relayctl_log_rec);
+}
+
+static int log_map(struct relayctl_log *log, size_t len, int writable) {
+    void *p = mmap(NULL, len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, log->fd, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    log->hdr = p;
+    log->recs = (struct relayctl_log_rec *)(log->hdr + 1);
+    log->map_len = len;
+    return 0;
+}
+
+static int log_fail(struct relayctl_log *log, int err) {
+    relayctl_log_close(log);
+    errno = err;
+    return -1;
+}
+
+int relayctl_log_open_append(struct relayctl_log *log, const char *path, uint64_t capacity) {
+    struct stat st;
+
+    memset(log, 0, sizeof(*log));
+    log->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (log->fd < 0 || fstat(log->fd, &st) != 0) {
+        return log_fail(log, errno);
+    }
+
+    /* Keep appending to an existing log, whatever its capacity */
+    if ((size_t)st.st_size > sizeof(struct relayctl_log_header)) {
+        if (log_map(log, (size_t)st.st_size, 1) != 0) {
+            return log_fail(log, errno);
+        }
+        if (log_header_valid(log->hdr, (size_t)st.st_size)) {
+            log->session_start = 1;
+            return 0;
+        }
+        return log_fail(log, EINVAL);       /* not ours: do not clobber it */
+    } else if (st.st_size != 0) {
+        return log_fail(log, EINVAL);
+    }
+    if (capacity == 0 || capacity > RELAYCTL_LOG_MAX_RECORDS) {
+        return log_fail(log, EINVAL);       /* the file size would overflow */
+    }
+
+    size_t len = sizeof(struct relayctl_log_header) + capacity * sizeof(struct relayctl_log_rec);
+    if (ftruncate(log->fd, (off_t)len) != 0 || log_map(log, len, 1) != 0) {
+        return log_fail(log, errno);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(log->hdr->magic, RELAYCTL_LOG_MAGIC, sizeof(RELAYCTL_LOG_MAGIC));
+    log->hdr->version = RELAYCTL_LOG_VERSION;
+    log->hdr->rec_size = sizeof(struct relayctl_log_rec);
+    log->hdr->capacity = capacity;
+    log->hdr->created_real_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+    atomic_store_explicit(&log->hdr->head, 0, memory_order_release);
+    log->session_start = 1;
+    return 0;
+}
+
+int relayctl_log_open_read(struct relayctl_log *log, const char *path) {
+    struct stat st;
+
+    memset(log, 0, sizeof(*log));
+    log->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (log->fd < 0 || fstat(log->fd, &st) != 0) {
+        return log_fail(log, errno);
+    }
+    if ((size_t)st.st_size <= sizeof(struct relayctl_log_header)) {
+        return log_fail(log, EINVAL);
+    }
+    if (log_map(log, (size_t)st.st_size, 0) != 0) {
+        return log_fail(log, errno);
+    }
+    if (!log_header_valid(log->hdr, (size_t)st.st_size)) {
+        return log_fail(log, EINVAL);
+    }
+    return 0;
+}
+
+void relayctl_log_append(struct relayctl_log *log, const struct relayctl_log_rec *rec) {
+    uint64_t slot = atomic_fetch_add_explicit(&log->hdr->head, 1, memory_order_acq_rel);
+    struct relayctl_log_rec *r = &log->recs[slot % log->hdr->capacity];
+
+    *r = *rec;
+    if (log->session_start) {
+        r->flags |= RELAYCTL_LOG_F_SESSION;
+        log->session_start = 0;
+    }
+}
+
+void relayctl_log_span(const struct relayctl_log *log, uint64_t *first, uint64_t *count) {
+    uint64_t head = atomic_load_explicit(&log->hdr->head, memory_order_acquire);
+    uint64_t cap = log->hdr->capacity;
+
+    if (head <= cap) {
+        *first = 0;
+        *count = head;
+    } else {
+        *first = head % cap;
+        *count = cap;
+    }
+}
+
+void relayctl_log_close(struct relayctl_log *log) {
+    if (log->hdr) {
+        munmap(log->hdr, log->map_len);
+    }
+    if (log->fd >= 0) {
+        close(log->fd);
+    }
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+}
@@ -0,0 +1,77 @@
+#ifndef RELAYCTL_LOG_H
+#define RELAYCTL_LOG_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Command log for relayctl -r (record) and -P (replay).
+ *
+ * The file is a fixed-size ring mapped with mmap(MAP_SHARED): a 64-byte
+ * header followed by "capacity" 16-byte records. Writers reserve a slot
+ * with an atomic increment of head and fill it in place, so appending
+ * costs no system call and the records survive a crash of relayctl.
+ * Once more than capacity records have been written the oldest are
+ * overwritten. All fields are in host byte order.
+ *
+ * Records reuse the binary protocol opcodes (USBRELAY_OP_*, PROTOCOL.md
+ * section 1.4), so a replay is a stream of binary frames. Several
+ * relayctl runs can append to one log; the first record of each run
+ * carries RELAYCTL_LOG_F_SESSION, so the idle time between runs is not
+ * mistaken for a gap between commands.
+ */
+
+#define RELAYCTL_LOG_MAGIC      "RLYLOG1"
+#define RELAYCTL_LOG_VERSION    1
+#define RELAYCTL_LOG_DEFAULT_RECORDS 65536
+#define RELAYCTL_LOG_MAX_RECORDS     (1U << 26)     /* 1 GiB of records */
+
+#define RELAYCTL_LOG_F_SESSION  0x0001  /* first record of a relayctl_log_open_append() */
+
+struct relayctl_log_header {
+    char             magic[8];       /* RELAYCTL_LOG_MAGIC, NUL padded */
+    uint32_t         version;
+    uint32_t         rec_size;       /* sizeof(struct relayctl_log_rec) */
+    uint64_t         capacity;       /* records in the ring */
+    _Atomic uint64_t head;           /* records ever written */
+    int64_t          created_real_ns;/* CLOCK_REALTIME at creation */
+    uint8_t          reserved[24];
+};
+
+struct relayctl_log_rec {
+    int64_t  t_ns;      /* CLOCK_MONOTONIC when the command started */
+    uint8_t  op;        /* USBRELAY_OP_* */
+    uint8_t  status;    /* enum usbrelay_status of the reply */
+    uint8_t  board;
+    uint8_t  channel;
+    uint8_t  arg;       /* SET state or WRITE-MASK mask */
+    uint8_t  mask;      /* board mask after the command */
+    uint16_t flags;     /* RELAYCTL_LOG_F_*, other bits 0 */
+};
+
+struct relayctl_log {
+    int                         fd;
+    struct relayctl_log_header *hdr;
+    struct relayctl_log_rec    *recs;
+    size_t                      map_len;
+    int                         session_start;  /* next append starts a session */
+};
+
+/* Open path for appending, creating a ring of capacity records if it
+ * does not hold a valid log yet. Returns 0, or -1 with errno set
+ * (EINVAL if capacity is not 1..RELAYCTL_LOG_MAX_RECORDS). */
+int relayctl_log_open_append(struct relayctl_log *log, const char *path, uint64_t capacity);
+
+/* Open an existing log read-only. Returns 0, or -1 with errno set
+ * (EINVAL if the file is not a log). */
+int relayctl_log_open_read(struct relayctl_log *log, const char *path);
+
+void relayctl_log_append(struct relayctl_log *log, const struct relayctl_log_rec *rec);
+
+/* Records still in the ring, oldest first: index i is at
+ * recs[(first + i) % capacity] for i < count. */
+void relayctl_log_span(const struct relayctl_log *log, uint64_t *first, uint64_t *count);
+
+void relayctl_log_close(struct relayctl_log *log);
+
+#endif /* RELAYCTL_LOG_H */
@@ -0,0 +1,400 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "relayctl_metrics.h"
+
+#define METRICS_NSTATUS     (USBRELAY_ERR_INTERLOCK + 1)
+#define METRICS_MAX_BOARDS  32
+
+static _Atomic uint64_t cmd_count[RELAYCTL_CMD_COUNT];
+static _Atomic uint64_t cmd_failed[RELAYCTL_CMD_COUNT];
+static _Atomic uint64_t err_count[METRICS_NSTATUS];
+static struct timespec  start_time;
+
+/* Histogram bucket bounds for device I/O, in seconds (Prometheus "le") */
+static const double io_buckets[] = {
+    5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+    1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1.0
+};
+
+static const char *const io_names[RELAY_IO_KINDS] = {
+    [RELAY_IO_READ]  = "read",
+    [RELAY_IO_WRITE] = "write",
+};
+
+/* Counters have one writer (the session thread) and are read by the
+ * exporter: relaxed load + store, no locked instructions */
+static void counter_inc(_Atomic uint64_t *c) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+static uint64_t counter_get(_Atomic uint64_t *c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static double uptime_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start_time.tv_sec) +
+           (double)(now.tv_nsec - start_time.tv_nsec) / 1e9;
+}
+
+void relayctl_metrics_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+void relayctl_metrics_command(enum relayctl_cmd cmd, int failed) {
+    if ((unsigned)cmd >= RELAYCTL_CMD_COUNT) {
+        return;
+    }
+    counter_inc(&cmd_count[cmd]);
+    if (failed) {
+        counter_inc(&cmd_failed[cmd]);
+    }
+}
+
+void relayctl_metrics_error(enum usbrelay_status status) {
+    if ((unsigned)status < METRICS_NSTATUS && status != USBRELAY_OK) {
+        counter_inc(&err_count[status]);
+    }
+}
+
+void relayctl_metrics_error_code(const char *code) {
+    for (int st = 1; st < METRICS_NSTATUS; st++) {
+        if (strcmp(code, relay_status_name((enum usbrelay_status)st)) == 0) {
+            counter_inc(&err_count[st]);
+            return;
+        }
+    }
+    counter_inc(&err_count[USBRELAY_ERR_INTERNAL_ERROR]);
+}
+
+void relayctl_metrics_print(FILE *out, const struct relayctl_metrics_board *boards, int nboards) {
+    fprintf(out, "STAT UPTIME_S=%.3f\n", uptime_s());
+    for (int c = RELAYCTL_CMD_NONE + 1; c < RELAYCTL_CMD_COUNT; c++) {
+        uint64_t n = counter_get(&cmd_count[c]);
+        if (n) {
+            fprintf(out, "STAT CMD=%s COUNT=%llu FAILED=%llu\n",
+                    relayctl_cmd_name((enum relayctl_cmd)c), (unsigned long long)n,
+                    (unsigned long long)counter_get(&cmd_failed[c]));
+        }
+    }
+    for (int st = 1; st < METRICS_NSTATUS; st++) {
+        uint64_t n = counter_get(&err_count[st]);
+        if (n) {
+            fprintf(out, "STAT ERR=%s COUNT=%llu\n",
+                    relay_status_name((enum usbrelay_status)st), (unsigned long long)n);
+        }
+    }
+    for (int b = 0; b < nboards; b++) {
+        for (int io = 0; io < RELAY_IO_KINDS; io++) {
+            struct relay_io_stats st;
+
+            relay_io_stats(boards[b].dev, (enum relay_io)io, &st);
+            if (st.count == 0) {
+                continue;
+            }
+            fprintf(out, "STAT BOARD=%d IO=%s COUNT=%llu ERRORS=%llu AVG_US=%.1f "
+                    "P50_US=%.1f P90_US=%.1f P99_US=%.1f P999_US=%.1f MAX_US=%.1f\n",
+                    b, io_names[io], (unsigned long long)st.count,
+                    (unsigned long long)st.errors,
+                    (double)st.sum_ns / 1e3 / (double)st.count,
+                    (double)relay_io_quantile(boards[b].dev, (enum relay_io)io, 0.5) / 1e3,
+                    (double)relay_io_quantile(boards[b].dev, (enum relay_io)io, 0.9) / 1e3,
+                    (double)relay_io_quantile(boards[b].dev, (enum relay_io)io, 0.99) / 1e3,
+                    (double)relay_io_quantile(boards[b].dev, (enum relay_io)io, 0.999) / 1e3,
+                    (double)st.max_ns / 1e3);
+        }
+    }
+    fprintf(out, "OK\n");
+}
+
+/* Label value with \, " and newline escaped as the format requires */
+static void prom_label(FILE *out, const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\' || *s == '"') {
+            fputc('\\', out);
+            fputc(*s, out);
+        } else if (*s == '\n') {
+            fputs("\\n", out);
+        } else {
+            fputc(*s, out);
+        }
+    }
+}
+
+static void prom_io_labels(FILE *out, int board, const char *path, int io) {
+    fprintf(out, "board=\"%d\",device=\"", board);
+    prom_label(out, path);
+    fprintf(out, "\",op=\"%s\"", io_names[io]);
+}
+
+void relayctl_metrics_write_prom(FILE *out, const struct relayctl_metrics_board *boards,
+                                 int nboards) {
+    fputs("# HELP relayctl_uptime_seconds Time since relayctl started.\n"
+          "# TYPE relayctl_uptime_seconds gauge\n", out);
+    fprintf(out, "relayctl_uptime_seconds %.3f\n", uptime_s());
+
+    fputs("# HELP relayctl_commands_total Protocol commands handled.\n"
+          "# TYPE relayctl_commands_total counter\n", out);
+    for (int c = RELAYCTL_CMD_NONE + 1; c < RELAYCTL_CMD_COUNT; c++) {
+        fprintf(out, "relayctl_commands_total{command=\"%s\"} %llu\n",
+                relayctl_cmd_name((enum relayctl_cmd)c),
+                (unsigned long long)counter_get(&cmd_count[c]));
+    }
+    fputs("# HELP relayctl_command_failures_total Protocol commands that answered ERR.\n"
+          "# TYPE relayctl_command_failures_total counter\n", out);
+    for (int c = RELAYCTL_CMD_NONE + 1; c < RELAYCTL_CMD_COUNT; c++) {
+        fprintf(out, "relayctl_command_failures_total{command=\"%s\"} %llu\n",
+                relayctl_cmd_name((enum relayctl_cmd)c),
+                (unsigned long long)counter_get(&cmd_failed[c]));
+    }
+
+    fputs("# HELP relayctl_errors_total ERR lines sent, by code.\n"
+          "# TYPE relayctl_errors_total counter\n", out);
+    for (int st = 1; st < METRICS_NSTATUS; st++) {
+        fprintf(out, "relayctl_errors_total{code=\"%s\"} %llu\n",
+                relay_status_name((enum usbrelay_status)st),
+                (unsigned long long)counter_get(&err_count[st]));
+    }
+
+    fputs("# HELP relayctl_device_io_seconds Latency of device mask reads and writes.\n"
+          "# TYPE relayctl_device_io_seconds histogram\n", out);
+    for (int b = 0; b < nboards; b++) {
+        for (int io = 0; io < RELAY_IO_KINDS; io++) {
+            struct relay_io_stats st;
+            uint64_t n = 0;
+
+            relay_io_stats(boards[b].dev, (enum relay_io)io, &st);
+            for (size_t i = 0; i < sizeof(io_buckets) / sizeof(io_buckets[0]); i++) {
+                n = relay_io_count_le(boards[b].dev, (enum relay_io)io,
+                                      (uint64_t)(io_buckets[i] * 1e9 + 0.5));
+                fputs("relayctl_device_io_seconds_bucket{", out);
+                prom_io_labels(out, b, boards[b].path, io);
+                fprintf(out, ",le=\"%g\"} %llu\n", io_buckets[i], (unsigned long long)n);
+            }
+            /* Buckets may have moved on since st was read */
+            if (st.count < n) {
+                st.count = n;
+            }
+            fputs("relayctl_device_io_seconds_bucket{", out);
+            prom_io_labels(out, b, boards[b].path, io);
+            fprintf(out, ",le=\"+Inf\"} %llu\n", (unsigned long long)st.count);
+            fputs("relayctl_device_io_seconds_sum{", out);
+            prom_io_labels(out, b, boards[b].path, io);
+            fprintf(out, "} %.9f\n", (double)st.sum_ns / 1e9);
+            fputs("relayctl_device_io_seconds_count{", out);
+            prom_io_labels(out, b, boards[b].path, io);
+            fprintf(out, "} %llu\n", (unsigned long long)st.count);
+        }
+    }
+
+    fputs("# HELP relayctl_device_io_errors_total Device mask reads and writes that failed.\n"
+          "# TYPE relayctl_device_io_errors_total counter\n", out);
+    for (int b = 0; b < nboards; b++) {
+        for (int io = 0; io < RELAY_IO_KINDS; io++) {
+            struct relay_io_stats st;
+
+            relay_io_stats(boards[b].dev, (enum relay_io)io, &st);
+            fputs("relayctl_device_io_errors_total{", out);
+            prom_io_labels(out, b, boards[b].path, io);
+            fprintf(out, "} %llu\n", (unsigned long long)st.errors);
+        }
+    }
+}
+
+/* ---- background exporter ---- */
+
+static struct {
+    int                           running;
+    pthread_t                     thread;
+    int                           stop_pipe[2];
+    int                           listen_fd;    /* -1 in file mode */
+    char                          path[108];    /* file or socket path */
+    long                          interval_ms;
+    struct relayctl_metrics_board boards[METRICS_MAX_BOARDS];
+    int                           nboards;
+} exporter = { .listen_fd = -1 };
+
+static int write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Replace the file in one rename so readers never see half of it */
+static int export_file(void) {
+    char tmp[sizeof(exporter.path) + 8];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", exporter.path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        return 1;
+    }
+    relayctl_metrics_write_prom(f, exporter.boards, exporter.nboards);
+    if (fclose(f) != 0 || rename(tmp, exporter.path) != 0) {
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+static void export_connection(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    char req[512];
+    char *body = NULL;
+    size_t len = 0;
+    int http = 0;
+
+    /* A plain "connect and read" client sends nothing; give an HTTP
+     * client a moment to send its request line */
+    if (poll(&pfd, 1, 100) == 1) {
+        ssize_t n = recv(fd, req, sizeof(req) - 1, 0);
+        http = n >= 4 && memcmp(req, "GET ", 4) == 0;
+    }
+
+    FILE *mem = open_memstream(&body, &len);
+    if (!mem) {
+        return;
+    }
+    if (http) {
+        fputs("HTTP/1.0 200 OK\r\n"
+              "Content-Type: text/plain; version=0.0.4\r\n"
+              "Connection: close\r\n\r\n", mem);
+    }
+    relayctl_metrics_write_prom(mem, exporter.boards, exporter.nboards);
+    if (fclose(mem) == 0) {
+        write_all(fd, body, len);
+    }
+    free(body);
+}
+
+static void *export_run(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        struct pollfd pfd[2] = {
+            { .fd = exporter.stop_pipe[0], .events = POLLIN },
+            { .fd = exporter.listen_fd,    .events = POLLIN },
+        };
+        int timeout = exporter.listen_fd < 0 ? (int)exporter.interval_ms : -1;
+        int n = poll(pfd, exporter.listen_fd < 0 ? 1 : 2, timeout);
+
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        if (pfd[0].revents) {
+            break;
+        }
+        if (exporter.listen_fd < 0) {
+            export_file();
+        } else if (pfd[1].revents & POLLIN) {
+            int fd = accept(exporter.listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                export_connection(fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+int relayctl_metrics_export_start(const char *target, const struct relayctl_metrics_board *boards,
+                                  int nboards, long interval_ms) {
+    int is_socket = strncmp(target, "unix:", 5) == 0;
+    const char *path = is_socket ? target + 5 : target;
+
+    if (*path == '\0' || strlen(path) >= sizeof(exporter.path) - 1) {
+        fprintf(stderr, "ERR BAD_COMMAND Bad metrics target: %s\n", target);
+        return 1;
+    }
+    strcpy(exporter.path, path);
+    exporter.nboards = nboards < METRICS_MAX_BOARDS ? nboards : METRICS_MAX_BOARDS;
+    memcpy(exporter.boards, boards, (size_t)exporter.nboards * sizeof(*boards));
+    exporter.interval_ms = interval_ms;
+    exporter.listen_fd = -1;
+
+    if (is_socket) {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        unlink(path);           /* stale socket from an earlier run */
+        exporter.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (exporter.listen_fd < 0 ||
+            bind(exporter.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(exporter.listen_fd, 8) != 0) {
+            fprintf(stderr, "ERR INTERNAL_ERROR Cannot listen on %s (errno=%d)\n", path, errno);
+            if (exporter.listen_fd >= 0) {
+                close(exporter.listen_fd);
+                exporter.listen_fd = -1;
+            }
+            return 1;
+        }
+    } else if (export_file() != 0) {
+        fprintf(stderr, "ERR INTERNAL_ERROR Cannot write metrics to %s (errno=%d)\n", path, errno);
+        return 1;
+    }
+
+    if (pipe(exporter.stop_pipe) != 0 ||
+        pthread_create(&exporter.thread, NULL, export_run, NULL) != 0) {
+        fprintf(stderr, "ERR INTERNAL_ERROR Cannot start metrics exporter\n");
+        if (exporter.listen_fd >= 0) {
+            close(exporter.listen_fd);
+            unlink(exporter.path);
+            exporter.listen_fd = -1;
+        }
+        return 1;
+    }
+    exporter.running = 1;
+    return 0;
+}
+
+int relayctl_metrics_export_stop(void) {
+    int rc = 0;
+
+    if (!exporter.running) {
+        return 0;
+    }
+    exporter.running = 0;
+    if (write(exporter.stop_pipe[1], "", 1) != 1) {
+        rc = 1;
+    }
+    pthread_join(exporter.thread, NULL);
+    close(exporter.stop_pipe[0]);
+    close(exporter.stop_pipe[1]);
+
+    if (exporter.listen_fd >= 0) {
+        close(exporter.listen_fd);
+        unlink(exporter.path);
+        exporter.listen_fd = -1;
+    } else if (export_file() != 0) {
+        fprintf(stderr, "ERR INTERNAL_ERROR Cannot write metrics to %s (errno=%d)\n",
+                exporter.path, errno);
+        rc = 1;
+    }
+    return rc;
+}
@@ -0,0 +1,52 @@
+#ifndef RELAYCTL_METRICS_H
+#define RELAYCTL_METRICS_H
+
+#include <stdio.h>
+
+#include "../include/relay.h"
+#include "relayctl_parse.h"
+
+/*
+ * Instrumentation for relayctl sessions: per-command counters and ERR
+ * counts by code are kept here, and device read/write latency histograms
+ * come from librelay (relay_io_*). Counters may be read by the exporter
+ * thread while the session updates them.
+ */
+
+/* One board as it appears in the labels of exported series */
+struct relayctl_metrics_board {
+    struct relay_board *dev;
+    const char         *path;
+};
+
+/* Start the uptime clock */
+void relayctl_metrics_init(void);
+
+void relayctl_metrics_command(enum relayctl_cmd cmd, int failed);
+void relayctl_metrics_error(enum usbrelay_status status);
+
+/* Count an error known only by its protocol name ("BAD_CHANNEL") */
+void relayctl_metrics_error_code(const char *code);
+
+/* Reply to STATS: "STAT ..." lines, then "OK" */
+void relayctl_metrics_print(FILE *out, const struct relayctl_metrics_board *boards, int nboards);
+
+/* Prometheus text exposition format (version 0.0.4) */
+void relayctl_metrics_write_prom(FILE *out, const struct relayctl_metrics_board *boards,
+                                 int nboards);
+
+/* Export in the background until relayctl_metrics_export_stop():
+ *   "unix:<path>"  listen on a Unix socket and answer each connection
+ *                  with the exposition (HTTP GETs get an HTTP reply, so
+ *                  curl --unix-socket works)
+ *   <path>         rewrite the file atomically every interval_ms and at
+ *                  stop (node_exporter textfile collector style)
+ * Returns 0, or 1 after printing an ERR line. */
+int relayctl_metrics_export_start(const char *target, const struct relayctl_metrics_board *boards,
+                                  int nboards, long interval_ms);
+
+/* Stop the exporter (no-op if not running); returns nonzero if the final
+ * file write failed */
+int relayctl_metrics_export_stop(void);
+
+#endif /* RELAYCTL_METRICS_H */
@@ -0,0 +1,331 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../include/usbrelay.h"
+#include "relayctl_parse.h"
+
+#define RELAYCTL_STR_(x) #x
+#define RELAYCTL_STR(x)  RELAYCTL_STR_(x)
+
+/* Argument kinds a command can take, in order */
+enum relayctl_arg {
+    ARG_NONE = 0,
+    ARG_CHANNEL,
+    ARG_STATE,
+    ARG_MASK,
+    ARG_INTERVAL,       /* optional, milliseconds */
+    ARG_NAME
+};
+
+/* One row of the dispatch table */
+struct relayctl_cmd_desc {
+    const char        *name;
+    unsigned char      len;
+    enum relayctl_cmd  cmd;
+    enum relayctl_arg  args[2];
+    const char        *usage;   /* message when arguments are missing */
+    int                boards;  /* accepts a leading board selector */
+};
+
+static const struct relayctl_cmd_desc cmd_table[] = {
+    { "set",        3,  RELAYCTL_CMD_SET,        { ARG_CHANNEL, ARG_STATE },
+      "set requires: set <ch> <on|off>", 0 },
+    { "get",        3,  RELAYCTL_CMD_GET,        { ARG_CHANNEL, ARG_NONE },
+      "get requires: get <ch>", 0 },
+    { "getall",     6,  RELAYCTL_CMD_GETALL,     { ARG_NONE, ARG_NONE }, NULL, 1 },
+    { "toggle",     6,  RELAYCTL_CMD_TOGGLE,     { ARG_CHANNEL, ARG_NONE },
+      "toggle requires: toggle <ch>", 0 },
+    { "write-mask", 10, RELAYCTL_CMD_WRITE_MASK, { ARG_MASK, ARG_NONE },
+      "write-mask requires: write-mask [boards] 0xHH", 1 },
+    { "read-mask",  9,  RELAYCTL_CMD_READ_MASK,  { ARG_NONE, ARG_NONE }, NULL, 1 },
+    { "reset",      5,  RELAYCTL_CMD_RESET,      { ARG_NONE, ARG_NONE }, NULL, 1 },
+    { "ping",       4,  RELAYCTL_CMD_PING,       { ARG_NONE, ARG_NONE }, NULL, 1 },
+    { "version",    7,  RELAYCTL_CMD_VERSION,    { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "help",       4,  RELAYCTL_CMD_HELP,       { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "begin",      5,  RELAYCTL_CMD_BEGIN,      { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "commit",     6,  RELAYCTL_CMD_COMMIT,     { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "abort",      5,  RELAYCTL_CMD_ABORT,      { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "quit",       4,  RELAYCTL_CMD_QUIT,       { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "exit",       4,  RELAYCTL_CMD_QUIT,       { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "binary",     6,  RELAYCTL_CMD_BINARY,     { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "stats",      5,  RELAYCTL_CMD_STATS,      { ARG_NONE, ARG_NONE }, NULL, 0 },
+    { "watch",      5,  RELAYCTL_CMD_WATCH,      { ARG_INTERVAL, ARG_NONE }, NULL, 0 },
+    { "scene",      5,  RELAYCTL_CMD_SCENE,      { ARG_NAME, ARG_NONE },
+      "scene requires: scene <name>", 0 },
+};
+
+#define CMD_TABLE_LEN   (sizeof(cmd_table) / sizeof(cmd_table[0]))
+#define CMD_HASH_SIZE   64      /* power of two, > 2 * CMD_TABLE_LEN */
+#define CMD_NAME_MAX    15
+
+/*
+ * Open-addressing hash index over cmd_table, keyed on the case-folded
+ * name. Built once on first use; a lookup is one hash over the token
+ * plus (almost always) a single strncasecmp.
+ */
+static unsigned char cmd_hash[CMD_HASH_SIZE];  /* table index + 1, 0 = empty */
+static int cmd_hash_ready;
+
+static unsigned int cmd_hash_name(const char *s, size_t len) {
+    unsigned int h = 2166136261u;   /* FNV-1a */
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 'A' && c <= 'Z') {
+            c |= 0x20;
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+static void cmd_hash_build(void) {
+    for (size_t i = 0; i < CMD_TABLE_LEN; i++) {
+        unsigned int slot = cmd_hash_name(cmd_table[i].name, cmd_table[i].len);
+        while (cmd_hash[slot & (CMD_HASH_SIZE - 1)]) {
+            slot++;
+        }
+        cmd_hash[slot & (CMD_HASH_SIZE - 1)] = (unsigned char)(i + 1);
+    }
+    cmd_hash_ready = 1;
+}
+
+static const struct relayctl_cmd_desc *cmd_lookup(const char *name) {
+    size_t len = strlen(name);
+
+    if (len == 0 || len > CMD_NAME_MAX) {
+        return NULL;
+    }
+    if (!cmd_hash_ready) {
+        cmd_hash_build();
+    }
+
+    unsigned int slot = cmd_hash_name(name, len);
+    for (;;) {
+        unsigned char idx = cmd_hash[slot & (CMD_HASH_SIZE - 1)];
+        if (idx == 0) {
+            return NULL;
+        }
+        const struct relayctl_cmd_desc *d = &cmd_table[idx - 1];
+        if (d->len == len && strncasecmp(d->name, name, len) == 0) {
+            return d;
+        }
+        slot++;
+    }
+}
+
+static int parse_fail(struct relayctl_command *out, const char *code,
+                      const char *msg, const char *arg) {
+    out->err_code = code;
+    out->err_msg  = msg;
+    out->err_arg  = arg;
+    return 1;
+}
+
+/* Parse a channel argument "1".."4", optionally board-qualified "B:1" */
+static int parse_channel_arg(char *arg, struct relayctl_command *out) {
+    int ch = 0;
+    char *colon = strchr(arg, ':');
+
+    if (colon) {
+        if (colon == arg) {
+            return parse_fail(out, "BAD_BOARD", "Missing board before ':'", NULL);
+        }
+        *colon = '\0';
+        out->boards = arg;
+        arg = colon + 1;
+    }
+
+    const char *p = arg;
+
+    /* At most two digits: anything longer is out of range anyway */
+    while (*p >= '0' && *p <= '9' && p - arg < 2) {
+        ch = ch * 10 + (*p - '0');
+        p++;
+    }
+    if (p == arg || *p != '\0' ||
+        ch < USBRELAY_MIN_CHANNEL || ch > USBRELAY_MAX_CHANNEL) {
+        return parse_fail(out, "BAD_CHANNEL", "Channel must be 1..4", NULL);
+    }
+    out->channel = ch;
+    return 0;
+}
+
+static int parse_state_arg(const char *arg, struct relayctl_command *out) {
+    if (strcasecmp(arg, "on") == 0) {
+        out->state = RELAYCTL_STATE_ON;
+    } else if (strcasecmp(arg, "off") == 0) {
+        out->state = RELAYCTL_STATE_OFF;
+    } else {
+        return parse_fail(out, "BAD_STATE", "State must be ON or OFF", NULL);
+    }
+    return 0;
+}
+
+/* Parse a mask argument "0xHH" (0x00-0x0F) */
+static int parse_mask_arg(const char *arg, struct relayctl_command *out) {
+    char *endp = NULL;
+    long val = strtol(arg, &endp, 0); /* base 0: allows 0x prefix */
+    if (*arg == '\0' || *endp != '\0' || val < 0 || val > 0xFF) {
+        return parse_fail(out, "BAD_MASK", "Mask must be 0xHH", NULL);
+    }
+    if ((uint8_t)val & ~USBRELAY_MASK_ALL) {
+        return parse_fail(out, "BAD_MASK", "Mask must be in range 0x00-0x0F", NULL);
+    }
+    out->mask = (uint8_t)val;
+    return 0;
+}
+
+/* Parse a watch interval in milliseconds (1..3600000) */
+static int parse_interval_arg(const char *arg, struct relayctl_command *out) {
+    char *endp = NULL;
+    long val = strtol(arg, &endp, 10);
+    if (*arg == '\0' || *endp != '\0' || val < 1 || val > 3600000) {
+        return parse_fail(out, "BAD_COMMAND", "Interval must be 1-3600000 ms", NULL);
+    }
+    out->interval_ms = val;
+    return 0;
+}
+
+int relayctl_tokenize(char *line, char **tok, int max) {
+    int n = 0;
+    char *p = line;
+
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
+        }
+        if (*p == '\0') {
+            return n;
+        }
+        if (n == max) {
+            return -1;
+        }
+        tok[n++] = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+            p++;
+        }
+        if (*p == '\0') {
+            return n;
+        }
+        *p++ = '\0';
+    }
+}
+
+int relayctl_parse_tokens(int ntok, char **tok, struct relayctl_command *out) {
+    out->cmd      = RELAYCTL_CMD_NONE;
+    out->channel  = 0;
+    out->state    = RELAYCTL_STATE_OFF;
+    out->mask     = 0;
+    out->interval_ms = 0;
+    out->name     = NULL;
+    out->boards   = NULL;
+    out->err_code = NULL;
+    out->err_msg  = NULL;
+    out->err_arg  = NULL;
+
+    if (ntok <= 0) {
+        return parse_fail(out, "BAD_COMMAND", "Empty command", NULL);
+    }
+
+    const struct relayctl_cmd_desc *d = cmd_lookup(tok[0]);
+    if (!d) {
+        return parse_fail(out, "BAD_COMMAND", "Unknown command:", tok[0]);
+    }
+    out->cmd = d->cmd;
+
+    int nargs = (d->args[0] != ARG_NONE) + (d->args[1] != ARG_NONE);
+    int i = 1;
+    if (d->boards && ntok == 2 + nargs) {
+        out->boards = tok[i++];
+    }
+    for (int a = 0; a < 2 && d->args[a] != ARG_NONE; a++, i++) {
+        if (i >= ntok) {
+            if (d->args[a] == ARG_INTERVAL) {
+                break;
+            }
+            return parse_fail(out, "BAD_COMMAND", d->usage, NULL);
+        }
+        int rc = 0;
+        switch (d->args[a]) {
+        case ARG_CHANNEL:
+            rc = parse_channel_arg(tok[i], out);
+            break;
+        case ARG_STATE:
+            rc = parse_state_arg(tok[i], out);
+            break;
+        case ARG_MASK:
+            rc = parse_mask_arg(tok[i], out);
+            break;
+        case ARG_INTERVAL:
+            rc = parse_interval_arg(tok[i], out);
+            break;
+        case ARG_NAME:
+            out->name = tok[i];     /* resolved when the command runs */
+            break;
+        case ARG_NONE:
+            break;
+        }
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    if (i < ntok) {
+        return parse_fail(out, "BAD_COMMAND", "Unexpected extra arguments", NULL);
+    }
+    return 0;
+}
+
+int relayctl_parse_line(char *line, struct relayctl_command *out) {
+    char *tok[RELAYCTL_MAX_TOKENS];
+    int ntok = relayctl_tokenize(line, tok, RELAYCTL_MAX_TOKENS);
+
+    if (ntok < 0) {
+        out->cmd = RELAYCTL_CMD_NONE;
+        return parse_fail(out, "BAD_COMMAND", "Too many arguments", NULL);
+    }
+    return relayctl_parse_tokens(ntok, tok, out);
+}
+
+const char *relayctl_cmd_name(enum relayctl_cmd cmd) {
+    for (size_t i = 0; i < CMD_TABLE_LEN; i++) {
+        if (cmd_table[i].cmd == cmd) {
+            return cmd_table[i].name;
+        }
+    }
+    return "none";
+}
+
+int relayctl_config_error(const char *file, int lineno, const char *code,
+                          const char *msg, const char *arg) {
+    fprintf(stderr, "ERR %s %s:%d: %s%s%s\n", code, file, lineno, msg,
+            arg ? " " : "", arg ? arg : "");
+    return 1;
+}
+
+const char *relayctl_parse_board_channel(const char *tok, int *board, int *ch) {
+    const char *colon = strchr(tok, ':');
+    const char *chs = tok;
+    char *endp;
+    long v;
+
+    *board = 0;
+    if (colon) {
+        v = strtol(tok, &endp, 10);
+        if (colon == tok || endp != colon || v < 0 || v >= RELAYCTL_CONFIG_MAX_BOARDS) {
+            return "Board must be 0.." RELAYCTL_STR(RELAYCTL_CONFIG_LAST_BOARD) ":";
+        }
+        *board = (int)v;
+        chs = colon + 1;
+    }
+    v = strtol(chs, &endp, 10);
+    if (*chs == '\0' || *endp != '\0' || v < USBRELAY_MIN_CHANNEL || v > USBRELAY_MAX_CHANNEL) {
+        return "Channel must be " RELAYCTL_STR(USBRELAY_MIN_CHANNEL) ".."
+               RELAYCTL_STR(USBRELAY_MAX_CHANNEL) ":";
+    }
+    *ch = (int)v;
+    return NULL;
+}
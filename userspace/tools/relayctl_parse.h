@@ -0,0 +1,81 @@
+#ifndef RELAYCTL_PARSE_H
+#define RELAYCTL_PARSE_H
+
+#include <stdint.h>
+
+#define RELAYCTL_MAX_TOKENS 16
+#define RELAYCTL_CONFIG_LAST_BOARD  15  /* highest board a config file can name */
+#define RELAYCTL_CONFIG_MAX_BOARDS  (RELAYCTL_CONFIG_LAST_BOARD + 1)
+
+enum relayctl_cmd {
+    RELAYCTL_CMD_NONE = 0,
+    RELAYCTL_CMD_SET,
+    RELAYCTL_CMD_GET,
+    RELAYCTL_CMD_GETALL,
+    RELAYCTL_CMD_TOGGLE,
+    RELAYCTL_CMD_WRITE_MASK,
+    RELAYCTL_CMD_READ_MASK,
+    RELAYCTL_CMD_RESET,
+    RELAYCTL_CMD_PING,
+    RELAYCTL_CMD_VERSION,
+    RELAYCTL_CMD_HELP,
+    RELAYCTL_CMD_BEGIN,
+    RELAYCTL_CMD_COMMIT,
+    RELAYCTL_CMD_ABORT,
+    RELAYCTL_CMD_QUIT,
+    RELAYCTL_CMD_BINARY,
+    RELAYCTL_CMD_STATS,
+    RELAYCTL_CMD_WATCH,
+    RELAYCTL_CMD_SCENE,
+    RELAYCTL_CMD_COUNT          /* number of commands; keep last */
+};
+
+/* ON/OFF state used when parsing "set" commands. */
+enum relayctl_state {
+    RELAYCTL_STATE_OFF = 0,
+    RELAYCTL_STATE_ON  = 1
+};
+
+/* One parsed protocol command. On failure err_code/err_msg describe the
+ * error as "ERR <err_code> <err_msg>[ <err_arg>]"; nothing is printed. */
+struct relayctl_command {
+    enum relayctl_cmd   cmd;
+    int                 channel;    /* channel number for channel-based commands (1..4 or 0) */
+    enum relayctl_state state;      /* ON/OFF for set, if relevant */
+    uint8_t             mask;       /* mask for write-mask, if relevant */
+    long                interval_ms;/* watch polling interval, 0 = default */
+    const char         *name;       /* scene name, if relevant */
+    const char         *boards;     /* board selector ("2", "0-3", group), or NULL */
+    const char         *err_code;   /* e.g. "BAD_CHANNEL" */
+    const char         *err_msg;    /* human readable message */
+    const char         *err_arg;    /* offending token, or NULL */
+};
+
+/* Split line into whitespace separated tokens in place (no copying).
+ * Returns the number of tokens, or -1 if there are more than max. */
+int relayctl_tokenize(char *line, char **tok, int max);
+
+/* Parse an already tokenized command (tok[0] is the command name).
+ * Channels may be board-qualified ("2:3", "lab:1") and board-level
+ * commands take an optional leading selector ("write-mask 0-3 0x05");
+ * the selector is split off in place and left unresolved in boards. */
+int relayctl_parse_tokens(int ntok, char **tok, struct relayctl_command *out);
+
+/* Tokenize and parse one protocol line in place. */
+int relayctl_parse_line(char *line, struct relayctl_command *out);
+
+/* Canonical lower-case name of a command, e.g. "write-mask". */
+const char *relayctl_cmd_name(enum relayctl_cmd cmd);
+
+/* ---- config files (-S schedules, -C scenes, -L interlocks) ---- */
+
+/* Print "ERR <code> <file>:<line>: <msg>[ <arg>]" to stderr; returns 1 */
+int relayctl_config_error(const char *file, int lineno, const char *code,
+                          const char *msg, const char *arg);
+
+/* Parse "[board:]ch" with a numeric board below RELAYCTL_CONFIG_MAX_BOARDS
+ * (0 if absent). Returns NULL, or an error message that is meant to be
+ * followed by the offending token. */
+const char *relayctl_parse_board_channel(const char *tok, int *board, int *ch);
+
+#endif /* RELAYCTL_PARSE_H */
@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../include/usbrelay.h"
+#include "relayctl_scene.h"
+
+static unsigned int scene_hash(const char *s) {
+    unsigned int h = 2166136261u;   /* FNV-1a */
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 'A' && c <= 'Z') {
+            c |= 0x20;
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+static int scene_name_valid(const char *p) {
+    size_t len = strlen(p);
+
+    if (len == 0 || len >= RELAYCTL_SCENE_NAME_MAX) {
+        return 0;
+    }
+    for (; *p; p++) {
+        char c = *p;
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* One "[board:]ch on|off" item; returns an error message or NULL */
+static const char *scene_parse_item(char *item, struct relayctl_scene *sc, uint8_t set[]) {
+    char *tok[3];
+    int ntok = 0;
+    int board, ch;
+    char *save;
+
+    for (char *p = strtok_r(item, " \t", &save); p; p = strtok_r(NULL, " \t", &save)) {
+        if (ntok == 3) {
+            return "Expected <[board:]ch> <on|off>:";
+        }
+        tok[ntok++] = p;
+    }
+    if (ntok != 2) {
+        return "Expected <[board:]ch> <on|off>:";
+    }
+
+    const char *err = relayctl_parse_board_channel(tok[0], &board, &ch);
+    if (err) {
+        return err;
+    }
+
+    uint8_t bit = (uint8_t)USBRELAY_CH_TO_BIT(ch);
+    if (set[board] & bit) {
+        return "Channel listed twice:";
+    }
+    set[board] |= bit;
+    sc->boards |= 1U << board;
+    if (strcasecmp(tok[1], "on") == 0) {
+        sc->mask[board] |= bit;
+    } else if (strcasecmp(tok[1], "off") != 0) {
+        return "State must be ON or OFF:";
+    }
+    return NULL;
+}
+
+void relayctl_scenes_init(struct relayctl_scenes *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+int relayctl_scenes_load(struct relayctl_scenes *s, FILE *in, const char *name) {
+    char line[USBRELAY_MAX_LINE_LEN];
+    int lineno = 0;
+    int rc = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *p = line + strspn(line, " \t\r\n");
+        if (*p == '\0') {
+            continue;
+        }
+        p[strcspn(p, "\r\n")] = '\0';
+
+        /* "SCENE <name> = <items>" */
+        size_t kw = strcspn(p, " \t");
+        if (kw != 5 || strncasecmp(p, "scene", 5) != 0) {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND",
+                                        "Expected SCENE <name> = ...", NULL);
+            continue;
+        }
+        char *eq = strchr(p, '=');
+        if (!eq) {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND",
+                                        "Missing '=' after the scene name", NULL);
+            continue;
+        }
+        *eq = '\0';
+        char *sname = p + kw + strspn(p + kw, " \t");
+        sname[strcspn(sname, " \t")] = '\0';
+        if (!scene_name_valid(sname)) {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND", "Bad scene name:", sname);
+            continue;
+        }
+        if (relayctl_scene_find(s, sname)) {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND", "Scene defined twice:", sname);
+            continue;
+        }
+        if (s->nscenes == RELAYCTL_SCENE_MAX) {
+            rc |= relayctl_config_error(name, lineno, "BAD_COMMAND", "Too many scenes", NULL);
+            break;
+        }
+
+        struct relayctl_scene *sc = &s->scene[s->nscenes];
+        uint8_t set[RELAYCTL_SCENE_MAX_BOARDS] = { 0 };
+        const char *err = NULL;
+
+        memset(sc, 0, sizeof(*sc));
+        strcpy(sc->name, sname);
+        for (char *item = eq + 1; item && !err; ) {
+            char *next = strchr(item, ',');
+            if (next) {
+                *next++ = '\0';
+            }
+            if (item[strspn(item, " \t")] == '\0') {
+                if (next) {
+                    err = "Empty item before ','";
+                    rc |= relayctl_config_error(name, lineno, "BAD_COMMAND", err, NULL);
+                }
+            } else {
+                char copy[USBRELAY_MAX_LINE_LEN];
+                strcpy(copy, item);
+                err = scene_parse_item(copy, sc, set);
+                if (err) {
+                    rc |= relayctl_config_error(name, lineno, "BAD_COMMAND", err,
+                                                item + strspn(item, " \t"));
+                }
+            }
+            item = next;
+        }
+        if (err) {
+            continue;
+        }
+        if (!sc->boards) {
+            sc->boards = 1;     /* "SCENE dark =": board 0 all OFF */
+        }
+
+        /* Index it */
+        unsigned int slot = scene_hash(sc->name);
+        while (s->index[slot & (RELAYCTL_SCENE_HASH_SIZE - 1)]) {
+            slot++;
+        }
+        s->index[slot & (RELAYCTL_SCENE_HASH_SIZE - 1)] = (unsigned char)(s->nscenes + 1);
+        s->nscenes++;
+    }
+    return rc;
+}
+
+const struct relayctl_scene *relayctl_scene_find(const struct relayctl_scenes *s,
+                                                 const char *name) {
+    unsigned int slot = scene_hash(name);
+
+    for (;;) {
+        unsigned char idx = s->index[slot & (RELAYCTL_SCENE_HASH_SIZE - 1)];
+        if (idx == 0) {
+            return NULL;
+        }
+        if (strcasecmp(s->scene[idx - 1].name, name) == 0) {
+            return &s->scene[idx - 1];
+        }
+        slot++;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef RELAYCTL_SCENE_H
+#define RELAYCTL_SCENE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "relayctl_parse.h"
+
+/*
+ * Named scenes for relayctl -C. A scene file holds lines
+ *
+ *     SCENE <name> = <[board:]ch> <on|off> {, <[board:]ch> <on|off>}
+ *
+ * ('#' starts a comment). Each scene is a complete configuration of the
+ * boards it mentions: listed channels are set as given and every other
+ * channel of those boards is OFF, so a scene compiles to one mask per
+ * board and is applied with a single write, without reading the board
+ * first. Unqualified channels belong to board 0.
+ *
+ * Names are looked up through an open-addressing hash index on the
+ * case-folded name, so "scene <name>" costs one hash and (almost always)
+ * one comparison.
+ */
+
+#define RELAYCTL_SCENE_MAX          64
+#define RELAYCTL_SCENE_NAME_MAX     32
+#define RELAYCTL_SCENE_MAX_BOARDS   RELAYCTL_CONFIG_MAX_BOARDS
+#define RELAYCTL_SCENE_HASH_SIZE    128     /* power of two, > 2 * RELAYCTL_SCENE_MAX */
+
+struct relayctl_scene {
+    char     name[RELAYCTL_SCENE_NAME_MAX];
+    uint32_t boards;                            /* bit n -> board n is set */
+    uint8_t  mask[RELAYCTL_SCENE_MAX_BOARDS];   /* mask to write per board */
+};
+
+struct relayctl_scenes {
+    struct relayctl_scene scene[RELAYCTL_SCENE_MAX];
+    int                   nscenes;
+    unsigned char         index[RELAYCTL_SCENE_HASH_SIZE];  /* scene + 1, 0 = empty */
+};
+
+void relayctl_scenes_init(struct relayctl_scenes *s);
+
+/* Read and compile a scene file. Errors are printed as protocol ERR
+ * lines with the offending line number; returns nonzero if any line was
+ * rejected. */
+int relayctl_scenes_load(struct relayctl_scenes *s, FILE *in, const char *name);
+
+/* Scene called name (case-insensitive), or NULL */
+const struct relayctl_scene *relayctl_scene_find(const struct relayctl_scenes *s,
+                                                 const char *name);
+
+#endif /* RELAYCTL_SCENE_H */
@@ -0,0 +1,451 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+
+#include "relayctl_parse.h"
+#include "relayctl_sched.h"
+
+#define NSEC_PER_MSEC   1000000LL
+#define NSEC_PER_SEC    1000000000LL
+
+static int64_t clock_ns(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void relayctl_sched_init(struct relayctl_sched *s) {
+    memset(s, 0, sizeof(*s));
+    s->tfd = -1;
+}
+
+void relayctl_sched_free(struct relayctl_sched *s) {
+    if (s->tfd >= 0) {
+        close(s->tfd);
+    }
+    free(s->entries);
+    free(s->heap);
+    relayctl_sched_init(s);
+}
+
+/* ---- min-heap on due_ns (ties fire in schedule order) ---- */
+
+static int heap_before(const struct relayctl_sched_entry *a,
+                       const struct relayctl_sched_entry *b) {
+    return a->due_ns < b->due_ns || (a->due_ns == b->due_ns && a->id < b->id);
+}
+
+static void heap_push(struct relayctl_sched *s, struct relayctl_sched_entry *e) {
+    int i = s->nheap++;
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heap_before(e, s->heap[parent])) {
+            break;
+        }
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = e;
+}
+
+static struct relayctl_sched_entry *heap_pop(struct relayctl_sched *s) {
+    struct relayctl_sched_entry *top = s->heap[0];
+    struct relayctl_sched_entry *last = s->heap[--s->nheap];
+    int i = 0;
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->nheap) {
+            break;
+        }
+        if (child + 1 < s->nheap && heap_before(s->heap[child + 1], s->heap[child])) {
+            child++;
+        }
+        if (!heap_before(s->heap[child], last)) {
+            break;
+        }
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if (s->nheap > 0) {
+        s->heap[i] = last;
+    }
+    return top;
+}
+
+/* ---- schedule parsing ---- */
+
+/* "<ms>" with an optional fraction, e.g. "250" or "0.5" */
+static int parse_ms(const char *tok, int64_t *out_ns) {
+    char *endp;
+    double ms = strtod(tok, &endp);
+
+    if (endp == tok || *endp != '\0' || !isfinite(ms) || ms < 0.0 || ms > 1e12) {
+        return 1;
+    }
+    *out_ns = (int64_t)(ms * (double)NSEC_PER_MSEC + 0.5);
+    return 0;
+}
+
+/* Wall-clock time "HH:MM:SS[.frac]" (today, local time) or "@<unix>[.frac]",
+ * converted to CLOCK_MONOTONIC so one timer serves every entry. */
+static int parse_at(const char *tok, int64_t *out_mono_ns) {
+    int64_t real_now = clock_ns(CLOCK_REALTIME);
+    int64_t mono_now = clock_ns(CLOCK_MONOTONIC);
+    double target;
+    char *endp;
+
+    if (tok[0] == '@') {
+        target = strtod(tok + 1, &endp);
+        if (endp == tok + 1 || *endp != '\0' || !isfinite(target) ||
+            target >= (double)(INT64_MAX / NSEC_PER_SEC)) {
+            return 1;       /* "@nan", "@inf" or past what int64 ns can hold */
+        }
+    } else {
+        int hh, mm, n = 0;
+        double ss = 0.0;
+        time_t t = (time_t)(real_now / NSEC_PER_SEC);
+        struct tm tm;
+
+        if (sscanf(tok, "%d:%d:%lf%n", &hh, &mm, &ss, &n) != 3 || tok[n] != '\0' ||
+            hh < 0 || hh > 23 || mm < 0 || mm > 59 || !isfinite(ss) || ss < 0.0 || ss >= 61.0) {
+            return 1;
+        }
+        localtime_r(&t, &tm);
+        tm.tm_hour = hh;
+        tm.tm_min = mm;
+        tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        target = (double)mktime(&tm) + ss;
+    }
+
+    int64_t delta = (int64_t)(target * (double)NSEC_PER_SEC) - real_now;
+    if (delta < 0) {
+        return 2;
+    }
+    *out_mono_ns = mono_now + delta;
+    return 0;
+}
+
+/* Check every ';' segment of a scheduled command with the protocol parser,
+ * so mistakes surface when the schedule is loaded, not when it fires. */
+static int check_command(const char *line, const char *name, int lineno) {
+    char copy[USBRELAY_MAX_LINE_LEN];
+    char *seg = copy;
+    int ncmds = 0;
+
+    strcpy(copy, line);
+    while (seg) {
+        char *next = strchr(seg, ';');
+        struct relayctl_command cmd;
+
+        if (next) {
+            *next++ = '\0';
+        }
+        if (seg[strspn(seg, " \t")] == '\0') {
+            seg = next;                 /* empty segment, ignored as in the REPL */
+            continue;
+        }
+        if (relayctl_parse_line(seg, &cmd) != 0) {
+            return relayctl_config_error(name, lineno, cmd.err_code, cmd.err_msg, cmd.err_arg);
+        }
+        switch (cmd.cmd) {
+        case RELAYCTL_CMD_BEGIN:
+        case RELAYCTL_CMD_COMMIT:
+        case RELAYCTL_CMD_ABORT:
+        case RELAYCTL_CMD_QUIT:
+        case RELAYCTL_CMD_BINARY:
+        case RELAYCTL_CMD_HELP:
+            return relayctl_config_error(name, lineno, "BAD_COMMAND", relayctl_cmd_name(cmd.cmd),
+                                         "cannot be scheduled (use ';' to batch)");
+        case RELAYCTL_CMD_WATCH:
+            return relayctl_config_error(name, lineno, "BAD_COMMAND", relayctl_cmd_name(cmd.cmd),
+                                         "cannot be scheduled (it does not return)");
+        default:
+            break;
+        }
+        ncmds++;
+        seg = next;
+    }
+    if (ncmds == 0) {
+        return relayctl_config_error(name, lineno, "BAD_COMMAND", "Missing command", NULL);
+    }
+    return 0;
+}
+
+/* Split off the next whitespace separated word of *p */
+static char *next_word(char **p) {
+    char *s = *p + strspn(*p, " \t");
+    char *e;
+
+    if (*s == '\0') {
+        *p = s;
+        return NULL;
+    }
+    e = s + strcspn(s, " \t");
+    if (*e != '\0') {
+        *e++ = '\0';
+    }
+    *p = e + strspn(e, " \t");
+    return s;
+}
+
+static int sched_parse_line(struct relayctl_sched *s, char *p, const char *name, int lineno) {
+    struct relayctl_sched_entry e;
+    char *kw = next_word(&p);
+    char *when = next_word(&p);
+
+    if (!kw) {
+        return 0;                       /* blank or comment-only line */
+    }
+    memset(&e, 0, sizeof(e));
+    e.lineno = lineno;
+    e.count = 1;
+
+    if (!when) {
+        return relayctl_config_error(name, lineno, "BAD_COMMAND", "Missing time after", kw);
+    }
+    if (strcasecmp(kw, "at") == 0) {
+        int r = parse_at(when, &e.offset_ns);
+        if (r == 2) {
+            return relayctl_config_error(name, lineno, "BAD_COMMAND", "Time already passed:", when);
+        }
+        if (r != 0) {
+            return relayctl_config_error(name, lineno, "BAD_COMMAND",
+                                         "Time must be HH:MM:SS[.frac] or @<unix time>:", when);
+        }
+        e.kind = RELAYCTL_SCHED_AT;
+    } else if (strcasecmp(kw, "after") == 0) {
+        if (parse_ms(when, &e.offset_ns) != 0) {
+            return relayctl_config_error(name, lineno, "BAD_COMMAND", "Bad delay in ms:", when);
+        }
+        e.kind = RELAYCTL_SCHED_AFTER;
+    } else if (strcasecmp(kw, "every") == 0) {
+        if (parse_ms(when, &e.period_ns) != 0 || e.period_ns == 0) {
+            return relayctl_config_error(name, lineno, "BAD_COMMAND", "Bad period in ms:", when);
+        }
+        e.kind = RELAYCTL_SCHED_EVERY;
+        e.offset_ns = e.period_ns;      /* first firing one period in */
+        e.count = -1;
+        if (strncasecmp(p, "count", 5) == 0 && (p[5] == ' ' || p[5] == '\t')) {
+            char *endp;
+            next_word(&p);
+            char *n = next_word(&p);
+            e.count = n ? strtol(n, &endp, 10) : 0;
+            if (!n || *endp != '\0' || e.count <= 0) {
+                return relayctl_config_error(name, lineno, "BAD_COMMAND",
+                                             "count must be a positive integer", NULL);
+            }
+        }
+    } else {
+        return relayctl_config_error(name, lineno, "BAD_COMMAND",
+                                     "Expected at, after or every:", kw);
+    }
+
+    if (strlen(p) >= sizeof(e.line)) {
+        return relayctl_config_error(name, lineno, "BAD_COMMAND", "Command too long", NULL);
+    }
+    strcpy(e.line, p);
+    if (check_command(e.line, name, lineno) != 0) {
+        return 1;
+    }
+
+    if (s->nentries == s->cap) {
+        int cap = s->cap ? s->cap * 2 : 16;
+        struct relayctl_sched_entry *grown = realloc(s->entries, (size_t)cap * sizeof(*grown));
+        if (!grown) {
+            return relayctl_config_error(name, lineno, "INTERNAL_ERROR", "Out of memory", NULL);
+        }
+        s->entries = grown;
+        s->cap = cap;
+    }
+    e.id = s->nentries + 1;
+    s->entries[s->nentries++] = e;
+    return 0;
+}
+
+int relayctl_sched_load(struct relayctl_sched *s, FILE *in, const char *name) {
+    char buf[2 * USBRELAY_MAX_LINE_LEN];
+    int lineno = 0;
+    int rc = 0;
+
+    while (fgets(buf, sizeof(buf), in)) {
+        size_t len = strlen(buf);
+
+        lineno++;
+        if (len > 0 && buf[len - 1] != '\n' && !feof(in)) {
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n') {
+            }
+            rc = relayctl_config_error(name, lineno, "BAD_COMMAND", "Line too long", NULL);
+            continue;
+        }
+        buf[strcspn(buf, "#\r\n")] = '\0';
+        if (sched_parse_line(s, buf, name, lineno) != 0) {
+            rc = 1;
+        }
+    }
+    if (ferror(in)) {
+        fprintf(stderr, "ERR INTERNAL_ERROR %s: read failed (errno=%d)\n", name, errno);
+        rc = 1;
+    }
+    if (rc == 0 && s->nentries == 0) {
+        fprintf(stderr, "ERR BAD_COMMAND %s: schedule is empty\n", name);
+        rc = 1;
+    }
+    return rc;
+}
+
+int relayctl_sched_realtime(int prio) {
+    struct sched_param sp = { .sched_priority = prio };
+
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0) {
+        return -1;
+    }
+    /* No page faults once the run has started */
+    return mlockall(MCL_CURRENT | MCL_FUTURE);
+}
+
+/* ---- run loop ---- */
+
+static int arm_timer(int tfd, int64_t due_ns) {
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = due_ns / NSEC_PER_SEC;
+    its.it_value.tv_nsec = due_ns % NSEC_PER_SEC;
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+        its.it_value.tv_nsec = 1;       /* all-zero would disarm */
+    }
+    return timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void sched_print_summary(const struct relayctl_sched *s) {
+    for (int i = 0; i < s->nentries; i++) {
+        const struct relayctl_sched_entry *e = &s->entries[i];
+
+        if (e->runs == 0) {
+            printf("OK SCHED ID=%d RUNS=0\n", e->id);
+            continue;
+        }
+        printf("OK SCHED ID=%d RUNS=%lu FAILED=%lu MISSED=%lu "
+               "LATE_US_MIN=%.1f LATE_US_AVG=%.1f LATE_US_MAX=%.1f\n",
+               e->id, e->runs, e->failures, e->missed,
+               (double)e->late_min_ns / 1e3,
+               (double)e->late_sum_ns / 1e3 / (double)e->runs,
+               (double)e->late_max_ns / 1e3);
+    }
+}
+
+static int sched_fire(struct relayctl_sched_entry *e, relayctl_sched_fire_fn fire, void *arg) {
+    char line[USBRELAY_MAX_LINE_LEN];
+    int64_t woke = clock_ns(CLOCK_MONOTONIC);
+    int64_t late = woke - e->due_ns;
+
+    strcpy(line, e->line);
+    int rc = fire(arg, line);
+    int64_t done = clock_ns(CLOCK_MONOTONIC);
+
+    if (e->runs == 0 || late < e->late_min_ns) {
+        e->late_min_ns = late;
+    }
+    if (e->runs == 0 || late > e->late_max_ns) {
+        e->late_max_ns = late;
+    }
+    e->late_sum_ns += late;
+    e->runs++;
+    if (rc != 0) {
+        e->failures++;
+    }
+
+    printf("OK SCHED ID=%d RUN=%lu LATE_US=%.1f EXEC_US=%.1f\n",
+           e->id, e->runs, (double)late / 1e3, (double)(done - woke) / 1e3);
+    fflush(stdout);
+    return rc;
+}
+
+int relayctl_sched_run(struct relayctl_sched *s, relayctl_sched_fire_fn fire,
+                       void *arg, volatile sig_atomic_t *stop) {
+    int rc = 0;
+
+    s->heap = calloc((size_t)s->nentries, sizeof(*s->heap));
+    s->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (!s->heap || s->tfd < 0) {
+        fprintf(stderr, "ERR INTERNAL_ERROR Cannot create scheduler timer (errno=%d)\n", errno);
+        return 1;
+    }
+    /* Default timer slack (50 us) would dominate the jitter we report */
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+    s->start_ns = clock_ns(CLOCK_MONOTONIC);
+    for (int i = 0; i < s->nentries; i++) {
+        struct relayctl_sched_entry *e = &s->entries[i];
+        e->due_ns = e->kind == RELAYCTL_SCHED_AT ? e->offset_ns : s->start_ns + e->offset_ns;
+        heap_push(s, e);
+    }
+
+    while (s->nheap > 0 && !*stop) {
+        uint64_t expirations;
+
+        if (arm_timer(s->tfd, s->heap[0]->due_ns) != 0) {
+            fprintf(stderr, "ERR INTERNAL_ERROR Cannot arm scheduler timer (errno=%d)\n", errno);
+            rc = 1;
+            break;
+        }
+        if (read(s->tfd, &expirations, sizeof(expirations)) < 0) {
+            if (errno == EINTR) {
+                continue;               /* *stop is checked above */
+            }
+            fprintf(stderr, "ERR INTERNAL_ERROR Scheduler timer failed (errno=%d)\n", errno);
+            rc = 1;
+            break;
+        }
+
+        while (s->nheap > 0 && s->heap[0]->due_ns <= clock_ns(CLOCK_MONOTONIC)) {
+            struct relayctl_sched_entry *e = heap_pop(s);
+            int r = sched_fire(e, fire, arg);
+
+            if (r != 0) {
+                rc = r;
+            }
+            if (e->count > 0) {
+                e->count--;
+            }
+            if (e->kind != RELAYCTL_SCHED_EVERY || e->count == 0) {
+                continue;
+            }
+
+            /* Keep the original phase; skip periods already missed
+             * rather than firing a burst to catch up */
+            int64_t now = clock_ns(CLOCK_MONOTONIC);
+            e->due_ns += e->period_ns;
+            if (e->due_ns <= now) {
+                int64_t skip = (now - e->due_ns) / e->period_ns + 1;
+                if (e->count > 0 && skip >= e->count) {
+                    e->missed += (unsigned long)e->count;
+                    continue;
+                }
+                e->missed += (unsigned long)skip;
+                if (e->count > 0) {
+                    e->count -= skip;
+                }
+                e->due_ns += skip * e->period_ns;
+            }
+            heap_push(s, e);
+        }
+    }
+
+    sched_print_summary(s);
+    return rc;
+}
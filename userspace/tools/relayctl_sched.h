@@ -0,0 +1,80 @@
+#ifndef RELAYCTL_SCHED_H
+#define RELAYCTL_SCHED_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../include/usbrelay.h"
+
+/*
+ * Timed actions for relayctl -S. A schedule is a list of entries
+ *
+ *     at <HH:MM:SS[.frac]|@unix[.frac]> <command>
+ *     after <ms> <command>
+ *     every <ms> [count <n>] <command>
+ *
+ * where <command> is a protocol line (';' lines are batched as in the
+ * REPL). "after" and "every" count from the start of the run; <ms> may be
+ * fractional. Pending firings live in a min-heap keyed on their due time
+ * and a single CLOCK_MONOTONIC timerfd is armed for the earliest one.
+ */
+
+enum relayctl_sched_kind {
+    RELAYCTL_SCHED_AT = 0,
+    RELAYCTL_SCHED_AFTER,
+    RELAYCTL_SCHED_EVERY
+};
+
+struct relayctl_sched_entry {
+    int                      id;         /* 1-based, in schedule order */
+    int                      lineno;
+    enum relayctl_sched_kind kind;
+    int64_t                  offset_ns;  /* AT: absolute monotonic due time;
+                                          * AFTER/EVERY: offset from start */
+    int64_t                  period_ns;  /* EVERY only */
+    long                     count;      /* EVERY: firings left, -1 = forever */
+    int64_t                  due_ns;     /* next firing, CLOCK_MONOTONIC */
+    char                     line[USBRELAY_MAX_LINE_LEN];
+
+    /* Firing statistics; lateness = wake-up time - due time */
+    unsigned long            runs;
+    unsigned long            failures;
+    unsigned long            missed;     /* EVERY periods skipped after an overrun */
+    int64_t                  late_min_ns;
+    int64_t                  late_max_ns;
+    int64_t                  late_sum_ns;
+};
+
+/* Runs one action; line is a private copy that may be modified.
+ * Returns 0 on success. */
+typedef int (*relayctl_sched_fire_fn)(void *arg, char *line);
+
+struct relayctl_sched {
+    struct relayctl_sched_entry  *entries;
+    int                           nentries;
+    int                           cap;
+    struct relayctl_sched_entry **heap;     /* pending entries, earliest first */
+    int                           nheap;
+    int                           tfd;
+    int64_t                       start_ns;
+};
+
+void relayctl_sched_init(struct relayctl_sched *s);
+void relayctl_sched_free(struct relayctl_sched *s);
+
+/* Read a schedule. Errors are printed as protocol ERR lines with the
+ * offending line number; returns nonzero if any entry was rejected. */
+int relayctl_sched_load(struct relayctl_sched *s, FILE *in, const char *name);
+
+/* Switch to SCHED_FIFO at prio and lock all memory. Returns 0, or -1
+ * with errno set. */
+int relayctl_sched_realtime(int prio);
+
+/* Fire every entry at its due time until none is left or *stop is set.
+ * Prints an "OK SCHED ..." line with the lateness of each firing and a
+ * summary per entry at the end. Returns the last nonzero fire() result. */
+int relayctl_sched_run(struct relayctl_sched *s, relayctl_sched_fire_fn fire,
+                       void *arg, volatile sig_atomic_t *stop);
+
+#endif /* RELAYCTL_SCHED_H */
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "relayctl_watch.h"
+
+struct watch_board {
+    int      fd;        /* POLLPRI descriptor, or -1 when polled */
+    uint8_t  mask;      /* last reported mask */
+    long     delay_ms;  /* polled: current backoff */
+    int64_t  due_ns;    /* polled: next read */
+};
+
+static int64_t watch_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void watch_print(int board, int qualified, uint8_t mask) {
+    if (qualified) {
+        printf("OK BOARD=%d MASK=0x%02X\n", board, mask);
+    } else {
+        printf("OK MASK=0x%02X\n", mask);
+    }
+}
+
+/* Read one board and report it if it changed; returns 1 on a change */
+static int watch_read(struct relay_board *dev, struct watch_board *w, int board,
+                      int qualified, struct relayctl_watch_stats *st,
+                      enum usbrelay_status *status) {
+    uint8_t mask;
+
+    st->reads++;
+    *status = relay_read_mask(dev, &mask);
+    if (*status != USBRELAY_OK || mask == w->mask) {
+        return 0;
+    }
+    w->mask = mask;
+    st->changes++;
+    watch_print(board, qualified, mask);
+    return 1;
+}
+
+enum usbrelay_status relayctl_watch_run(struct relay_board *const *devs, int ndevs,
+                                        int qualified, long interval_ms,
+                                        int input_fd, relayctl_watch_input_fn input,
+                                        void *input_arg, volatile sig_atomic_t *stop,
+                                        struct relayctl_watch_stats *st, int *failed_board) {
+    struct watch_board w[RELAYCTL_WATCH_MAX_BOARDS];
+    struct pollfd pfd[RELAYCTL_WATCH_MAX_BOARDS + 1];
+    int pfd_board[RELAYCTL_WATCH_MAX_BOARDS];
+    enum usbrelay_status status = USBRELAY_OK;
+
+    memset(st, 0, sizeof(*st));
+    *failed_board = -1;
+    if (ndevs > RELAYCTL_WATCH_MAX_BOARDS) {
+        ndevs = RELAYCTL_WATCH_MAX_BOARDS;
+    }
+
+    int64_t start = watch_now_ns();
+    for (int b = 0; b < ndevs; b++) {
+        st->reads++;
+        status = relay_watch(devs[b], &w[b].mask, &w[b].fd);
+        if (status != USBRELAY_OK) {
+            *failed_board = b;
+            return status;
+        }
+        w[b].delay_ms = interval_ms;
+        w[b].due_ns = start + (int64_t)interval_ms * 1000000LL;
+        if (w[b].fd >= 0) {
+            st->notified++;
+        } else {
+            st->polled++;
+        }
+        watch_print(b, qualified, w[b].mask);
+    }
+
+    while (!*stop) {
+        int64_t now = watch_now_ns();
+        int timeout = -1;
+        int n = 0;
+
+        if (input && input(input_arg, 0) > 0) {
+            break;
+        }
+
+        for (int b = 0; b < ndevs; b++) {
+            if (w[b].fd >= 0) {
+                pfd_board[n] = b;
+                pfd[n].fd = w[b].fd;
+                pfd[n].events = POLLPRI;
+                pfd[n].revents = 0;
+                n++;
+            } else {
+                int64_t wait_ms = (w[b].due_ns - now + 999999) / 1000000;
+                if (wait_ms < 0) {
+                    wait_ms = 0;
+                }
+                if (timeout < 0 || wait_ms < timeout) {
+                    timeout = (int)wait_ms;
+                }
+            }
+        }
+        int nboards_fds = n;
+        if (input_fd >= 0) {
+            pfd[n].fd = input_fd;
+            pfd[n].events = POLLIN;
+            pfd[n].revents = 0;
+            n++;
+        }
+
+        /* About to sleep: let the lines printed so far out */
+        fflush(stdout);
+        if (poll(pfd, (nfds_t)n, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            status = USBRELAY_ERR_INTERNAL_ERROR;
+            break;
+        }
+
+        for (int i = 0; i < nboards_fds && status == USBRELAY_OK; i++) {
+            if (pfd[i].revents) {
+                int b = pfd_board[i];
+                watch_read(devs[b], &w[b], b, qualified, st, &status);
+                if (status != USBRELAY_OK) {
+                    *failed_board = b;
+                }
+            }
+        }
+
+        now = watch_now_ns();
+        for (int b = 0; b < ndevs && status == USBRELAY_OK; b++) {
+            if (w[b].fd >= 0 || w[b].due_ns > now) {
+                continue;
+            }
+            if (watch_read(devs[b], &w[b], b, qualified, st, &status)) {
+                w[b].delay_ms = interval_ms;
+            } else if (w[b].delay_ms < interval_ms * RELAYCTL_WATCH_BACKOFF_MAX) {
+                w[b].delay_ms *= 2;
+            }
+            if (status != USBRELAY_OK) {
+                *failed_board = b;
+            }
+            w[b].due_ns = now + (int64_t)w[b].delay_ms * 1000000LL;
+        }
+        if (status != USBRELAY_OK) {
+            break;
+        }
+
+        if (input_fd >= 0 && pfd[nboards_fds].revents) {
+            int rc = input(input_arg, 1);
+            if (rc > 0) {
+                break;
+            }
+            if (rc < 0) {
+                input_fd = -1;
+            }
+        }
+    }
+
+    /* A getall loop would have read every board once per interval */
+    uint64_t loop_reads = (uint64_t)ndevs *
+                          (uint64_t)((watch_now_ns() - start) / ((int64_t)interval_ms * 1000000LL) + 1);
+    st->skipped = loop_reads > st->reads ? (unsigned long)(loop_reads - st->reads) : 0;
+    fflush(stdout);
+    return status;
+}
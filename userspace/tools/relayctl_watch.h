@@ -0,0 +1,46 @@
+#ifndef RELAYCTL_WATCH_H
+#define RELAYCTL_WATCH_H
+
+#include <signal.h>
+
+#include "../include/relay.h"
+
+/*
+ * WATCH: stream "OK [BOARD=<n> ]MASK=0xHH" whenever a board's mask
+ * changes, instead of a getall loop. Boards whose transport can notify
+ * (relay_watch() returns a descriptor) are slept on with poll() and read
+ * only when they report POLLPRI. The others are read every interval_ms
+ * right after a change, backing off by doubling up to
+ * RELAYCTL_WATCH_BACKOFF_MAX * interval_ms while nothing changes.
+ */
+
+#define RELAYCTL_WATCH_MAX_BOARDS       16
+#define RELAYCTL_WATCH_DEFAULT_MS       100
+#define RELAYCTL_WATCH_BACKOFF_MAX      16
+
+struct relayctl_watch_stats {
+    unsigned long changes;      /* mask changes reported */
+    unsigned long reads;        /* device reads made */
+    unsigned long skipped;      /* reads a getall loop every interval_ms
+                                 * would have made on top of those */
+    int           notified;     /* boards watched through poll() */
+    int           polled;       /* boards read on a backoff timer */
+};
+
+/* Called with readable = 1 when input_fd is readable, and with readable = 0
+ * before every sleep to ask, without blocking, whether input is already
+ * buffered (a line read ahead together with WATCH). Return 1 to end the
+ * watch, 0 to keep going, or -1 to keep going without watching input_fd
+ * (EOF). */
+typedef int (*relayctl_watch_input_fn)(void *arg, int readable);
+
+/* Print the current masks, then every change, until *stop is set (a
+ * signal), input says so, or a board fails: then *failed_board is set and
+ * its status returned. qualified adds BOARD=<n> to each line. */
+enum usbrelay_status relayctl_watch_run(struct relay_board *const *devs, int ndevs,
+                                        int qualified, long interval_ms,
+                                        int input_fd, relayctl_watch_input_fn input,
+                                        void *input_arg, volatile sig_atomic_t *stop,
+                                        struct relayctl_watch_stats *st, int *failed_board);
+
+#endif /* RELAYCTL_WATCH_H */
@@ -8,13 +8,17 @@
 #   ./test_relayctl.sh
 #
 # Assumptions:
-#   - /dev/usbrelay0 exists and is bound to your kernel driver
-#   - Your user has permission to open /dev/usbrelay0 (group "usbrelay" etc.)
+#   - DEVICE (default /dev/usbrelay0) exists and is bound to your kernel
+#     driver, or is the CUSE emulator (userspace/emu/usbrelay_cuse)
+#   - Your user has permission to open DEVICE (group "usbrelay" etc.)
+#
+# RELAYCTL and DEVICE may be overridden from the environment; every test
+# passes DEVICE to relayctl with -d.
 
 set -u  # treat unset vars as error, but DO NOT use -e (we want all tests to run)
 
-RELAYCTL="./relayctl"
-DEVICE="/dev/usbrelay0"
+RELAYCTL="${RELAYCTL:-./relayctl}"
+DEVICE="${DEVICE:-/dev/usbrelay0}"
 
 echo "=== relayctl test harness ==="
 echo "Using binary: ${RELAYCTL}"
@@ -50,66 +54,203 @@ run_test() {
 }
 
 # 1) Basic ping / version / help
-run_test "ping"           "${RELAYCTL}" ping
-run_test "version"        "${RELAYCTL}" version
-run_test "help (short)"   "${RELAYCTL}" help
+run_test "ping"           "${RELAYCTL}" -d "${DEVICE}" ping
+run_test "version"        "${RELAYCTL}" -d "${DEVICE}" version
+run_test "help (short)"   "${RELAYCTL}" -d "${DEVICE}" help
 
 # 2) Reset and read mask
-run_test "reset (all off)"          "${RELAYCTL}" reset
-run_test "getall after reset"       "${RELAYCTL}" getall
+run_test "reset (all off)"          "${RELAYCTL}" -d "${DEVICE}" reset
+run_test "getall after reset"       "${RELAYCTL}" -d "${DEVICE}" getall
 
 # 3) Set individual channels ON, then read back via get/getall
-run_test "set CH1 ON"               "${RELAYCTL}" set 1 on
-run_test "get CH1"                  "${RELAYCTL}" get 1
-run_test "getall after CH1 ON"      "${RELAYCTL}" getall
+run_test "set CH1 ON"               "${RELAYCTL}" -d "${DEVICE}" set 1 on
+run_test "get CH1"                  "${RELAYCTL}" -d "${DEVICE}" get 1
+run_test "getall after CH1 ON"      "${RELAYCTL}" -d "${DEVICE}" getall
 
-run_test "set CH3 ON"               "${RELAYCTL}" set 3 on
-run_test "get CH3"                  "${RELAYCTL}" get 3
-run_test "getall after CH1+CH3 ON"  "${RELAYCTL}" getall
+run_test "set CH3 ON"               "${RELAYCTL}" -d "${DEVICE}" set 3 on
+run_test "get CH3"                  "${RELAYCTL}" -d "${DEVICE}" get 3
+run_test "getall after CH1+CH3 ON"  "${RELAYCTL}" -d "${DEVICE}" getall
 
 # 4) Toggle a channel
-run_test "toggle CH1"               "${RELAYCTL}" toggle 1
-run_test "get CH1 after toggle"     "${RELAYCTL}" get 1
-run_test "getall after toggle CH1"  "${RELAYCTL}" getall
+run_test "toggle CH1"               "${RELAYCTL}" -d "${DEVICE}" toggle 1
+run_test "get CH1 after toggle"     "${RELAYCTL}" -d "${DEVICE}" get 1
+run_test "getall after toggle CH1"  "${RELAYCTL}" -d "${DEVICE}" getall
 
 # 5) Write / read mask explicitly
-run_test "write-mask 0x0A"          "${RELAYCTL}" write-mask 0x0A
-run_test "read-mask (expect 0x0A)"  "${RELAYCTL}" read-mask
-run_test "get CH1 (0x0A => OFF)"    "${RELAYCTL}" get 1
-run_test "get CH2 (0x0A => ON)"     "${RELAYCTL}" get 2
-run_test "get CH3 (0x0A => OFF)"    "${RELAYCTL}" get 3
-run_test "get CH4 (0x0A => ON)"     "${RELAYCTL}" get 4
+run_test "write-mask 0x0A"          "${RELAYCTL}" -d "${DEVICE}" write-mask 0x0A
+run_test "read-mask (expect 0x0A)"  "${RELAYCTL}" -d "${DEVICE}" read-mask
+run_test "get CH1 (0x0A => OFF)"    "${RELAYCTL}" -d "${DEVICE}" get 1
+run_test "get CH2 (0x0A => ON)"     "${RELAYCTL}" -d "${DEVICE}" get 2
+run_test "get CH3 (0x0A => OFF)"    "${RELAYCTL}" -d "${DEVICE}" get 3
+run_test "get CH4 (0x0A => ON)"     "${RELAYCTL}" -d "${DEVICE}" get 4
 
 # 6) Error handling: bad channels, bad mask, bad commands
-run_test "bad channel (set 0 on)"      "${RELAYCTL}" set 0 on
-run_test "bad channel (set 5 on)"      "${RELAYCTL}" set 5 on
-run_test "bad mask (write-mask 0x10)"  "${RELAYCTL}" write-mask 0x10
-run_test "bad mask (write-mask xyz)"   "${RELAYCTL}" write-mask xyz
-run_test "bad command name"            "${RELAYCTL}" frobnicate
+run_test "bad channel (set 0 on)"      "${RELAYCTL}" -d "${DEVICE}" set 0 on
+run_test "bad channel (set 5 on)"      "${RELAYCTL}" -d "${DEVICE}" set 5 on
+run_test "bad mask (write-mask 0x10)"  "${RELAYCTL}" -d "${DEVICE}" write-mask 0x10
+run_test "bad mask (write-mask xyz)"   "${RELAYCTL}" -d "${DEVICE}" write-mask xyz
+run_test "bad command name"            "${RELAYCTL}" -d "${DEVICE}" frobnicate
 
 # 7) Make sure we can still talk to the device after errors
-run_test "reset after error tests"     "${RELAYCTL}" reset
-run_test "getall after final reset"    "${RELAYCTL}" getall
+run_test "reset after error tests"     "${RELAYCTL}" -d "${DEVICE}" reset
+run_test "getall after final reset"    "${RELAYCTL}" -d "${DEVICE}" getall
 
 # 8) Interactive / REPL sanity test:
 #    Send a few commands through stdin and see that they all work.
 echo "=================================================="
 echo "TEST: interactive REPL basic"
-echo "CMD : printf 'getall\nset 1 on\ngetall\nreset\ngetall\nexit\n' | ${RELAYCTL} -i"
+echo "CMD : printf 'getall\nset 1 on\ngetall\nreset\ngetall\nexit\n' | ${RELAYCTL} -d ${DEVICE} -i"
 echo "--------------------------------------------------"
-printf 'getall\nset 1 on\ngetall\nreset\ngetall\nexit\n' | "${RELAYCTL}" -i
+printf 'getall\nset 1 on\ngetall\nreset\ngetall\nexit\n' | "${RELAYCTL}" -d "${DEVICE}" -i
 status=$?
 echo "--------------------------------------------------"
 echo "Exit status: ${status}"
 echo
 
+# 8.1) Interactive REPL with shadow-mask cache (-c):
+#      Same results as above; -v reports cache hits on stderr at exit.
+echo "=================================================="
+echo "TEST: interactive REPL with -c 0 (cached mask)"
+echo "CMD : printf 'reset\nset 1 on\nset 2 on\ntoggle 1\ngetall\nread-mask\nexit\n' | ${RELAYCTL} -d ${DEVICE} -c 0 -v -i"
+echo "--------------------------------------------------"
+printf 'reset\nset 1 on\nset 2 on\ntoggle 1\ngetall\nread-mask\nexit\n' | "${RELAYCTL}" -d "${DEVICE}" -c 0 -v -i
+status=$?
+echo "--------------------------------------------------"
+echo "Exit status: ${status} (expect MASK=0x02 twice)"
+echo
+
+# 8.2) Transactions: begin/commit, abort and ';' compound lines
+echo "=================================================="
+echo "TEST: interactive REPL transactions"
+echo "CMD : printf 'reset\nbegin\nset 1 on\nset 3 on\ncommit\nbegin\nreset\nabort\ngetall\nset 2 on; toggle 1\ngetall\nset 4 on; set 5 on\ngetall\nexit\n' | ${RELAYCTL} -d ${DEVICE} -i"
+echo "--------------------------------------------------"
+printf 'reset\nbegin\nset 1 on\nset 3 on\ncommit\nbegin\nreset\nabort\ngetall\nset 2 on; toggle 1\ngetall\nset 4 on; set 5 on\ngetall\nexit\n' | "${RELAYCTL}" -d "${DEVICE}" -i
+status=$?
+echo "--------------------------------------------------"
+echo "Exit status: ${status} (expect MASK=0x05, 0x05, 0x06, 0x06 and one BAD_CHANNEL)"
+echo
+
+run_test "begin outside interactive mode (expect error)" "${RELAYCTL}" -d "${DEVICE}" begin
+
+# 8.3) Scheduler mode (-S): timed actions read from stdin
+echo "=================================================="
+echo "TEST: scheduler mode"
+echo "CMD : printf 'after 0 reset\nafter 10 set 1 on; set 3 on\nevery 5 count 3 toggle 4\nafter 30 getall\n' | ${RELAYCTL} -d ${DEVICE} -S -"
+echo "--------------------------------------------------"
+printf 'after 0 reset\nafter 10 set 1 on; set 3 on\nevery 5 count 3 toggle 4\nafter 30 getall\n' | "${RELAYCTL}" -d "${DEVICE}" -S -
+status=$?
+echo "--------------------------------------------------"
+echo "Exit status: ${status} (expect MASK=0x0D and an OK SCHED line per firing)"
+echo
+
+run_test "schedule with a bad command (expect error, nothing runs)" \
+    sh -c "printf 'after 0 reset\nafter 5 set 9 on\n' | '${RELAYCTL}' -d '${DEVICE}' -S -"
+
+# 8.4) STATS: counters and device latency for the session
+echo "=================================================="
+echo "TEST: interactive REPL stats"
+echo "CMD : printf 'reset\nset 1 on\nset 9 on\nstats\nexit\n' | ${RELAYCTL} -d ${DEVICE} -i"
+echo "--------------------------------------------------"
+printf 'reset\nset 1 on\nset 9 on\nstats\nexit\n' | "${RELAYCTL}" -d "${DEVICE}" -i
+status=$?
+echo "--------------------------------------------------"
+echo "Exit status: ${status} (expect STAT CMD=set COUNT=2 FAILED=1, ERR=BAD_CHANNEL and IO lines)"
+echo
+
+# 8.5) -r / -P: record a session, then replay it from the same start state
+REPLAY_LOG="/tmp/relayctl-test.log"
+rm -f "${REPLAY_LOG}"
+echo "=================================================="
+echo "TEST: record and replay"
+echo "CMD : printf 'reset\nset 1 on\ntoggle 2\nset 1 off; set 3 on\nexit\n' | ${RELAYCTL} -d ${DEVICE} -r ${REPLAY_LOG} -i"
+echo "CMD : ${RELAYCTL} -d ${DEVICE} reset; ${RELAYCTL} -d ${DEVICE} -P ${REPLAY_LOG} -x 0"
+echo "--------------------------------------------------"
+printf 'reset\nset 1 on\ntoggle 2\nset 1 off; set 3 on\nexit\n' | "${RELAYCTL}" -d "${DEVICE}" -r "${REPLAY_LOG}" -i
+"${RELAYCTL}" -d "${DEVICE}" reset
+"${RELAYCTL}" -d "${DEVICE}" -P "${REPLAY_LOG}" -x 0
+status=$?
+echo "--------------------------------------------------"
+echo "Exit status: ${status} (expect 0, OK REPLAY RECORDS=7 FAILED=0 DIVERGED=0)"
+echo
+
+# 8.5b) -r appends a second run to the log; the replay does not wait out
+#       the idle time between the two runs
+echo "=================================================="
+echo "TEST: replay across recording runs"
+echo "CMD : sleep 2; ${RELAYCTL} -d ${DEVICE} -r ${REPLAY_LOG} set 2 on; ${RELAYCTL} -d ${DEVICE} reset; ${RELAYCTL} -d ${DEVICE} -P ${REPLAY_LOG}"
+echo "--------------------------------------------------"
+sleep 2
+"${RELAYCTL}" -d "${DEVICE}" -r "${REPLAY_LOG}" set 2 on
+"${RELAYCTL}" -d "${DEVICE}" reset
+"${RELAYCTL}" -d "${DEVICE}" -P "${REPLAY_LOG}"
+status=$?
+echo "--------------------------------------------------"
+echo "Exit status: ${status} (expect 0, OK REPLAY RECORDS=8 DIVERGED=0 with ELAPSED_S well below 2)"
+echo
+
+# 8.6) WATCH: a change made by another process is reported, then the
+#      next line ends the watch with its summary
+echo "=================================================="
+echo "TEST: watch"
+echo "CMD : (echo watch; sleep 1; echo exit) | ${RELAYCTL} -d ${DEVICE} -i  &&  ${RELAYCTL} -d ${DEVICE} set 2 on"
+echo "--------------------------------------------------"
+"${RELAYCTL}" -d "${DEVICE}" reset
+(echo "watch"; sleep 1; echo "exit") | "${RELAYCTL}" -d "${DEVICE}" -i &
+sleep 0.3
+"${RELAYCTL}" -d "${DEVICE}" set 2 on
+wait $!
+status=$?
+echo "--------------------------------------------------"
+echo "Exit status: ${status} (expect OK MASK=0x00, OK MASK=0x02, OK WATCH CHANGES=1 ... MODE=NOTIFY)"
+echo
+
+run_test "watch ended by a line read together with it (expect OK WATCH, then OK CH=2 at once)" \
+    sh -c "(printf 'watch\nget 2\n'; sleep 3; echo exit) | '${RELAYCTL}' -d '${DEVICE}' -i"
+
+# 8.7) Scenes: one write per scene, unlisted channels OFF
+SCENE_FILE="/tmp/relayctl-test.scenes"
+printf 'SCENE load-test = 1 on, 3 on\nSCENE idle =\n' > "${SCENE_FILE}"
+run_test "scene load-test (expect OK MASK=0x05)" \
+    "${RELAYCTL}" -d "${DEVICE}" -C "${SCENE_FILE}" scene load-test
+
+run_test "scene idle (expect OK MASK=0x00)" \
+    "${RELAYCTL}" -d "${DEVICE}" -C "${SCENE_FILE}" scene idle
+
+run_test "unknown scene (expect ERR BAD_COMMAND)" \
+    "${RELAYCTL}" -d "${DEVICE}" -C "${SCENE_FILE}" scene nope
+
+# 8.8) Interlocks: CH1 and CH2 never on together
+RULE_FILE="/tmp/relayctl-test.rules"
+printf 'EXCLUSIVE 1 2\n' > "${RULE_FILE}"
+run_test "interlocked write-mask 0x03 (expect ERR INTERLOCK)" \
+    "${RELAYCTL}" -d "${DEVICE}" -L "${RULE_FILE}" write-mask 0x03
+
+run_test "allowed write-mask 0x05 (expect OK MASK=0x05)" \
+    "${RELAYCTL}" -d "${DEVICE}" -L "${RULE_FILE}" write-mask 0x05
+
+run_test "interlocked set 2 on (expect ERR INTERLOCK)" \
+    "${RELAYCTL}" -d "${DEVICE}" -L "${RULE_FILE}" set 2 on
+
+# 8.9) Ring server (-Q): ring_bench starts one, runs write-mask round
+#      trips through it and through a binary session, then stops it
+RING_BENCH="${RING_BENCH:-../bench/ring_bench}"
+if [ -x "${RING_BENCH}" ]; then
+    run_test "ring server round trips (expect errs 0 in every case)" \
+        "${RING_BENCH}" -r "${RELAYCTL}" -d "${DEVICE}" -n 1000
+else
+    echo "SKIP: ${RING_BENCH} not built (make bench)"
+fi
+
+run_test "-Q with a command (expect ERR BAD_COMMAND)" \
+    "${RELAYCTL}" -d "${DEVICE}" -Q relayctl-test getall
+
 # 9) -d flag tests (device override)
 echo "=================================================="
 echo "TEST GROUP: -d (device override)"
 echo
 
-# 9.1 -d with the default device path (should behave exactly like no -d)
-run_test "-d with default device" \
+# 9.1 -d with the test device (as every test above)
+run_test "-d with the test device" \
     "${RELAYCTL}" -d "${DEVICE}" getall
 
 # 9.2 -d with a symlink to the real device (tests path override logic)
@@ -129,4 +270,18 @@ run_test "-d with symlink (getall)" \
 run_test "-d with missing device" \
     "${RELAYCTL}" -d "/dev/usbrelay-does-not-exist" ping
 
+# 9.4 Repeated -d: multi-board addressing (both paths reach the same
+#     physical board here, so expect matching masks on board 0 and 1)
+run_test "two boards (write-mask all 0x03)" \
+    "${RELAYCTL}" -d "${DEVICE}" -d "${ALT_DEVICE}" write-mask all 0x03
+
+run_test "two boards (getall 1)" \
+    "${RELAYCTL}" -d "${DEVICE}" -d "${ALT_DEVICE}" getall 1
+
+run_test "two boards (ping via group)" \
+    "${RELAYCTL}" -d "${DEVICE}" -d "${ALT_DEVICE}" -g pair=0-1 ping pair
+
+run_test "two boards (bad board, expect BAD_BOARD)" \
+    "${RELAYCTL}" -d "${DEVICE}" -d "${ALT_DEVICE}" get 2:1
+
 echo "=== End of relayctl tests ==="